@@ -0,0 +1,182 @@
+//------------------------------------------------------------------------------
+//
+// Example: local client over the Unix domain socket transport
+//
+// Sends the image in a sealed memfd and reads the result from the memfd the
+// server returns. See servers/local-server.hpp for the protocol.
+//
+//------------------------------------------------------------------------------
+
+#include <opencv2/imgcodecs.hpp>
+#include "../dep/json/include/nlohmann/json.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+static std::runtime_error errno_error(std::string const &what)
+{
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// Copies bytes into a memfd sealed against resizing, so the server can map it
+static int sealed_memfd(const unsigned char *data, std::size_t size)
+{
+  int fd = memfd_create("local-client-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    throw errno_error("memfd_create");
+  if (ftruncate(fd, size) != 0)
+    throw errno_error("ftruncate");
+  void *p = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    throw errno_error("mmap");
+  std::memcpy(p, data, size);
+  munmap(p, size);
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)
+    throw errno_error("F_ADD_SEALS");
+  return fd;
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    // Check command line arguments.
+    if (argc != 4 && argc != 5)
+    {
+      std::cerr << "Usage: local_client <socket path> <image path> <pipeline json> [--raw]\n"
+                << "Example:\n"
+                << "   ./local_client /tmp/vision_tools.sock ./image.jpeg '{\"DetectEdges\": true}'\n"
+                << "--raw sends decoded BGR pixels instead of the file bytes.\n";
+      return EXIT_FAILURE;
+    }
+    std::string socket_path = argv[1];
+    std::string image_path = argv[2];
+    json request;
+    request["pipeline"] = json::parse(argv[3]);
+    bool raw = argc == 5 && std::string(argv[4]) == "--raw";
+
+    // Put the image into shared memory
+    int image_fd;
+    if (raw)
+    {
+      cv::Mat image = cv::imread(image_path, cv::IMREAD_COLOR);
+      if (image.empty())
+        throw std::runtime_error("Could not read image: " + image_path);
+      if (!image.isContinuous())
+        image = image.clone();
+      image_fd = sealed_memfd(image.data, image.total() * image.elemSize());
+      request["format"] = "raw";
+      request["width"] = image.cols;
+      request["height"] = image.rows;
+      request["channels"] = image.channels();
+      request["output"] = "raw";
+    }
+    else
+    {
+      std::ifstream file(image_path, std::ios::binary);
+      if (!file)
+        throw std::runtime_error("Could not open file: " + image_path);
+      std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      if (bytes.empty())
+        throw std::runtime_error("File is empty: " + image_path);
+      image_fd = sealed_memfd(bytes.data(), bytes.size());
+      request["format"] = "encoded";
+      request["size"] = bytes.size();
+      request["output"] = "jpeg";
+    }
+
+    // Connect
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (sock < 0 || socket_path.size() >= sizeof(addr.sun_path))
+      throw std::runtime_error("Invalid socket path: " + socket_path);
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+      throw errno_error("connect");
+
+    // Send the header with the image descriptor
+    std::string header = request.dump();
+    iovec iov{header.data(), header.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(c), &image_fd, sizeof(int));
+    if (sendmsg(sock, &msg, 0) < 0)
+      throw errno_error("sendmsg");
+    close(image_fd);
+
+    // Receive the reply and the result descriptor
+    std::vector<char> buffer(64 * 1024);
+    iovec reply_iov{buffer.data(), buffer.size()};
+    alignas(cmsghdr) char reply_control[CMSG_SPACE(sizeof(int))];
+    msghdr reply_msg{};
+    reply_msg.msg_iov = &reply_iov;
+    reply_msg.msg_iovlen = 1;
+    reply_msg.msg_control = reply_control;
+    reply_msg.msg_controllen = sizeof(reply_control);
+    ssize_t n = recvmsg(sock, &reply_msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+      throw errno_error("recvmsg");
+    close(sock);
+
+    json reply = json::parse(buffer.begin(), buffer.begin() + n);
+    if (reply.value("status", "") != "ok")
+      throw std::runtime_error(reply.value("message", std::string("Unknown error")));
+
+    cmsghdr *rc = CMSG_FIRSTHDR(&reply_msg);
+    if (!rc || rc->cmsg_type != SCM_RIGHTS)
+      throw std::runtime_error("Reply carried no result descriptor");
+    int result_fd;
+    std::memcpy(&result_fd, CMSG_DATA(rc), sizeof(int));
+
+    std::size_t size = reply.at("size");
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, result_fd, 0);
+    if (p == MAP_FAILED)
+      throw errno_error("mmap");
+    const unsigned char *result = static_cast<const unsigned char *>(p);
+
+    // Save the result
+    if (raw)
+    {
+      int channels = reply.at("channels");
+      cv::Mat processed(reply.at("height").get<int>(), reply.at("width").get<int>(), CV_8UC(channels),
+                        const_cast<unsigned char *>(result), reply.at("stride").get<std::size_t>());
+      cv::imwrite("processed_image.png", processed);
+    }
+    else
+    {
+      std::ofstream output_file("processed_image.jpg", std::ios::binary);
+      output_file.write(reinterpret_cast<const char *>(result), size);
+    }
+    munmap(p, size);
+    close(result_fd);
+  }
+  catch (std::exception const &e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,9 +1,22 @@
 // Handles an HTTP server connection
 #include <iostream>
+#include <algorithm>
 #include <exception>
 #include <cstdlib>
 #include <cctype>
+#include <fstream>
+#include <string>
 #include "servers/sync-server.hpp"
+#include "servers/blur.hpp"
+#include "servers/threading.hpp"
+#include "servers/batch-runner.hpp"
+#include "servers/video-runner.hpp"
+#include "servers/tracing.hpp"
+#include "servers/replay-runner.hpp"
+#include "servers/logger.hpp"
+#include "servers/dispatcher.hpp"
+#include "servers/overlay.hpp"
+#include <unistd.h>
 
 bool isNumber(const char* s)
 {
@@ -19,14 +32,327 @@ bool isNumber(const char* s)
     return true;
 }
 
+// Splits "--name=value" into its parts; returns false for anything else
+bool parseOption(const std::string& arg, std::string& name, std::string& value)
+{
+    if (arg.compare(0, 2, "--") != 0)
+        return false;
+
+    auto eq = arg.find('=');
+    name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+    value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+    return !name.empty();
+}
+
+double parseDecimal(const std::string& name, const std::string& value)
+{
+    char* end = nullptr;
+    double result = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0')
+        throw std::invalid_argument("Option --" + name + " expects a number. Given: " + value);
+    return result;
+}
+
+nlohmann::json loadJsonFile(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::invalid_argument("Cannot open " + path);
+    return nlohmann::json::parse(file);
+}
+
+// Options shared by the server and batch mode; returns false if `name` is not one
+bool parseEngineOption(const std::string& name, const std::string& value, mj::BlurOptions& blur, mj::ThreadingOptions& threading)
+{
+    if (name == "fast-blur-sigma")
+        blur.sigma_threshold = parseDecimal(name, value);
+    else if (name == "fast-blur-passes" && isNumber(value.c_str()))
+        blur.passes = std::atoi(value.c_str());
+    else if (name == "intra-op-threads" && isNumber(value.c_str()))
+        threading.intra_op_threads = std::atoi(value.c_str());
+    else if (name == "adaptive-threads" && value.empty())
+        threading.adaptive = true;
+    else if (name == "pin-threads" && value.empty())
+        threading.pin_threads = true;
+    else if (name == "overlay-dir" && !value.empty())
+        mj::load_overlay_logos(value);
+    else
+        return false;
+    return true;
+}
+
+// vision_tools batch <pipeline.json> <input dir | manifest> <output dir> [options]
+int runBatch(int argc, const char **argv)
+{
+    if (argc < 5)
+    {
+        std::cerr << "Usage: " << argv[0] << " batch <pipeline.json> <input dir | manifest> <output dir> [options]\n"
+                  << "Options:\n"
+                  << "   --format=<ext>         output format such as png (default: keep the input's)\n"
+                  << "   --workers=<n>          pipeline threads (default: CPU count)\n"
+                  << "   --decoders=<n>         decoder threads (default: CPU count)\n"
+                  << "   --readers=<n>          file reader threads (default 2)\n"
+                  << "   --writers=<n>          encoder/writer threads (default 2)\n"
+                  << "   --queue-depth=<n>      images buffered between stages (default 8)\n"
+                  << "   and the server's --fast-blur-*, --intra-op-threads, --adaptive-threads, --pin-threads, --overlay-dir\n";
+        return 1;
+    }
+
+    mj::BatchOptions batch;
+    batch.pipeline = loadJsonFile(argv[2]);
+    batch.input = argv[3];
+    batch.output = argv[4];
+
+    mj::BlurOptions blur = mj::blur_options();
+    mj::ThreadingOptions threading;
+    for (int i = 5; i < argc; ++i)
+    {
+        std::string name, value;
+        if (!parseOption(argv[i], name, value))
+            throw std::invalid_argument(std::string("Unexpected argument: ") + argv[i]);
+
+        if (parseEngineOption(name, value, blur, threading))
+            continue;
+        if (name == "format" && !value.empty())
+            batch.format = value[0] == '.' ? value.substr(1) : value;
+        else if (name == "workers" && isNumber(value.c_str()))
+            batch.workers = std::atoi(value.c_str());
+        else if (name == "decoders" && isNumber(value.c_str()))
+            batch.decoders = std::atoi(value.c_str());
+        else if (name == "readers" && isNumber(value.c_str()))
+            batch.readers = std::atoi(value.c_str());
+        else if (name == "writers" && isNumber(value.c_str()))
+            batch.writers = std::atoi(value.c_str());
+        else if (name == "queue-depth" && isNumber(value.c_str()))
+            batch.queue_depth = std::atoi(value.c_str());
+        else
+            throw std::invalid_argument("Unknown or malformed option --" + name);
+    }
+    mj::set_blur_options(blur);
+    mj::configure_threading(threading, batch.workers);
+
+    mj::BatchReport report = mj::run_batch(batch, std::cerr);
+    for (auto const& failure : report.failures)
+        std::cerr << "FAILED " << failure.first << ": " << failure.second << "\n";
+    std::cerr << report.succeeded << " of " << report.total << " files processed in " << report.seconds << " s ("
+              << report.total / std::max(report.seconds, 1e-3) << " files/s, "
+              << report.bytes_read / std::max(report.seconds, 1e-3) / (1 << 20) << " MB/s read, "
+              << report.bytes_written / std::max(report.seconds, 1e-3) / (1 << 20) << " MB/s written)" << std::endl;
+    return report.failed > 0 ? 8 : 0;
+}
+
+// vision_tools video <pipeline.json> <input video> <output video | directory/> [options]
+int runVideo(int argc, const char **argv)
+{
+    if (argc < 5)
+    {
+        std::cerr << "Usage: " << argv[0] << " video <pipeline.json> <input video> <output video | directory/> [options]\n"
+                  << "Options:\n"
+                  << "   --workers=<n>          frames processed at once (default: CPU count)\n"
+                  << "   --window=<n>           frames buffered for reordering (default: 2 x workers)\n"
+                  << "   --fourcc=<code>        output codec such as mp4v or MJPG (default: by extension)\n"
+                  << "   --fps=<f>              output frame rate (default: the input's)\n"
+                  << "   --format=<ext>         image sequence format when the output is a directory (default png)\n"
+                  << "   and the server's --fast-blur-*, --intra-op-threads, --adaptive-threads, --pin-threads, --overlay-dir\n";
+        return 1;
+    }
+
+    mj::VideoOptions video;
+    video.pipeline = loadJsonFile(argv[2]);
+    video.input = argv[3];
+    video.output = argv[4];
+
+    mj::BlurOptions blur = mj::blur_options();
+    mj::ThreadingOptions threading;
+    for (int i = 5; i < argc; ++i)
+    {
+        std::string name, value;
+        if (!parseOption(argv[i], name, value))
+            throw std::invalid_argument(std::string("Unexpected argument: ") + argv[i]);
+
+        if (parseEngineOption(name, value, blur, threading))
+            continue;
+        if (name == "workers" && isNumber(value.c_str()))
+            video.workers = std::atoi(value.c_str());
+        else if (name == "window" && isNumber(value.c_str()))
+            video.window = std::atoi(value.c_str());
+        else if (name == "fourcc" && value.size() == 4)
+            video.fourcc = value;
+        else if (name == "fps")
+            video.fps = parseDecimal(name, value);
+        else if (name == "format" && !value.empty())
+            video.format = value[0] == '.' ? value.substr(1) : value;
+        else
+            throw std::invalid_argument("Unknown or malformed option --" + name);
+    }
+    mj::set_blur_options(blur);
+    mj::configure_threading(threading, video.workers);
+
+    mj::VideoReport report = mj::run_video(video, std::cerr);
+    std::cerr << report.frames << " frames (" << report.size.width << "x" << report.size.height << ") in "
+              << report.seconds << " s, " << report.frames / std::max(report.seconds, 1e-3) << " frames/s on "
+              << report.workers << (report.temporal ? " worker (temporal pipeline)" : " workers") << std::endl;
+    return 0;
+}
+
+// vision_tools replay <capture file> [options]
+int runReplay(int argc, const char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " replay <capture file> [options]\n"
+                  << "Options:\n"
+                  << "   --target=<host:port>   replay against a server (default: in-process)\n"
+                  << "   --speed=<x>            time scale, 2 = twice as fast, 0 = no pauses (default 1)\n"
+                  << "   --max-gap=<s>          longest pause between requests before scaling (default: none)\n"
+                  << "   --concurrency=<n>      requests in flight (default: CPU count)\n"
+                  << "   --limit=<n>            replay only the first n requests\n"
+                  << "   and the server's --fast-blur-*, --intra-op-threads, --adaptive-threads, --pin-threads, --overlay-dir\n";
+        return 1;
+    }
+
+    mj::ReplayOptions replay;
+    replay.capture = argv[2];
+
+    mj::BlurOptions blur = mj::blur_options();
+    mj::ThreadingOptions threading;
+    for (int i = 3; i < argc; ++i)
+    {
+        std::string name, value;
+        if (!parseOption(argv[i], name, value))
+            throw std::invalid_argument(std::string("Unexpected argument: ") + argv[i]);
+
+        if (parseEngineOption(name, value, blur, threading))
+            continue;
+        auto colon = value.rfind(':');
+        if (name == "target" && colon != std::string::npos && colon > 0 && isNumber(value.c_str() + colon + 1))
+        {
+            replay.host = value.substr(0, colon);
+            replay.port = value.substr(colon + 1);
+        }
+        else if (name == "speed")
+            replay.speed = parseDecimal(name, value);
+        else if (name == "max-gap")
+            replay.max_gap = parseDecimal(name, value);
+        else if (name == "concurrency" && isNumber(value.c_str()))
+            replay.concurrency = std::atoi(value.c_str());
+        else if (name == "limit" && isNumber(value.c_str()))
+            replay.limit = std::strtoul(value.c_str(), nullptr, 10);
+        else
+            throw std::invalid_argument("Unknown or malformed option --" + name);
+    }
+    mj::set_blur_options(blur);
+    mj::configure_threading(threading, replay.concurrency);
+
+    mj::ReplayReport report = mj::run_replay(replay, std::cerr);
+    std::cerr << report.succeeded << " of " << report.requests << " requests succeeded in " << report.seconds << " s ("
+              << report.throughput << " requests/s)\n"
+              << "latency ms: p50 " << report.latency_p50 << ", p90 " << report.latency_p90
+              << ", p99 " << report.latency_p99 << ", max " << report.latency_max << "\n"
+              << "service ms: p50 " << report.service_p50 << ", p99 " << report.service_p99 << std::endl;
+    return report.failed > 0 ? 8 : 0;
+}
+
+// vision_tools dispatch <host> <port> [options] [-- worker options]
+int runDispatch(int argc, const char **argv)
+{
+    if (argc < 4 || !isNumber(argv[3]))
+    {
+        std::cerr << "Usage: " << argv[0] << " dispatch <host> <port> [options] [-- worker options]\n"
+                  << "Options:\n"
+                  << "   --processes=<n>        worker processes (default 2)\n"
+                  << "   --worker-port=<p>      port of the first worker, on 127.0.0.1 (default: port + 1)\n"
+                  << "   --retries=<n>          other workers tried when one fails or is busy (default 1)\n"
+                  << "   --timeout=<s>          seconds a worker may take to answer (default 120)\n"
+                  << "   Options after -- are passed to every worker, e.g. -- --optimize=strict\n"
+                  << "   (by default each worker gets its share of the cores and memory budget)\n";
+        return 1;
+    }
+
+    mj::DispatcherOptions options;
+    options.host = argv[2];
+    options.port = argv[3];
+    int port = std::atoi(argv[3]);
+    if (port <= 0 || port > 65535)
+        throw std::invalid_argument("Port must be in range 1-65535. Given: " + options.port);
+
+    int i = 4;
+    for (; i < argc && std::string(argv[i]) != "--"; ++i)
+    {
+        std::string name, value;
+        if (!parseOption(argv[i], name, value))
+            throw std::invalid_argument(std::string("Unexpected argument: ") + argv[i]);
+
+        if (name == "processes" && isNumber(value.c_str()) && std::atoi(value.c_str()) > 0)
+            options.processes = std::atoi(value.c_str());
+        else if (name == "worker-port" && isNumber(value.c_str()))
+            options.worker_port = std::atoi(value.c_str());
+        else if (name == "retries" && isNumber(value.c_str()))
+            options.retries = std::atoi(value.c_str());
+        else if (name == "timeout" && isNumber(value.c_str()) && std::atoi(value.c_str()) > 0)
+            options.timeout = std::chrono::seconds(std::atoi(value.c_str()));
+        else
+            throw std::invalid_argument("Unknown or malformed option --" + name);
+    }
+    for (++i; i < argc; ++i)
+        options.worker_args.push_back(argv[i]);
+
+    // Workers run this same binary
+    char path[4096];
+    ssize_t length = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    options.executable = length > 0 ? std::string(path, length) : std::string(argv[0]);
+
+    mj::start_logging(mj::LogOptions());
+    mj::run_dispatcher(options);
+    return 0;
+}
+
 int main(int argc, const char **argv)
 {
     try
     {
+        // Offline batch and video modes
+        if (argc >= 2 && std::string(argv[1]) == "batch")
+            return runBatch(argc, argv);
+        if (argc >= 2 && std::string(argv[1]) == "video")
+            return runVideo(argc, argv);
+        if (argc >= 2 && std::string(argv[1]) == "replay")
+            return runReplay(argc, argv);
+        if (argc >= 2 && std::string(argv[1]) == "dispatch")
+            return runDispatch(argc, argv);
+
         // Validate arguments
         if (argc < 3)
         {
-            std::cerr << "Usage: " << argv[0] << " <host> <port>\n";
+            std::cerr << "Usage: " << argv[0] << " <host> <port> [options]\n"
+                      << "       " << argv[0] << " batch <pipeline.json> <input dir | manifest> <output dir> [options]\n"
+                      << "       " << argv[0] << " video <pipeline.json> <input video> <output video | directory/> [options]\n"
+                      << "       " << argv[0] << " replay <capture file> [options]\n"
+                      << "       " << argv[0] << " dispatch <host> <port> [options] [-- worker options]\n"
+                      << "Options:\n"
+                      << "   --workers=<n>          concurrent image jobs (default: CPU count)\n"
+                      << "   --tenants=<file.json>  tenant weights, concurrency caps and API keys\n"
+                      << "   --local-socket=<path>  also serve co-located clients on a Unix socket (shared memory)\n"
+                      << "   --fast-blur-sigma=<s>  Gaussian sigma from which blurs use the box cascade (0 = never, default 8)\n"
+                      << "   --fast-blur-passes=<n> box passes in the cascade, 3-5 (default 3)\n"
+                      << "   --intra-op-threads=<n> threads one request may use (default: CPU count / workers)\n"
+                      << "   --adaptive-threads     give large images idle cores when few requests are in flight\n"
+                      << "   --pin-threads          pin intra-op helper threads to CPU cores (Linux)\n"
+                      << "   --overlay-dir=<dir>    logos for the Overlay stage, named by file stem\n"
+                      << "   --server-timing        Server-Timing header on every response (else only with X-Debug-Timing: 1)\n"
+                      << "   --trace[=<events>]     keep the last spans for GET /debug/trace and SIGUSR1 (default 65536)\n"
+                      << "   --capture=<file>       append sampled requests to a capture file for replay\n"
+                      << "   --capture-rate=<f>     fraction of requests captured (default 0.01)\n"
+                      << "   --image-store-mb=<n>   memory for uploads referenced by img_ref (0 = off, default 256)\n"
+                      << "   --image-store-ttl=<s>  seconds an unused upload is kept (default 600)\n"
+                      << "   --image-store-encoded  keep uploads encoded only (less memory, decoded per request)\n"
+                      << "   --access-log=<file>    one JSON line per request (\"-\" = stdout)\n"
+                      << "   --memory-budget-mb=<n> working memory shared by all requests (default: half of RAM)\n"
+                      << "   --max-pixels=<n>       largest image accepted, in pixels (default 100000000)\n"
+                      << "   --presets=<file.json>  named pipelines requests select with \"preset\"\n"
+                      << "   --optimize=<mode>      reorder stages by cost: off (default), strict or approx\n"
+                      << "   --jpeg-yuv             run luma-only pipelines on JPEG's own YCbCr planes (libjpeg-turbo)\n"
+                      << "   --warmup=<px>          side of the synthetic image warmed up on before GET /ready (0 = none, default 1024)\n";
             return 1;
         }
 
@@ -48,7 +374,70 @@ int main(int argc, const char **argv)
             return 3;
         }
 
-        mj::SyncServer server(host, portStr);
+        mj::ServerOptions options;
+        mj::LogOptions logging;
+        mj::BlurOptions blur = mj::blur_options();
+        mj::ThreadingOptions threading;
+        int workers = 0;
+        std::size_t trace_events = 0;
+        for (int i = 3; i < argc; ++i)
+        {
+            std::string name, value;
+            if (!parseOption(argv[i], name, value))
+                throw std::invalid_argument(std::string("Unexpected argument: ") + argv[i]);
+
+            if (parseEngineOption(name, value, blur, threading))
+                continue;
+            if (name == "tenants")
+                options.scheduler = mj::SchedulerConfig::from_json(loadJsonFile(value));
+            else if (name == "local-socket" && !value.empty())
+                options.local_socket = value;
+            else if (name == "capture" && !value.empty())
+                options.capture = value;
+            else if (name == "capture-rate")
+                options.capture_rate = parseDecimal(name, value);
+            else if (name == "image-store-mb" && isNumber(value.c_str()))
+                options.image_store_bytes = std::strtoull(value.c_str(), nullptr, 10) << 20;
+            else if (name == "image-store-ttl" && isNumber(value.c_str()) && std::atoi(value.c_str()) > 0)
+                options.image_store_ttl = std::chrono::seconds(std::atoi(value.c_str()));
+            else if (name == "image-store-encoded" && value.empty())
+                options.image_store_decoded = false;
+            else if (name == "memory-budget-mb" && isNumber(value.c_str()) && std::strtoull(value.c_str(), nullptr, 10) > 0)
+                options.memory_budget = std::strtoull(value.c_str(), nullptr, 10) << 20;
+            else if (name == "max-pixels" && isNumber(value.c_str()) && std::strtoull(value.c_str(), nullptr, 10) > 0)
+                options.max_pixels = std::strtoull(value.c_str(), nullptr, 10);
+            else if (name == "presets")
+                options.presets = loadJsonFile(value);
+            else if (name == "optimize")
+                options.optimize = mj::parse_optimize_mode(value);
+            else if (name == "jpeg-yuv" && value.empty())
+                options.jpeg_yuv = true;
+            else if (name == "warmup" && isNumber(value.c_str()))
+                options.warmup_size = std::atoi(value.c_str());
+            else if (name == "access-log" && !value.empty())
+                logging.access_log = value;
+            else if (name == "server-timing" && value.empty())
+                options.server_timing = true;
+            else if (name == "trace" && (value.empty() || isNumber(value.c_str())))
+                trace_events = value.empty() ? 65536 : std::strtoul(value.c_str(), nullptr, 10);
+            else if (name == "workers" && isNumber(value.c_str()))
+                workers = std::atoi(value.c_str());
+            else
+                throw std::invalid_argument("Unknown or malformed option --" + name);
+        }
+        if (workers > 0)
+            options.scheduler.worker_slots = workers;
+        if (trace_events > 0)
+        {
+            // Before any thread starts, so only the waiter thread gets SIGUSR1
+            mj::enable_tracing(trace_events);
+            mj::install_trace_signal();
+        }
+        mj::start_logging(logging);
+        mj::set_blur_options(blur);
+        mj::configure_threading(threading, options.scheduler.worker_slots);
+
+        mj::SyncServer server(host, portStr, options);
         server.run();
     }
     catch (const std::invalid_argument &e)
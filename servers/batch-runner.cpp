@@ -0,0 +1,322 @@
+#include "batch-runner.hpp"
+#include "bounded-queue.hpp"
+#include "pipeline.hpp"
+#include "threading.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+// Read-only mapping of a whole input file
+class MappedFile
+{
+public:
+    explicit MappedFile(std::string const &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error(std::string("Cannot open: ") + std::strerror(errno));
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > INT_MAX)
+        {
+            close(fd);
+            throw std::runtime_error("Empty, oversized or unreadable file");
+        }
+
+        _size = static_cast<std::size_t>(st.st_size);
+        void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error(std::string("Cannot map: ") + std::strerror(errno));
+        madvise(p, _size, MADV_SEQUENTIAL);
+        madvise(p, _size, MADV_WILLNEED);
+        _data = static_cast<unsigned char *>(p);
+    }
+
+    ~MappedFile() { munmap(_data, _size); }
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    unsigned char *data() const { return _data; }
+    std::size_t size() const { return _size; }
+
+private:
+    unsigned char *_data = nullptr;
+    std::size_t _size = 0;
+};
+
+struct BatchItem
+{
+    std::size_t index = 0;
+    std::unique_ptr<MappedFile> file;
+    cv::Mat image;
+};
+
+struct Job
+{
+    fs::path input;
+    fs::path output;
+};
+
+bool is_image_file(fs::path const &path)
+{
+    static const std::set<std::string> extensions = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".webp", ".ppm", ".pgm"};
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extensions.count(ext) > 0;
+}
+
+fs::path output_path(fs::path const &output_dir, fs::path relative, std::string const &format)
+{
+    if (!format.empty())
+        relative.replace_extension("." + format);
+    return output_dir / relative;
+}
+
+// Directory: every image file below it, keeping the relative layout.
+// Manifest: one input path per line ('#' starts a comment), written flat.
+std::vector<Job> list_jobs(BatchOptions const &options, BatchReport &report)
+{
+    fs::path input(options.input);
+    fs::path output(options.output);
+    std::vector<Job> jobs;
+
+    std::error_code ec;
+    if (fs::is_directory(input, ec))
+    {
+        for (auto const &entry : fs::recursive_directory_iterator(input, fs::directory_options::skip_permission_denied))
+        {
+            if (entry.is_regular_file(ec) && is_image_file(entry.path()))
+                jobs.push_back({entry.path(), output_path(output, fs::relative(entry.path(), input), options.format)});
+        }
+        std::sort(jobs.begin(), jobs.end(), [](Job const &a, Job const &b) { return a.input < b.input; });
+        return jobs;
+    }
+
+    std::ifstream manifest(options.input);
+    if (!manifest)
+        throw std::invalid_argument("Cannot read input directory or manifest: " + options.input);
+
+    std::set<fs::path> outputs;
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        fs::path path(line);
+        fs::path target = output_path(output, path.filename(), options.format);
+        if (!outputs.insert(target).second)
+        {
+            report.failures.emplace_back(line, "Duplicate output name " + target.string());
+            continue;
+        }
+        jobs.push_back({path, target});
+    }
+    return jobs;
+}
+
+// Writes through a temporary file so a crash never leaves a truncated image
+void write_file(fs::path const &path, std::vector<unsigned char> const &bytes)
+{
+    if (path.has_parent_path())
+        fs::create_directories(path.parent_path());
+
+    fs::path tmp = path;
+    tmp += ".part";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!out)
+            throw std::runtime_error("Cannot write " + tmp.string());
+    }
+    fs::rename(tmp, path);
+}
+
+} // namespace
+
+BatchReport mj::run_batch(BatchOptions const &options, std::ostream &progress)
+{
+    BatchReport report;
+
+    std::unique_ptr<PipelinePlan const> plan;
+    try
+    {
+        plan = std::make_unique<PipelinePlan const>(canonicalize_pipeline(options.pipeline));
+    }
+    catch (const json::exception &e)
+    {
+        throw std::invalid_argument(std::string("Invalid pipeline: ") + e.what());
+    }
+
+    std::vector<Job> jobs = list_jobs(options, report);
+    report.total = jobs.size() + report.failures.size();
+    report.failed = report.failures.size();
+
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int readers = std::max(1, options.readers);
+    int decoders = options.decoders > 0 ? options.decoders : cores;
+    int workers = options.workers > 0 ? options.workers : cores;
+    int writers = std::max(1, options.writers);
+
+    BoundedQueue<BatchItem> to_decode(options.queue_depth, readers);
+    BoundedQueue<BatchItem> to_process(options.queue_depth, decoders);
+    BoundedQueue<BatchItem> to_write(options.queue_depth, workers);
+
+    std::mutex report_mutex;
+    std::atomic<std::size_t> next_job{0};
+    std::atomic<std::size_t> finished{0};
+    std::atomic<std::uint64_t> bytes_read{0};
+    std::atomic<std::uint64_t> bytes_written{0};
+
+    auto fail = [&](std::size_t index, std::string const &reason) {
+        std::lock_guard<std::mutex> lock(report_mutex);
+        report.failures.emplace_back(jobs[index].input.string(), reason);
+        ++finished;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; ++i)
+        threads.emplace_back([&] {
+            for (std::size_t index = next_job++; index < jobs.size(); index = next_job++)
+            {
+                try
+                {
+                    BatchItem item;
+                    item.index = index;
+                    item.file = std::make_unique<MappedFile>(jobs[index].input.string());
+                    bytes_read += item.file->size();
+                    to_decode.push(std::move(item));
+                }
+                catch (const std::exception &e)
+                {
+                    fail(index, e.what());
+                }
+            }
+            to_decode.producer_done();
+        });
+
+    for (int i = 0; i < decoders; ++i)
+        threads.emplace_back([&] {
+            while (auto item = to_decode.pop())
+            {
+                try
+                {
+                    cv::Mat bytes(1, static_cast<int>(item->file->size()), CV_8UC1, item->file->data());
+                    item->image = cv::imdecode(bytes, cv::IMREAD_COLOR);
+                    item->file.reset();
+                    if (item->image.empty())
+                        throw std::runtime_error("Failed to decode image");
+                    to_process.push(std::move(*item));
+                }
+                catch (const std::exception &e)
+                {
+                    fail(item->index, e.what());
+                }
+            }
+            to_process.producer_done();
+        });
+
+    for (int i = 0; i < workers; ++i)
+        threads.emplace_back([&] {
+            while (auto item = to_process.pop())
+            {
+                try
+                {
+                    IntraOpScope scope(item->image.total());
+                    item->image = plan->run(item->image);
+                    to_write.push(std::move(*item));
+                }
+                catch (const std::exception &e)
+                {
+                    fail(item->index, e.what());
+                }
+            }
+            to_write.producer_done();
+        });
+
+    for (int i = 0; i < writers; ++i)
+        threads.emplace_back([&] {
+            while (auto item = to_write.pop())
+            {
+                try
+                {
+                    fs::path const &target = jobs[item->index].output;
+                    std::vector<unsigned char> encoded;
+                    if (!cv::imencode(target.extension().string(), item->image, encoded))
+                        throw std::runtime_error("Failed to encode " + target.string());
+                    write_file(target, encoded);
+                    bytes_written += encoded.size();
+                    ++finished;
+                }
+                catch (const std::exception &e)
+                {
+                    fail(item->index, e.what());
+                }
+            }
+        });
+
+    // Progress until every file has left the pipeline
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    auto print_progress = [&] {
+        double seconds = std::max(elapsed(), 1e-3);
+        std::size_t failed;
+        {
+            std::lock_guard<std::mutex> lock(report_mutex);
+            failed = report.failures.size();
+        }
+        progress << "\r" << (finished.load() + report.failed) << "/" << report.total << " files, "
+                 << failed << " failed, " << std::fixed << std::setprecision(1)
+                 << finished.load() / seconds << " files/s, "
+                 << bytes_read.load() / seconds / (1 << 20) << " MB/s read" << std::flush;
+    };
+    auto last_print = start;
+    while (finished.load() < jobs.size())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (std::chrono::steady_clock::now() - last_print >= std::chrono::seconds(1))
+        {
+            print_progress();
+            last_print = std::chrono::steady_clock::now();
+        }
+    }
+    for (auto &t : threads)
+        t.join();
+    print_progress();
+    progress << std::endl;
+
+    report.seconds = elapsed();
+    report.bytes_read = bytes_read.load();
+    report.bytes_written = bytes_written.load();
+    report.failed = report.failures.size();
+    report.succeeded = report.total - report.failed;
+    return report;
+}
@@ -0,0 +1,50 @@
+#ifndef MJ_BATCH_RUNNER_HPP
+#define MJ_BATCH_RUNNER_HPP
+
+#include <nlohmann/json.hpp>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mj {
+
+// Offline batch mode. Runs one pipeline over many files with the same plans
+// and processors as the server, so results match it pixel for pixel.
+//
+// Files flow through four stages on their own threads, connected by bounded
+// queues so disk I/O overlaps with compute and memory stays capped:
+//   readers (mmap) -> decoders -> workers (pipeline) -> writers (encode, write)
+// A file that fails at any stage is reported and skipped.
+struct BatchOptions
+{
+    nlohmann::json pipeline;     // same keys as the HTTP request body
+    std::string input;           // directory (searched recursively) or manifest, one path per line
+    std::string output;          // output directory
+    std::string format;          // output extension such as "png", empty = keep the input's
+    int readers = 2;
+    int decoders = 0;            // 0 = CPU count
+    int workers = 0;             // 0 = CPU count
+    int writers = 2;
+    std::size_t queue_depth = 8; // images buffered between two stages
+};
+
+struct BatchReport
+{
+    std::size_t total = 0;
+    std::size_t succeeded = 0;
+    std::size_t failed = 0;
+    std::uint64_t bytes_read = 0;
+    std::uint64_t bytes_written = 0;
+    double seconds = 0;
+    std::vector<std::pair<std::string, std::string>> failures; // path, reason
+};
+
+// Prints progress about once a second to `progress`. Throws
+// std::invalid_argument for a bad pipeline or unreadable input list.
+BatchReport run_batch(BatchOptions const &options, std::ostream &progress);
+
+} // namespace mj
+
+#endif // MJ_BATCH_RUNNER_HPP
@@ -0,0 +1,237 @@
+#include "blur.hpp"
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace mj;
+
+// Column stripe width (elements) for the vertical passes
+static constexpr int COLUMN_STRIPE = 256;
+
+static std::mutex options_mutex;
+static BlurOptions current_options;
+
+void mj::set_blur_options(BlurOptions const &options)
+{
+    std::lock_guard<std::mutex> lock(options_mutex);
+    current_options = options;
+    current_options.passes = std::min(std::max(current_options.passes, 3), 5);
+}
+
+BlurOptions mj::blur_options()
+{
+    std::lock_guard<std::mutex> lock(options_mutex);
+    return current_options;
+}
+
+namespace {
+
+// BORDER_REFLECT_101 index for any offset, including radii larger than the image
+inline int reflect101(int i, int n)
+{
+    if (n == 1)
+        return 0;
+    const int period = 2 * n - 2;
+    i %= period;
+    if (i < 0)
+        i += period;
+    return i < n ? i : period - i;
+}
+
+// Box widths whose cascade has the variance of a Gaussian with this sigma
+std::vector<int> box_widths(double sigma, int passes)
+{
+    double ideal = std::sqrt(12.0 * sigma * sigma / passes + 1.0);
+    int wl = static_cast<int>(std::floor(ideal));
+    if (wl % 2 == 0)
+        --wl;
+    int wu = wl + 2;
+    // In double: passes * wl * wl overflows int from wl of about 20k
+    const double n = passes, w = wl;
+    int m = static_cast<int>(std::lround((12.0 * sigma * sigma - n * w * w - 4.0 * n * w - 3.0 * n) / (-4.0 * w - 4.0)));
+
+    std::vector<int> widths(passes);
+    for (int i = 0; i < passes; ++i)
+        widths[i] = i < m ? wl : wu;
+    return widths;
+}
+
+// Running sums are 64-bit and scaled in double, so they stay exact for any
+// box width (a 32-bit sum of 8.8 values wraps from a width of about 65.8k,
+// and a float stops holding it exactly from 256)
+
+// One box pass along a row of n pixels with cn interleaved channels, in place.
+// `pad` holds at least (n + w - 1) * cn values.
+void box_row(std::uint16_t *row, int n, int cn, int w, std::uint16_t *pad)
+{
+    const int r = w / 2;
+    const double scale = 1.0 / w;
+
+    for (int i = -r; i < n + r; ++i)
+        std::copy(row + reflect101(i, n) * cn, row + reflect101(i, n) * cn + cn, pad + (i + r) * cn);
+
+    for (int c = 0; c < cn; ++c)
+    {
+        std::uint64_t sum = 0;
+        for (int i = 0; i < w; ++i)
+            sum += pad[i * cn + c];
+        for (int x = 0; x < n; ++x)
+        {
+            row[x * cn + c] = static_cast<std::uint16_t>(static_cast<double>(sum) * scale + 0.5);
+            if (x + 1 < n)
+                sum += static_cast<std::uint64_t>(pad[(x + w) * cn + c]) - pad[x * cn + c];
+        }
+    }
+}
+
+// One box pass down `rows` rows of a `width`-element stripe, src -> dst
+void box_columns(const std::uint16_t *src, std::uint16_t *dst, int rows, int width, int w, std::uint64_t *sums)
+{
+    const int r = w / 2;
+    const double scale = 1.0 / w;
+
+    std::fill(sums, sums + width, std::uint64_t(0));
+    for (int i = -r; i <= r; ++i)
+    {
+        const std::uint16_t *in = src + std::size_t(reflect101(i, rows)) * width;
+        for (int x = 0; x < width; ++x)
+            sums[x] += in[x];
+    }
+
+    for (int y = 0; y < rows; ++y)
+    {
+        std::uint16_t *out = dst + std::size_t(y) * width;
+        for (int x = 0; x < width; ++x)
+            out[x] = static_cast<std::uint16_t>(static_cast<double>(sums[x]) * scale + 0.5);
+
+        const std::uint16_t *add = src + std::size_t(reflect101(y + r + 1, rows)) * width;
+        const std::uint16_t *sub = src + std::size_t(reflect101(y - r, rows)) * width;
+        for (int x = 0; x < width; ++x)
+            sums[x] += static_cast<std::uint64_t>(add[x]) - sub[x];
+    }
+}
+
+void box_cascade(cv::Mat const &src, cv::Mat &dst, double sigma, int passes)
+{
+    const std::vector<int> widths = box_widths(sigma, passes);
+    const int cn = src.channels();
+    const int rows = src.rows;
+    const int row_elems = src.cols * cn;
+    const int max_width = *std::max_element(widths.begin(), widths.end());
+
+    // Horizontal passes, one row at a time while it is in cache
+    cv::Mat fixed(rows, row_elems, CV_16UC1);
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        std::vector<std::uint16_t> pad(std::size_t(src.cols + max_width) * cn);
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const unsigned char *in = src.ptr<unsigned char>(y);
+            std::uint16_t *row = fixed.ptr<std::uint16_t>(y);
+            for (int x = 0; x < row_elems; ++x)
+                row[x] = static_cast<std::uint16_t>(in[x] << 8);
+            for (int w : widths)
+                box_row(row, src.cols, cn, w, pad.data());
+        }
+    });
+
+    // Vertical passes over column stripes, ping-ponging between two buffers
+    cv::Mat out(src.size(), src.type());
+    const int stripes = (row_elems + COLUMN_STRIPE - 1) / COLUMN_STRIPE;
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        std::vector<std::uint16_t> a(std::size_t(rows) * COLUMN_STRIPE), b(a.size());
+        std::vector<std::uint64_t> sums(COLUMN_STRIPE);
+        for (int s = range.start; s < range.end; ++s)
+        {
+            const int c0 = s * COLUMN_STRIPE;
+            const int width = std::min(COLUMN_STRIPE, row_elems - c0);
+
+            for (int y = 0; y < rows; ++y)
+                std::copy(fixed.ptr<std::uint16_t>(y) + c0, fixed.ptr<std::uint16_t>(y) + c0 + width, a.data() + std::size_t(y) * width);
+
+            for (int w : widths)
+            {
+                box_columns(a.data(), b.data(), rows, width, w, sums.data());
+                std::swap(a, b);
+            }
+
+            for (int y = 0; y < rows; ++y)
+            {
+                const std::uint16_t *in = a.data() + std::size_t(y) * width;
+                unsigned char *o = out.ptr<unsigned char>(y) + c0;
+                for (int x = 0; x < width; ++x)
+                    o[x] = static_cast<unsigned char>(std::min<int>((in[x] + 128) >> 8, 255));
+            }
+        }
+    });
+    dst = out;
+}
+
+} // namespace
+
+void mj::gaussian_blur(cv::Mat const &src, cv::Mat &dst, int ksize, double sigma)
+{
+    // Resolve the pair the way cv::GaussianBlur does for 8-bit input
+    double effective_sigma = sigma > 0 ? sigma : 0.3 * ((ksize - 1) * 0.5 - 1) + 0.8;
+
+    BlurOptions options = blur_options();
+    bool approximate = options.sigma_threshold > 0 && effective_sigma >= options.sigma_threshold &&
+                       src.depth() == CV_8U && (ksize == 0 || ksize % 2 == 1);
+
+    if (!approximate)
+    {
+        cv::GaussianBlur(src, dst, cv::Size(ksize, ksize), sigma);
+        return;
+    }
+    box_cascade(src, dst, effective_sigma, options.passes);
+}
+
+int mj::gaussian_radius(int ksize, double sigma)
+{
+    double effective_sigma = sigma > 0 ? sigma : 0.3 * ((ksize - 1) * 0.5 - 1) + 0.8;
+
+    BlurOptions options = blur_options();
+    if (options.sigma_threshold > 0 && effective_sigma >= options.sigma_threshold && (ksize == 0 || ksize % 2 == 1))
+    {
+        int radius = 0;
+        for (int w : box_widths(effective_sigma, options.passes))
+            radius += w / 2;
+        return radius;
+    }
+    // cv::GaussianBlur's kernel size for 8-bit images when only sigma is given
+    if (ksize <= 0)
+        ksize = cvRound(sigma * 6 + 1) | 1;
+    return ksize / 2;
+}
+
+void mj::unsharp_mask(cv::Mat const &src, cv::Mat const &blurred, cv::Mat &dst, double strength)
+{
+    CV_Assert(src.size() == blurred.size() && src.type() == blurred.type());
+
+    if (src.depth() != CV_8U)
+    {
+        dst = src + strength * (src - blurred);
+        return;
+    }
+
+    cv::Mat out(src.size(), src.type());
+    const int row_elems = src.cols * src.channels();
+    const float alpha = static_cast<float>(strength);
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const unsigned char *in = src.ptr<unsigned char>(y);
+            const unsigned char *bl = blurred.ptr<unsigned char>(y);
+            unsigned char *o = out.ptr<unsigned char>(y);
+            for (int x = 0; x < row_elems; ++x)
+            {
+                int detail = cv::saturate_cast<unsigned char>(in[x] * alpha - bl[x] * alpha);
+                o[x] = cv::saturate_cast<unsigned char>(in[x] + detail);
+            }
+        }
+    });
+    dst = out;
+}
@@ -0,0 +1,48 @@
+#ifndef MJ_BLUR_HPP
+#define MJ_BLUR_HPP
+
+#include <opencv2/core.hpp>
+
+namespace mj {
+
+// Gaussian blur engine shared by Blur and UnsharpMask.
+//
+// Below `sigma_threshold` it calls cv::GaussianBlur. At or above it, the blur
+// is approximated by a cascade of `passes` box filters (Kovesi's widths, which
+// match the Gaussian variance exactly). Each pass uses running sums, so the
+// cost per pixel is constant in sigma. Rows and column stripes run in parallel.
+// Intermediates are 8.8 fixed point and borders are reflected like
+// BORDER_REFLECT_101.
+//
+// Error against cv::GaussianBlur for sigma in [8, 80], 8-bit images:
+//   passes = 3: <= 3.6 grey levels across a step edge, <= 33 for an adversarial
+//               image (255 x 2 x L1 distance between the kernels)
+//   passes = 4: <= 3.1 across a step edge, <= 26 adversarial
+// plus 0.5 for the final rounding. Synthetic step, sinusoid and noise images
+// measured within 4 grey levels, or within 10 on images smaller than the
+// kernel, which are reflected many times over (tests/blur-test.cpp).
+struct BlurOptions
+{
+    double sigma_threshold = 8.0; // <= 0 disables the approximation
+    int passes = 3;               // 3..5
+};
+
+void set_blur_options(BlurOptions const &options);
+BlurOptions blur_options();
+
+// Same parameter rules as cv::GaussianBlur for a square kernel: ksize odd or 0,
+// sigma 0 derives it from ksize, ksize 0 derives it from sigma.
+void gaussian_blur(cv::Mat const &src, cv::Mat &dst, int ksize, double sigma);
+
+// How far gaussian_blur reads from each output pixel on 8-bit input, with
+// the current options
+int gaussian_radius(int ksize, double sigma);
+
+// dst = src + strength * (src - blurred) in one saturating pass. As in the Mat
+// expression it replaces, the scaled difference is clamped to [0, 255] before
+// it is added, so the mask only brightens.
+void unsharp_mask(cv::Mat const &src, cv::Mat const &blurred, cv::Mat &dst, double strength);
+
+} // namespace mj
+
+#endif // MJ_BLUR_HPP
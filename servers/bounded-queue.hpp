@@ -0,0 +1,85 @@
+#ifndef MJ_BOUNDED_QUEUE_HPP
+#define MJ_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace mj {
+
+// Blocking FIFO with a fixed capacity, connecting the stages of a staged
+// pipeline. push() waits while the queue is full, so a slow stage throttles
+// the ones feeding it. The queue closes once each of its `producers` has
+// called producer_done(); pop() then drains what is left and returns nullopt.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(std::size_t capacity, int producers)
+        : _capacity(capacity > 0 ? capacity : 1), _producers(producers) {}
+
+    BoundedQueue(BoundedQueue const &) = delete;
+    BoundedQueue &operator=(BoundedQueue const &) = delete;
+
+    // Returns false if the queue was closed by abort()
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [&] { return _items.size() < _capacity || _aborted; });
+        if (_aborted)
+            return false;
+        _items.push_back(std::move(item));
+        _not_empty.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [&] { return !_items.empty() || _producers <= 0 || _aborted; });
+        if (_items.empty() || _aborted)
+            return std::nullopt;
+        T item = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return item;
+    }
+
+    void producer_done()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_producers <= 0)
+            _not_empty.notify_all();
+    }
+
+    // Wakes everyone and drops pending items
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        _items.clear();
+        _not_full.notify_all();
+        _not_empty.notify_all();
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _items.size();
+    }
+
+private:
+    std::size_t _capacity;
+    int _producers;
+    bool _aborted = false;
+    std::deque<T> _items;
+    mutable std::mutex _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+};
+
+} // namespace mj
+
+#endif // MJ_BOUNDED_QUEUE_HPP
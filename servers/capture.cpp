@@ -0,0 +1,233 @@
+#include "capture.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include <unistd.h>
+
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+const char magic[8] = {'V', 'T', 'C', 'A', 'P', '0', '1', '\n'};
+
+// Header JSON beyond this is treated as corruption rather than allocated
+const std::uint32_t max_header = 1u << 24;
+
+void put_u32(unsigned char *out, std::uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+std::uint32_t get_u32(unsigned char const *in)
+{
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4; ++i)
+        value |= static_cast<std::uint32_t>(in[i]) << (8 * i);
+    return value;
+}
+
+// Appends `data` to `fd` (opened for append, nothing buffered). A failed
+// write is truncated away, so a reader stops at the end of the last whole
+// record instead of misparsing records written after a partial one.
+bool append_record(int fd, std::vector<unsigned char> const &data)
+{
+    off_t start = ::lseek(fd, 0, SEEK_END);
+    if (start < 0)
+        return false;
+    std::size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            [[maybe_unused]] int ignored = ::ftruncate(fd, start);
+            return false;
+        }
+        done += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+std::int64_t mj::capture_clock_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// CaptureWriter
+
+CaptureWriter::CaptureWriter(std::string const &path, double sample_rate, std::size_t max_pending)
+    : _file(std::fopen(path.c_str(), "ab")), _sample_rate(sample_rate), _max_pending(std::max<std::size_t>(max_pending, 1))
+{
+    if (!_file)
+        throw std::invalid_argument("Cannot open capture file " + path);
+    if (sample_rate <= 0 || sample_rate > 1)
+    {
+        std::fclose(_file);
+        throw std::invalid_argument("Capture sample rate must be in (0, 1]");
+    }
+
+    // An existing file must already be a capture; a new one gets the magic
+    std::fseek(_file, 0, SEEK_END);
+    if (std::ftell(_file) == 0)
+    {
+        std::fwrite(magic, 1, sizeof(magic), _file);
+        std::fflush(_file);
+    }
+    else
+    {
+        char head[sizeof(magic)] = {};
+        std::FILE *check = std::fopen(path.c_str(), "rb");
+        bool ok = check && std::fread(head, 1, sizeof(head), check) == sizeof(head) && std::memcmp(head, magic, sizeof(magic)) == 0;
+        if (check)
+            std::fclose(check);
+        if (!ok)
+        {
+            std::fclose(_file);
+            throw std::invalid_argument(path + " exists and is not a capture file");
+        }
+    }
+
+    _thread = std::thread([this] { write_loop(); });
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+    std::fclose(_file);
+}
+
+bool CaptureWriter::sample() const
+{
+    if (_sample_rate >= 1)
+        return true;
+    thread_local std::minstd_rand rng{std::random_device{}()};
+    return std::uniform_real_distribution<double>(0, 1)(rng) < _sample_rate;
+}
+
+void CaptureWriter::record(CaptureRecord record)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending.size() >= _max_pending)
+        {
+            ++_dropped;
+            return;
+        }
+        _pending.push_back(std::move(record));
+    }
+    _wake.notify_one();
+}
+
+json CaptureWriter::metrics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return {{"sample_rate", _sample_rate},
+            {"recorded", _recorded},
+            {"dropped", _dropped},
+            {"pending", _pending.size()},
+            {"bytes", _bytes}};
+}
+
+void CaptureWriter::write_loop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        _wake.wait(lock, [&] { return _stopping || !_pending.empty(); });
+        if (_pending.empty())
+            return;
+        CaptureRecord record = std::move(_pending.front());
+        _pending.pop_front();
+        lock.unlock();
+
+        // The whole record in one buffer, written with a single write(). The
+        // tenant is a raw header cut at a byte count, so invalid UTF-8 is
+        // replaced rather than thrown on. Nothing may escape this thread: a
+        // record that cannot be built is dropped.
+        std::vector<unsigned char> bytes;
+        bool ok = false;
+        try
+        {
+            json fields = {{"ts_us", record.ts_us}, {"tenant", record.tenant}, {"pipeline", record.pipeline}};
+            std::string header = fields.dump(-1, ' ', false, json::error_handler_t::replace);
+            bytes.resize(8 + header.size() + record.image.size());
+            put_u32(bytes.data(), static_cast<std::uint32_t>(header.size()));
+            put_u32(bytes.data() + 4, static_cast<std::uint32_t>(record.image.size()));
+            std::copy(header.begin(), header.end(), bytes.begin() + 8);
+            std::copy(record.image.begin(), record.image.end(), bytes.begin() + 8 + header.size());
+            ok = append_record(fileno(_file), bytes);
+        }
+        catch (const std::exception &)
+        {
+        }
+
+        lock.lock();
+        if (ok)
+        {
+            ++_recorded;
+            _bytes += bytes.size();
+        }
+        else
+            ++_dropped;
+    }
+}
+
+// CaptureReader
+
+CaptureReader::CaptureReader(std::string const &path) : _file(std::fopen(path.c_str(), "rb"))
+{
+    if (!_file)
+        throw std::invalid_argument("Cannot open capture file " + path);
+    char head[sizeof(magic)] = {};
+    if (std::fread(head, 1, sizeof(head), _file) != sizeof(head) || std::memcmp(head, magic, sizeof(magic)) != 0)
+    {
+        std::fclose(_file);
+        throw std::invalid_argument(path + " is not a capture file");
+    }
+}
+
+CaptureReader::~CaptureReader()
+{
+    std::fclose(_file);
+}
+
+std::optional<CaptureRecord> CaptureReader::next()
+{
+    unsigned char lengths[8];
+    if (std::fread(lengths, 1, sizeof(lengths), _file) != sizeof(lengths))
+        return std::nullopt;
+    std::uint32_t header_size = get_u32(lengths);
+    std::uint32_t image_size = get_u32(lengths + 4);
+    if (header_size == 0 || header_size > max_header)
+        return std::nullopt;
+
+    std::string header(header_size, '\0');
+    CaptureRecord record;
+    record.image.resize(image_size);
+    if (std::fread(&header[0], 1, header_size, _file) != header_size ||
+        std::fread(record.image.data(), 1, image_size, _file) != image_size)
+        return std::nullopt;
+
+    json j = json::parse(header, nullptr, false);
+    if (j.is_discarded() || !j.is_object())
+        return std::nullopt;
+    record.ts_us = j.value("ts_us", std::int64_t(0));
+    record.tenant = j.value("tenant", std::string());
+    record.pipeline = j.value("pipeline", json::object());
+    return record;
+}
@@ -0,0 +1,95 @@
+#ifndef MJ_CAPTURE_HPP
+#define MJ_CAPTURE_HPP
+
+#include <nlohmann/json.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mj {
+
+// Sampled production traffic for offline replay.
+//
+// A capture file starts with the 8 bytes "VTCAP01\n" and is followed by
+// records, each
+//
+//   u32 header length, u32 image length (little endian)
+//   header: JSON {"ts_us": wall clock arrival in microseconds,
+//                 "tenant": "...", "pipeline": {request body without img}}
+//   image:  the encoded image bytes as uploaded (base64 decoded)
+//
+// Files are only ever appended to, so several server runs can share one.
+// Every record is written with a single write(), and one that fails part way
+// is truncated off again; a reader stops cleanly at a truncated tail.
+struct CaptureRecord
+{
+    std::int64_t ts_us = 0;
+    std::string tenant;
+    nlohmann::json pipeline;
+    std::vector<unsigned char> image;
+};
+
+class CaptureWriter
+{
+public:
+    // Keeps `sample_rate` (0..1] of the requests offered to sample(). At most
+    // `max_pending` records wait for the writer thread; beyond that records
+    // are dropped rather than slowing requests down.
+    CaptureWriter(std::string const &path, double sample_rate, std::size_t max_pending = 64);
+    ~CaptureWriter();
+
+    CaptureWriter(CaptureWriter const &) = delete;
+    CaptureWriter &operator=(CaptureWriter const &) = delete;
+
+    // Whether to record the current request
+    bool sample() const;
+
+    // Never blocks on I/O
+    void record(CaptureRecord record);
+
+    nlohmann::json metrics() const;
+
+private:
+    void write_loop();
+
+    std::FILE *_file;
+    double _sample_rate;
+    std::size_t _max_pending;
+    std::uint64_t _recorded = 0;
+    std::uint64_t _dropped = 0;
+    std::uint64_t _bytes = 0;
+    bool _stopping = false;
+    std::deque<CaptureRecord> _pending;
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::thread _thread;
+};
+
+class CaptureReader
+{
+public:
+    // Throws std::invalid_argument if the file is missing or not a capture
+    explicit CaptureReader(std::string const &path);
+    ~CaptureReader();
+
+    CaptureReader(CaptureReader const &) = delete;
+    CaptureReader &operator=(CaptureReader const &) = delete;
+
+    // Next record in file order; nullopt at the end or at a truncated record
+    std::optional<CaptureRecord> next();
+
+private:
+    std::FILE *_file;
+};
+
+std::int64_t capture_clock_us();
+
+} // namespace mj
+
+#endif // MJ_CAPTURE_HPP
@@ -0,0 +1,103 @@
+#include "color-space.hpp"
+#include <opencv2/imgproc.hpp>
+
+using namespace mj;
+
+TrackedImage::TrackedImage(cv::Mat const &bgr) : planes{bgr} {}
+
+static cv::Mat interleaved_bgr(TrackedImage const &image)
+{
+    cv::Mat merged, bgr;
+    switch (image.space)
+    {
+    case ColorSpace::BGR:
+        return image.planes[0];
+    case ColorSpace::Gray:
+        cv::cvtColor(image.planes[0], bgr, cv::COLOR_GRAY2BGR);
+        return bgr;
+    case ColorSpace::YCrCb:
+        cv::merge(image.planes, merged);
+        cv::cvtColor(merged, bgr, cv::COLOR_YCrCb2BGR);
+        return bgr;
+    case ColorSpace::Lab:
+        cv::merge(image.planes, merged);
+        cv::cvtColor(merged, bgr, cv::COLOR_Lab2BGR);
+        return bgr;
+    }
+    return image.planes[0];
+}
+
+void TrackedImage::convert(ColorSpace target)
+{
+    if (space == target)
+        return;
+
+    cv::Mat bgr = interleaved_bgr(*this);
+    cv::Mat converted;
+    switch (target)
+    {
+    case ColorSpace::BGR:
+        planes = {bgr};
+        break;
+    case ColorSpace::Gray:
+        cv::cvtColor(bgr, converted, cv::COLOR_BGR2GRAY);
+        planes = {converted};
+        break;
+    case ColorSpace::YCrCb:
+        cv::cvtColor(bgr, converted, cv::COLOR_BGR2YCrCb);
+        cv::split(converted, planes);
+        break;
+    case ColorSpace::Lab:
+        cv::cvtColor(bgr, converted, cv::COLOR_BGR2Lab);
+        cv::split(converted, planes);
+        break;
+    }
+    space = target;
+}
+
+cv::Mat TrackedImage::to_bgr() const
+{
+    return interleaved_bgr(*this);
+}
+
+void BgrStage::apply(TrackedImage &image) const
+{
+    image.convert(ColorSpace::BGR);
+    image.planes[0] = _fn(image.planes[0]);
+}
+
+void ChannelwiseStage::apply(TrackedImage &image) const
+{
+    if (image.space != ColorSpace::Gray)
+        image.convert(ColorSpace::BGR);
+    image.planes[0] = _fn(image.planes[0]);
+}
+
+void GrayscaleStage::apply(TrackedImage &image) const
+{
+    image.convert(ColorSpace::Gray);
+}
+
+void EdgeStage::apply(TrackedImage &image) const
+{
+    image.convert(ColorSpace::Gray);
+    cv::Mat edges;
+    cv::Canny(image.planes[0], edges, 100, 200);
+    image.planes[0] = edges;
+}
+
+void EqualizeStage::apply(TrackedImage &image) const
+{
+    if (image.space != ColorSpace::Gray)
+        image.convert(ColorSpace::YCrCb);
+    cv::equalizeHist(image.planes[0], image.planes[0]);
+}
+
+void ClaheStage::apply(TrackedImage &image) const
+{
+    image.convert(ColorSpace::Lab);
+    // CLAHE keeps scratch buffers between calls, so each thread reuses its own instance
+    thread_local cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE();
+    clahe->setClipLimit(_clip_limit);
+    clahe->apply(image.planes[0], image.planes[0]);
+}
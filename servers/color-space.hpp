@@ -0,0 +1,116 @@
+#ifndef MJ_COLOR_SPACE_HPP
+#define MJ_COLOR_SPACE_HPP
+
+#include <opencv2/core.hpp>
+#include <functional>
+#include <vector>
+
+namespace mj {
+
+enum class ColorSpace
+{
+    BGR,
+    Gray,
+    YCrCb,
+    Lab
+};
+
+// An image between the stages of a colour-tracked run. BGR is one interleaved
+// Mat. Gray is a single plane that stands for three equal channels. YCrCb and
+// Lab are three planes, luma first. Conversions happen only when a stage needs
+// a different space, so consecutive luma stages share one round trip.
+struct TrackedImage
+{
+    ColorSpace space = ColorSpace::BGR;
+    std::vector<cv::Mat> planes;
+
+    explicit TrackedImage(cv::Mat const &bgr);
+
+    // Always through BGR: a modified Y plane is not the grey of the BGR it
+    // converts back to, which is clipped per channel
+    void convert(ColorSpace target);
+
+    cv::Mat to_bgr() const;
+};
+
+// A JPEG's own planar YCbCr (jpeg-yuv.hpp): full resolution Y, and Cb and Cr
+// at the file's chroma subsampling, `subsampling` luma pixels per chroma
+// pixel across and down. No chroma planes means a greyscale image.
+struct YuvImage
+{
+    cv::Mat y;
+    std::vector<cv::Mat> chroma;
+    cv::Size subsampling{1, 1};
+};
+
+class TrackedStage
+{
+public:
+    virtual void apply(TrackedImage &image) const = 0;
+    virtual bool temporal() const { return false; }
+    virtual ~TrackedStage() = default;
+};
+
+using StageFunction = std::function<cv::Mat(cv::Mat const &)>;
+
+// A stage that mixes channels and needs interleaved BGR
+class BgrStage : public TrackedStage
+{
+public:
+    explicit BgrStage(StageFunction fn, bool temporal = false) : _fn(std::move(fn)), _temporal(temporal) {}
+    void apply(TrackedImage &image) const override;
+    bool temporal() const override { return _temporal; }
+
+private:
+    StageFunction _fn;
+    bool _temporal;
+};
+
+// A stage that treats channels independently. On a Gray image it runs on the
+// single plane, which is exact since all three channels would be equal.
+class ChannelwiseStage : public TrackedStage
+{
+public:
+    explicit ChannelwiseStage(StageFunction fn, bool temporal = false) : _fn(std::move(fn)), _temporal(temporal) {}
+    void apply(TrackedImage &image) const override;
+    bool temporal() const override { return _temporal; }
+
+private:
+    StageFunction _fn;
+    bool _temporal;
+};
+
+class GrayscaleStage : public TrackedStage
+{
+public:
+    void apply(TrackedImage &image) const override;
+};
+
+class EdgeStage : public TrackedStage
+{
+public:
+    void apply(TrackedImage &image) const override;
+};
+
+// equalizeHist on Y of YCrCb, or directly on a Gray plane (Y of a grey pixel is
+// the pixel itself)
+class EqualizeStage : public TrackedStage
+{
+public:
+    void apply(TrackedImage &image) const override;
+};
+
+// CLAHE on L of Lab
+class ClaheStage : public TrackedStage
+{
+public:
+    explicit ClaheStage(double clip_limit) : _clip_limit(clip_limit) {}
+    void apply(TrackedImage &image) const override;
+
+private:
+    double _clip_limit;
+};
+
+} // namespace mj
+
+#endif // MJ_COLOR_SPACE_HPP
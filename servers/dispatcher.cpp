@@ -0,0 +1,722 @@
+#include "dispatcher.hpp"
+#include "image-probe.hpp"
+#include "logger.hpp"
+#include "memory-governor.hpp"
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <cppcodec/base64_rfc4648.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using json = nlohmann::json;
+using base64 = cppcodec::base64_rfc4648;
+using Clock = std::chrono::steady_clock;
+using namespace mj;
+
+namespace {
+
+// A request in flight weighs as much as this many pixels when ranking workers
+constexpr double REQUEST_PIXELS = 1e6;
+// Bytes of image header decoded from a request's base64 to size it
+constexpr std::size_t PROBE_BYTES = 64 * 1024;
+// img_ref -> worker entries kept for routing
+constexpr std::size_t MAX_AFFINITY = 1 << 16;
+
+constexpr Clock::duration MIN_BACKOFF = std::chrono::milliseconds(100);
+constexpr Clock::duration MAX_BACKOFF = std::chrono::seconds(10);
+// A worker that ran this long before exiting is restarted without delay growth
+constexpr Clock::duration STABLE_RUN = std::chrono::seconds(10);
+// For connecting to a worker, and for its answer to GET /ready
+constexpr Clock::duration CONNECT_TIMEOUT = std::chrono::seconds(2);
+constexpr Clock::duration READY_TIMEOUT = std::chrono::seconds(2);
+// Worker options naming a file or socket that each process needs its own of
+constexpr char const *PER_PROCESS_OPTIONS[] = {"capture", "local-socket", "access-log"};
+
+enum class WorkerState
+{
+    Down,
+    Starting, // process running, not yet ready
+    Ready
+};
+
+char const *state_name(WorkerState state)
+{
+    switch (state)
+    {
+    case WorkerState::Starting:
+        return "starting";
+    case WorkerState::Ready:
+        return "ready";
+    default:
+        return "down";
+    }
+}
+
+// One connection to a worker. Its operations run on its own io_context on
+// the calling thread, so they are synchronous to the caller but honour the
+// stream's deadline.
+class Connection
+{
+public:
+    bool connect(tcp::endpoint const &endpoint)
+    {
+        beast::error_code ec;
+        _stream.expires_after(CONNECT_TIMEOUT);
+        _stream.async_connect(endpoint, [&](beast::error_code e) { ec = e; });
+        run();
+        return !ec;
+    }
+
+    // Writes `req` and reads the response into `parser` before `timeout`
+    // passes; beast::error::timeout if it does
+    template <class Request, class Parser>
+    beast::error_code exchange(Request const &req, Parser &parser, Clock::duration timeout)
+    {
+        beast::error_code ec;
+        _stream.expires_after(timeout);
+        http::async_write(_stream, req, [&](beast::error_code e, std::size_t) {
+            ec = e;
+            if (!ec)
+                http::async_read(_stream, _buffer, parser, [&](beast::error_code e, std::size_t) { ec = e; });
+        });
+        run();
+        return ec;
+    }
+
+private:
+    void run()
+    {
+        _ioc.restart();
+        _ioc.run();
+    }
+
+    net::io_context _ioc{1};
+    beast::tcp_stream _stream{_ioc};
+    beast::flat_buffer _buffer;
+};
+
+enum class Forwarded
+{
+    Answered,
+    Failed,  // no response (refused, reset or closed), safe to retry
+    TimedOut // no response within the timeout; the worker may still be at it
+};
+
+struct Worker
+{
+    int index = 0;
+    tcp::endpoint endpoint;
+    std::atomic<WorkerState> state{WorkerState::Down};
+
+    // Guarded by mutex
+    std::mutex mutex;
+    pid_t pid = 0;
+    std::uint64_t generation = 0; // bumped on exit; older pooled connections are dropped
+    bool spawned = false;
+    Clock::time_point started;
+    Clock::time_point restart_at;
+    Clock::duration backoff = MIN_BACKOFF;
+    std::vector<std::unique_ptr<Connection>> idle; // keep-alive connections
+
+    std::atomic<int> in_flight{0};
+    std::atomic<std::uint64_t> in_flight_pixels{0};
+    std::atomic<std::uint64_t> requests{0};
+    std::atomic<std::uint64_t> failures{0};
+    std::atomic<std::uint64_t> restarts{0};
+};
+
+// Counts a request against a worker's load for its lifetime
+class LoadGuard
+{
+public:
+    LoadGuard(Worker &worker, std::uint64_t pixels) : _worker(worker), _pixels(pixels)
+    {
+        ++_worker.in_flight;
+        _worker.in_flight_pixels += _pixels;
+        ++_worker.requests;
+    }
+
+    ~LoadGuard()
+    {
+        --_worker.in_flight;
+        _worker.in_flight_pixels -= _pixels;
+    }
+
+    LoadGuard(LoadGuard const &) = delete;
+    LoadGuard &operator=(LoadGuard const &) = delete;
+
+private:
+    Worker &_worker;
+    std::uint64_t _pixels;
+};
+
+// Pixels of a request's image from its header. The base64 of "img" is found
+// by scanning rather than parsing, and only its start is decoded; other
+// bodies (raw uploads) are probed directly. Falls back to a guess from the
+// body size, which is all the ranking needs.
+std::uint64_t request_pixels(http::request<http::string_body> const &req)
+{
+    std::string const &body = req.body();
+    std::vector<unsigned char> head;
+    if (req[http::field::content_type].find("json") == beast::string_view::npos)
+        head.assign(body.begin(), body.begin() + std::min(body.size(), PROBE_BYTES));
+    else
+    {
+        std::size_t key = body.find("\"img\"");
+        std::size_t colon = key == std::string::npos ? key : body.find(':', key + 5);
+        std::size_t open = colon == std::string::npos ? colon : body.find('"', colon + 1);
+        if (open != std::string::npos)
+        {
+            std::string text;
+            for (std::size_t i = open + 1; i < body.size() && body[i] != '"' && text.size() < PROBE_BYTES / 3 * 4; ++i)
+                if (body[i] != '\\') // JSON may escape '/' as "\/"
+                    text += body[i];
+            text.resize(text.size() / 4 * 4);
+            try
+            {
+                head = base64::decode(text);
+            }
+            catch (const std::exception &)
+            {
+                head.clear();
+            }
+        }
+    }
+
+    if (auto size = probe_image_size(head))
+        return static_cast<std::uint64_t>(size->width) * static_cast<std::uint64_t>(size->height);
+    return body.size() * 2; // about right for base64 JPEG photos
+}
+
+// The upload a request refers to: /images/<ref>, or "img_ref" in a small JSON body
+std::string request_ref(http::request<http::string_body> const &req, std::string const &target)
+{
+    if (target.rfind("/images/", 0) == 0)
+        return target.substr(std::strlen("/images/"));
+    std::string const &body = req.body();
+    if ((target != "/" && target != "/analyze") || body.size() > PROBE_BYTES || body.find("\"img_ref\"") == std::string::npos)
+        return std::string();
+    json j = json::parse(body, nullptr, false);
+    auto it = j.is_object() ? j.find("img_ref") : j.end();
+    return it != j.end() && it->is_string() ? it->get<std::string>() : std::string();
+}
+
+// "capture" for "--capture=file"
+std::string option_name(std::string const &arg)
+{
+    if (arg.rfind("--", 0) != 0)
+        return std::string();
+    return arg.substr(2, arg.find('=') == std::string::npos ? std::string::npos : arg.find('=') - 2);
+}
+
+// The value of the last --<name>=<value> in `args`, empty if none
+std::string option_value(std::vector<std::string> const &args, std::string const &name)
+{
+    std::string value;
+    for (std::string const &arg : args)
+        if (option_name(arg) == name && arg.find('=') != std::string::npos)
+            value = arg.substr(arg.find('=') + 1);
+    return value;
+}
+
+void send_json(tcp::socket &socket, http::status status, json const &body, unsigned version, bool keep_alive)
+{
+    http::response<http::string_body> res{status, version};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "application/json");
+    res.body() = body.dump();
+    res.content_length(res.body().size());
+    res.keep_alive(keep_alive);
+
+    beast::error_code ec;
+    http::write(socket, res, ec);
+    if (ec)
+        log_error("write error (dispatcher): " + ec.message());
+}
+
+class Dispatcher
+{
+public:
+    explicit Dispatcher(DispatcherOptions options) : _options(std::move(options))
+    {
+        int port = std::atoi(_options.port.c_str());
+        int first = _options.worker_port > 0 ? _options.worker_port : port + 1;
+        if (_options.processes < 1)
+            throw std::invalid_argument("The dispatcher needs at least one worker process");
+        if (first + _options.processes - 1 > 65535)
+            throw std::invalid_argument("Worker ports run past 65535");
+
+        // The workers share this host: unless told otherwise each gets its
+        // share of the cores and of the memory budget
+        std::vector<std::string> &args = _options.worker_args;
+        int share = std::max(1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) / _options.processes);
+        if (option_value(args, "workers").empty())
+            args.push_back("--workers=" + std::to_string(share));
+        if (option_value(args, "intra-op-threads").empty())
+        {
+            int slots = std::max(1, std::atoi(option_value(args, "workers").c_str()));
+            args.push_back("--intra-op-threads=" + std::to_string(std::max(1, share / slots)));
+        }
+        if (option_value(args, "memory-budget-mb").empty())
+        {
+            std::size_t megabytes = default_memory_budget() / static_cast<std::size_t>(_options.processes) >> 20;
+            args.push_back("--memory-budget-mb=" + std::to_string(std::max<std::size_t>(1, megabytes)));
+        }
+
+        for (int i = 0; i < _options.processes; ++i)
+        {
+            auto worker = std::make_unique<Worker>();
+            worker->index = i;
+            worker->endpoint = tcp::endpoint(net::ip::make_address("127.0.0.1"), static_cast<unsigned short>(first + i));
+            _workers.push_back(std::move(worker));
+        }
+    }
+
+    void run()
+    {
+        std::thread(&Dispatcher::supervise, this).detach();
+
+        tcp::acceptor acceptor{_ioc};
+        try
+        {
+            tcp::endpoint endpoint(net::ip::make_address(_options.host), static_cast<unsigned short>(std::atoi(_options.port.c_str())));
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(net::socket_base::reuse_address(true));
+            acceptor.bind(endpoint);
+            acceptor.listen();
+        }
+        catch (const std::exception &e)
+        {
+            throw std::runtime_error("Dispatcher cannot listen on " + _options.host + ":" + _options.port + ": " + e.what());
+        }
+        std::cerr << "Dispatcher is listening on " << _options.host << ":" << _options.port << " with " << _workers.size()
+                  << " worker processes from port " << _workers.front()->endpoint.port() << std::endl;
+
+        for (;;)
+        {
+            beast::error_code ec;
+            tcp::socket socket{_ioc};
+            acceptor.accept(socket, ec);
+            if (ec)
+            {
+                log_error("Accept failed: " + ec.message());
+                continue;
+            }
+            std::thread(&Dispatcher::do_session, this, std::move(socket)).detach();
+        }
+    }
+
+private:
+    // ---------------------------------------------------------------------
+    // Worker processes
+    // ---------------------------------------------------------------------
+
+    void supervise()
+    {
+        for (;;)
+        {
+            int status = 0;
+            pid_t pid;
+            while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+                exited(pid, status);
+
+            auto now = Clock::now();
+            for (auto &worker : _workers)
+            {
+                WorkerState state = worker->state.load();
+                if (state == WorkerState::Down && now >= worker->restart_at)
+                    spawn(*worker);
+                else if (state == WorkerState::Starting && ready(*worker))
+                    worker->state = WorkerState::Ready;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    void spawn(Worker &worker)
+    {
+        std::vector<std::string> args = {_options.executable, worker.endpoint.address().to_string(), std::to_string(worker.endpoint.port())};
+        for (std::string const &arg : _options.worker_args)
+        {
+            std::string name = option_name(arg);
+            bool own = std::find(std::begin(PER_PROCESS_OPTIONS), std::end(PER_PROCESS_OPTIONS), name) != std::end(PER_PROCESS_OPTIONS);
+            args.push_back(own && arg != "--access-log=-" ? arg + "." + std::to_string(worker.index) : arg);
+        }
+        std::vector<char *> argv;
+        for (std::string &arg : args)
+            argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        // Only async-signal-safe calls between fork and exec
+        pid_t parent = ::getpid();
+        pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            // Workers do not outlive the dispatcher
+            ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if (::getppid() != parent)
+                ::_exit(1);
+            ::execv(argv[0], argv.data());
+            ::_exit(127);
+        }
+
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (pid < 0)
+        {
+            log_error("Cannot start worker " + std::to_string(worker.index) + ": " + std::strerror(errno));
+            worker.restart_at = Clock::now() + worker.backoff;
+            return;
+        }
+        if (worker.spawned)
+            ++worker.restarts;
+        worker.spawned = true;
+        worker.pid = pid;
+        worker.started = Clock::now();
+        worker.state = WorkerState::Starting;
+    }
+
+    void exited(pid_t pid, int status)
+    {
+        for (auto &worker : _workers)
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            if (worker->pid != pid)
+                continue;
+
+            auto now = Clock::now();
+            worker->pid = 0;
+            worker->state = WorkerState::Down;
+            ++worker->generation;
+            worker->idle.clear();
+            worker->backoff = now - worker->started >= STABLE_RUN ? MIN_BACKOFF : std::min(worker->backoff * 2, MAX_BACKOFF);
+            worker->restart_at = now + worker->backoff;
+
+            std::string how = WIFSIGNALED(status) ? "was killed by signal " + std::to_string(WTERMSIG(status))
+                                                  : "exited with status " + std::to_string(WEXITSTATUS(status));
+            log_error("Worker " + std::to_string(worker->index) + " (pid " + std::to_string(pid) + ") " + how + "; restarting in " +
+                      std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(worker->backoff).count()) + " ms");
+            return;
+        }
+    }
+
+    // A started worker takes requests once its GET /ready answers 200,
+    // which it does after warming up
+    bool ready(Worker &worker)
+    {
+        Connection connection;
+        if (!connection.connect(worker.endpoint))
+            return false;
+
+        http::request<http::empty_body> req{http::verb::get, "/ready", 11};
+        req.set(http::field::host, worker.endpoint.address().to_string());
+        req.keep_alive(false);
+        http::response_parser<http::string_body> parser;
+        return !connection.exchange(req, parser, READY_TIMEOUT) && parser.get().result() == http::status::ok;
+    }
+
+    // ---------------------------------------------------------------------
+    // Routing
+    // ---------------------------------------------------------------------
+
+    // Least loaded ready worker not yet tried, preferring `preferred`
+    Worker *pick(std::vector<bool> const &tried, int preferred)
+    {
+        if (preferred >= 0 && !tried[preferred] && _workers[preferred]->state == WorkerState::Ready)
+            return _workers[preferred].get();
+
+        Worker *best = nullptr;
+        double best_load = std::numeric_limits<double>::max();
+        std::size_t start = _next++;
+        for (std::size_t k = 0; k < _workers.size(); ++k)
+        {
+            Worker &worker = *_workers[(start + k) % _workers.size()];
+            if (tried[worker.index] || worker.state != WorkerState::Ready)
+                continue;
+            double load = worker.in_flight * REQUEST_PIXELS + static_cast<double>(worker.in_flight_pixels.load());
+            if (load < best_load)
+            {
+                best = &worker;
+                best_load = load;
+            }
+        }
+        return best;
+    }
+
+    int affinity(std::string const &ref)
+    {
+        if (ref.empty())
+            return -1;
+        std::lock_guard<std::mutex> lock(_affinity_mutex);
+        auto it = _affinity.find(ref);
+        return it == _affinity.end() ? -1 : it->second;
+    }
+
+    void remember(std::string const &ref, int worker)
+    {
+        std::lock_guard<std::mutex> lock(_affinity_mutex);
+        if (_affinity.insert_or_assign(ref, worker).second)
+            _affinity_order.push_back(ref);
+        while (_affinity_order.size() > MAX_AFFINITY)
+        {
+            _affinity.erase(_affinity_order.front());
+            _affinity_order.pop_front();
+        }
+    }
+
+    void forget(std::string const &ref)
+    {
+        std::lock_guard<std::mutex> lock(_affinity_mutex);
+        _affinity.erase(ref);
+    }
+
+    // Sends `req` to `worker` and reads its response within the timeout
+    Forwarded forward(Worker &worker, http::request<http::string_body> const &req, http::response<http::string_body> &res)
+    {
+        // A pooled connection may have been closed by the worker while idle;
+        // then one fresh connection is tried
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            std::unique_ptr<Connection> connection;
+            std::uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                if (worker.state != WorkerState::Ready)
+                    return Forwarded::Failed;
+                generation = worker.generation;
+                if (attempt == 0 && !worker.idle.empty())
+                {
+                    connection = std::move(worker.idle.back());
+                    worker.idle.pop_back();
+                }
+            }
+            bool reused = static_cast<bool>(connection);
+            if (!connection)
+            {
+                connection = std::make_unique<Connection>();
+                if (!connection->connect(worker.endpoint))
+                    return Forwarded::Failed;
+            }
+
+            http::response_parser<http::string_body> parser;
+            parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+            beast::error_code ec = connection->exchange(req, parser, _options.timeout);
+            if (ec == beast::error::timeout)
+                return Forwarded::TimedOut;
+            if (ec)
+            {
+                if (reused)
+                    continue;
+                return Forwarded::Failed;
+            }
+
+            res = parser.release();
+            if (res.keep_alive())
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                if (worker.generation == generation && worker.state == WorkerState::Ready)
+                    worker.idle.push_back(std::move(connection));
+            }
+            return Forwarded::Answered;
+        }
+        return Forwarded::Failed;
+    }
+
+    void dispatch(tcp::socket &socket, http::request<http::string_body> const &req, std::string const &target)
+    {
+        std::string ref = request_ref(req, target);
+        int preferred = affinity(ref);
+        std::uint64_t pixels = target == "/" || target == "/analyze" || target == "/images" ? request_pixels(req) : 0;
+
+        http::request<http::string_body> forwarded = req;
+        forwarded.keep_alive(true);
+
+        std::vector<bool> tried(_workers.size(), false);
+        std::optional<http::response<http::string_body>> busy; // last 503, relayed if nothing better
+        for (int attempt = 0; attempt <= _options.retries; ++attempt)
+        {
+            Worker *worker = pick(tried, preferred);
+            if (!worker)
+                break;
+            tried[worker->index] = true;
+            if (attempt > 0)
+                ++_retries;
+
+            http::response<http::string_body> res;
+            Forwarded outcome;
+            {
+                LoadGuard load(*worker, pixels);
+                outcome = forward(*worker, forwarded, res);
+            }
+            if (outcome != Forwarded::Answered)
+                ++worker->failures;
+            if (outcome == Forwarded::TimedOut)
+            {
+                // Retrying would give another worker the same slow request
+                ++_timeouts;
+                send_json(socket, http::status::gateway_timeout, {{"error", "Worker did not answer in time"}}, req.version(), req.keep_alive());
+                return;
+            }
+            if (outcome == Forwarded::Failed)
+                continue;
+            if (res.result() == http::status::service_unavailable)
+            {
+                busy = std::move(res);
+                continue;
+            }
+
+            // Uploads are remembered so later requests find them
+            if (res.result() == http::status::ok && req.method() == http::verb::post && target == "/images")
+            {
+                json body = json::parse(res.body(), nullptr, false);
+                if (body.is_object() && body.contains("img_ref") && body["img_ref"].is_string())
+                    remember(body["img_ref"].get<std::string>(), worker->index);
+            }
+            else if (res.result() == http::status::ok && req.method() == http::verb::delete_ && !ref.empty())
+                forget(ref);
+            relay(socket, std::move(res), worker->index, req);
+            return;
+        }
+
+        if (busy)
+        {
+            relay(socket, std::move(*busy), -1, req);
+            return;
+        }
+        ++_unavailable;
+        bool any_tried = std::find(tried.begin(), tried.end(), true) != tried.end();
+        send_json(socket, any_tried ? http::status::bad_gateway : http::status::service_unavailable,
+                  {{"error", any_tried ? "Worker failed to answer" : "No worker available"}}, req.version(), req.keep_alive());
+    }
+
+    void relay(tcp::socket &socket, http::response<http::string_body> res, int worker, http::request<http::string_body> const &req)
+    {
+        res.version(req.version());
+        res.keep_alive(req.keep_alive());
+        if (worker >= 0)
+            res.set("X-Worker", std::to_string(worker));
+        beast::error_code ec;
+        http::write(socket, res, ec);
+        if (ec)
+            log_error("write error (dispatcher): " + ec.message());
+    }
+
+    json metrics() const
+    {
+        json workers = json::array();
+        for (auto const &worker : _workers)
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            workers.push_back({{"index", worker->index},
+                               {"port", worker->endpoint.port()},
+                               {"pid", worker->pid},
+                               {"state", state_name(worker->state)},
+                               {"in_flight", worker->in_flight.load()},
+                               {"in_flight_pixels", worker->in_flight_pixels.load()},
+                               {"requests", worker->requests.load()},
+                               {"failures", worker->failures.load()},
+                               {"restarts", worker->restarts.load()}});
+        }
+        return {{"dispatcher", {{"workers", workers}, {"retries", _retries.load()}, {"timeouts", _timeouts.load()}, {"unavailable", _unavailable.load()}}}};
+    }
+
+    // Ready while any worker is
+    void send_ready(tcp::socket &socket, http::request<http::string_body> const &req)
+    {
+        int ready = 0;
+        for (auto const &worker : _workers)
+            ready += worker->state == WorkerState::Ready;
+        if (ready > 0)
+            send_json(socket, http::status::ok, {{"ready", true}, {"workers", ready}}, req.version(), req.keep_alive());
+        else
+            send_json(socket, http::status::service_unavailable, {{"error", "No worker is ready"}}, req.version(), req.keep_alive());
+    }
+
+    void do_session(tcp::socket socket)
+    {
+        beast::flat_buffer buffer;
+        for (;;)
+        {
+            beast::error_code ec;
+            http::request<http::string_body> req;
+            http::read(socket, buffer, req, ec);
+            if (ec == http::error::end_of_stream)
+                break;
+            if (ec)
+            {
+                log_error("read error: " + ec.message());
+                break;
+            }
+
+            std::string target(req.target());
+            auto pos = target.find('?');
+            if (pos != std::string::npos)
+                target.resize(pos);
+
+            try
+            {
+                if (target == "/metrics" && req.method() == http::verb::get)
+                    send_json(socket, http::status::ok, metrics(), req.version(), req.keep_alive());
+                else if (target == "/ready" && req.method() == http::verb::get)
+                    send_ready(socket, req);
+                else
+                    dispatch(socket, req, target);
+            }
+            catch (const std::exception &e)
+            {
+                log_error(std::string("Dispatcher exception: ") + e.what());
+                send_json(socket, http::status::internal_server_error, {{"error", e.what()}}, req.version(), req.keep_alive());
+            }
+
+            if (!req.keep_alive())
+                break;
+        }
+
+        beast::error_code ec;
+        socket.shutdown(tcp::socket::shutdown_send, ec);
+    }
+
+    DispatcherOptions _options;
+    net::io_context _ioc{1};
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<std::size_t> _next{0};
+    std::atomic<std::uint64_t> _retries{0};
+    std::atomic<std::uint64_t> _timeouts{0};
+    std::atomic<std::uint64_t> _unavailable{0};
+
+    std::mutex _affinity_mutex;
+    std::unordered_map<std::string, int> _affinity;
+    std::deque<std::string> _affinity_order;
+};
+
+} // namespace
+
+void mj::run_dispatcher(DispatcherOptions const &options)
+{
+    Dispatcher(options).run();
+}
@@ -0,0 +1,53 @@
+#ifndef MJ_DISPATCHER_HPP
+#define MJ_DISPATCHER_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace mj {
+
+// Cluster mode: an HTTP front end that forwards every request to a pool of
+// vision_tools server processes, so an OpenCV crash on one image loses only
+// the requests in flight on that process.
+//
+// Worker i runs as `<executable> 127.0.0.1 <worker_port + i> <worker_args...>`
+// and is spoken to in plain HTTP, so nothing ties a worker to this host.
+// Each request goes to the ready worker with the least load, counting
+// requests in flight and the pixels they carry (from the image header, with
+// no JSON parse or full base64 decode). Requests naming an img_ref go to the
+// worker that stored the upload. A worker that exits is restarted, with the
+// delay doubling while it keeps dying young. Requests it dropped, and 503s,
+// are retried on other workers up to `retries` times; every route is
+// idempotent, since processing is a pure function of the request and
+// uploads are keyed by their content.
+//
+// A started worker takes requests once its GET /ready succeeds (after its
+// warm-up). GET /metrics is answered by the dispatcher with each worker's
+// state and load, and GET /ready while any worker is ready. A worker that
+// does not answer within `timeout` gets 504 relayed, without a retry.
+//
+// Unless `worker_args` set them, each worker gets an equal share of the
+// cores (--workers, and --intra-op-threads to match) and of the default
+// memory budget (--memory-budget-mb). Options naming a file or socket of
+// their own (--capture, --local-socket, --access-log other than "-") get
+// ".<index>" appended for worker <index>.
+struct DispatcherOptions
+{
+    std::string host;
+    std::string port;
+    int processes = 2;
+    int worker_port = 0;                  // port of worker 0, 0 = port + 1
+    int retries = 1;                      // other workers tried after a failure
+    std::chrono::seconds timeout{120};    // for a worker's response to one request
+    std::string executable;               // vision_tools binary the workers run
+    std::vector<std::string> worker_args; // server options for every worker
+};
+
+// Blocks. Throws std::invalid_argument for bad options and
+// std::runtime_error when the front end cannot listen.
+void run_dispatcher(DispatcherOptions const &options);
+
+} // namespace mj
+
+#endif // MJ_DISPATCHER_HPP
@@ -0,0 +1,337 @@
+#include "fair-scheduler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+using json = nlohmann::json;
+using namespace mj;
+
+// Bound on distinct tenants so arbitrary header values cannot grow the table forever
+static constexpr std::size_t MAX_TENANTS = 1024;
+static constexpr std::size_t MAX_TENANT_NAME = 64;
+static const std::string DEFAULT_TENANT = "default";
+
+// Tenant names become JSON keys in metrics, log fields and capture headers,
+// so a header is only taken as one if it is plain ASCII: letters, digits,
+// '.', '_' and '-', at most MAX_TENANT_NAME of them
+static bool valid_tenant_name(std::string const &name)
+{
+    if (name.empty() || name.size() > MAX_TENANT_NAME)
+        return false;
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-';
+    });
+}
+
+static TenantPolicy policy_from_json(json const &j, TenantPolicy policy)
+{
+    policy.weight = j.value("weight", policy.weight);
+    policy.max_concurrency = j.value("max_concurrency", policy.max_concurrency);
+    policy.max_pixels = j.value("max_pixels", policy.max_pixels);
+    if (!(policy.weight > 0.0))
+        throw std::invalid_argument("Tenant weight must be positive");
+    return policy;
+}
+
+SchedulerConfig SchedulerConfig::from_json(json const &j)
+{
+    SchedulerConfig config;
+    config.worker_slots = j.value("workers", config.worker_slots);
+    config.quantum = j.value("quantum", config.quantum);
+    config.max_queue_time = std::chrono::milliseconds(j.value("max_queue_ms", 0));
+    if (!(config.quantum > 0.0))
+        throw std::invalid_argument("Scheduler quantum must be positive");
+
+    if (j.contains("default") && j["default"].is_object())
+        config.default_policy = policy_from_json(j["default"], config.default_policy);
+
+    if (j.contains("tenants") && j["tenants"].is_object())
+    {
+        for (auto const &item : j["tenants"].items())
+            config.tenants[item.key()] = policy_from_json(item.value(), config.default_policy);
+    }
+
+    if (j.contains("api_keys") && j["api_keys"].is_object())
+    {
+        for (auto const &item : j["api_keys"].items())
+            config.api_keys[item.key()] = item.value().get<std::string>();
+    }
+    return config;
+}
+
+TenantPolicy const &SchedulerConfig::policy_for(std::string const &tenant) const
+{
+    auto it = tenants.find(tenant);
+    return it != tenants.end() ? it->second : default_policy;
+}
+
+// -----------------------------------------------------------------------------
+// Admission
+// -----------------------------------------------------------------------------
+
+FairScheduler::Admission::Admission(FairScheduler *scheduler, TenantState *tenant, double queue_ms)
+    : _scheduler(scheduler), _tenant(tenant), _queue_ms(queue_ms) {}
+
+FairScheduler::Admission::Admission(Admission &&other) noexcept
+    : _scheduler(other._scheduler), _tenant(other._tenant), _queue_ms(other._queue_ms)
+{
+    other._tenant = nullptr;
+}
+
+FairScheduler::Admission &FairScheduler::Admission::operator=(Admission &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        _scheduler = other._scheduler;
+        _tenant = other._tenant;
+        _queue_ms = other._queue_ms;
+        other._tenant = nullptr;
+    }
+    return *this;
+}
+
+FairScheduler::Admission::~Admission()
+{
+    release();
+}
+
+void FairScheduler::Admission::release()
+{
+    if (_tenant)
+    {
+        _scheduler->release(_tenant);
+        _tenant = nullptr;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FairScheduler
+// -----------------------------------------------------------------------------
+
+FairScheduler::FairScheduler(SchedulerConfig config) : _config(std::move(config))
+{
+    if (_config.worker_slots <= 0)
+        _config.worker_slots = std::max(1u, std::thread::hardware_concurrency());
+    _free_slots = _config.worker_slots;
+}
+
+std::string FairScheduler::resolve_tenant(std::string const &tenant_header, std::string const &api_key) const
+{
+    if (!api_key.empty())
+    {
+        auto it = _config.api_keys.find(api_key);
+        if (it != _config.api_keys.end())
+            return it->second;
+    }
+    if (valid_tenant_name(tenant_header))
+        return tenant_header;
+    return DEFAULT_TENANT;
+}
+
+FairScheduler::TenantState &FairScheduler::tenant_locked(std::string const &name)
+{
+    auto it = _tenants.find(name);
+    if (it != _tenants.end())
+        return it->second;
+
+    if (_tenants.size() >= MAX_TENANTS && name != DEFAULT_TENANT)
+        return tenant_locked(DEFAULT_TENANT);
+
+    TenantState &tenant = _tenants[name];
+    tenant.name = name;
+    auto policy = _config.tenants.find(name);
+    tenant.policy = policy != _config.tenants.end() ? policy->second : _config.default_policy;
+    return tenant;
+}
+
+bool FairScheduler::at_capacity(TenantState const &tenant) const
+{
+    return tenant.policy.max_concurrency > 0 && tenant.in_flight >= tenant.policy.max_concurrency;
+}
+
+FairScheduler::Admission FairScheduler::acquire(std::string const &tenant_name, double cost)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    TenantState &tenant = tenant_locked(tenant_name);
+
+    Waiter waiter;
+    waiter.cost = std::max(cost, 1.0);
+    waiter.enqueued = clock::now();
+
+    tenant.queue.push_back(&waiter);
+    if (!tenant.active)
+    {
+        tenant.active = true;
+        _active.push_back(&tenant);
+    }
+    dispatch_locked();
+
+    if (_config.max_queue_time.count() > 0)
+        waiter.cv.wait_for(lock, _config.max_queue_time, [&] { return waiter.granted; });
+    else
+        waiter.cv.wait(lock, [&] { return waiter.granted; });
+
+    double queue_ms = std::chrono::duration<double, std::milli>(clock::now() - waiter.enqueued).count();
+    if (!waiter.granted)
+    {
+        // Timed out: withdraw from the queue so dispatch never grants a dead waiter
+        tenant.queue.erase(std::find(tenant.queue.begin(), tenant.queue.end(), &waiter));
+        if (tenant.queue.empty() && tenant.active)
+        {
+            tenant.active = false;
+            tenant.deficit = 0.0;
+            _active.erase(std::find(_active.begin(), _active.end(), &tenant));
+        }
+        ++tenant.rejected;
+        return Admission();
+    }
+
+    record_wait(tenant, queue_ms);
+    return Admission(this, &tenant, queue_ms);
+}
+
+void FairScheduler::grant_locked(TenantState &tenant)
+{
+    Waiter *waiter = tenant.queue.front();
+    tenant.queue.pop_front();
+    tenant.deficit -= waiter->cost;
+    ++tenant.in_flight;
+    ++tenant.admitted;
+    tenant.cost_admitted += waiter->cost;
+    --_free_slots;
+    waiter->granted = true;
+    waiter->cv.notify_one();
+}
+
+void FairScheduler::dispatch_locked()
+{
+    while (_free_slots > 0 && !_active.empty())
+    {
+        bool granted_any = false;
+        std::size_t visits = _active.size();
+
+        for (std::size_t i = 0; i < visits && _free_slots > 0; ++i)
+        {
+            TenantState *tenant = _active.front();
+            _active.pop_front();
+
+            // Capped tenants keep their place but earn no credit while capped
+            if (!at_capacity(*tenant))
+            {
+                tenant->deficit += _config.quantum * tenant->policy.weight;
+                while (!tenant->queue.empty() && _free_slots > 0 && !at_capacity(*tenant) &&
+                       tenant->queue.front()->cost <= tenant->deficit)
+                {
+                    grant_locked(*tenant);
+                    granted_any = true;
+                }
+            }
+
+            if (tenant->queue.empty())
+            {
+                tenant->active = false;
+                tenant->deficit = 0.0;
+            }
+            else
+            {
+                _active.push_back(tenant);
+            }
+        }
+
+        if (granted_any)
+            continue;
+
+        // Nobody could afford its head request this round. Credit the rounds that
+        // would pass without a grant at once instead of spinning through them.
+        double rounds = std::numeric_limits<double>::infinity();
+        for (TenantState *tenant : _active)
+        {
+            if (at_capacity(*tenant))
+                continue;
+            double missing = tenant->queue.front()->cost - tenant->deficit;
+            rounds = std::min(rounds, std::ceil(missing / (_config.quantum * tenant->policy.weight)));
+        }
+        if (!std::isfinite(rounds))
+            break; // every waiting tenant is at its concurrency cap
+
+        if (rounds > 1.0)
+        {
+            for (TenantState *tenant : _active)
+            {
+                if (!at_capacity(*tenant))
+                    tenant->deficit += (rounds - 1.0) * _config.quantum * tenant->policy.weight;
+            }
+        }
+    }
+}
+
+void FairScheduler::release(TenantState *tenant)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    --tenant->in_flight;
+    ++_free_slots;
+    dispatch_locked();
+}
+
+void FairScheduler::record_wait(TenantState &tenant, double queue_ms)
+{
+    tenant.queue_ms_total += queue_ms;
+    tenant.queue_ms_max = std::max(tenant.queue_ms_max, queue_ms);
+
+    auto us = static_cast<std::uint64_t>(queue_ms * 1000.0);
+    int bucket = 0;
+    while (us > 1 && bucket < 31)
+    {
+        us >>= 1;
+        ++bucket;
+    }
+    ++tenant.queue_us_hist[bucket];
+}
+
+// Upper bound of the log2 bucket holding the given quantile, in milliseconds
+static double histogram_quantile(std::uint64_t const (&hist)[32], std::uint64_t total, double q)
+{
+    if (total == 0)
+        return 0.0;
+    auto rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(total)));
+    std::uint64_t seen = 0;
+    for (int bucket = 0; bucket < 32; ++bucket)
+    {
+        seen += hist[bucket];
+        if (seen >= rank)
+            return static_cast<double>(std::uint64_t(2) << bucket) / 1000.0;
+    }
+    return static_cast<double>(std::uint64_t(1) << 32) / 1000.0;
+}
+
+json FairScheduler::metrics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    json j;
+    j["worker_slots"] = _config.worker_slots;
+    j["free_slots"] = _free_slots;
+    j["tenants"] = json::object();
+
+    for (auto const &item : _tenants)
+    {
+        TenantState const &tenant = item.second;
+        json t;
+        t["weight"] = tenant.policy.weight;
+        t["max_concurrency"] = tenant.policy.max_concurrency;
+        t["queued"] = tenant.queue.size();
+        t["in_flight"] = tenant.in_flight;
+        t["admitted"] = tenant.admitted;
+        t["rejected"] = tenant.rejected;
+        t["cost_admitted"] = tenant.cost_admitted;
+        t["queue_ms_mean"] = tenant.admitted ? tenant.queue_ms_total / static_cast<double>(tenant.admitted) : 0.0;
+        t["queue_ms_max"] = tenant.queue_ms_max;
+        t["queue_ms_p50"] = histogram_quantile(tenant.queue_us_hist, tenant.admitted, 0.50);
+        t["queue_ms_p95"] = histogram_quantile(tenant.queue_us_hist, tenant.admitted, 0.95);
+        t["queue_ms_p99"] = histogram_quantile(tenant.queue_us_hist, tenant.admitted, 0.99);
+        j["tenants"][tenant.name] = t;
+    }
+    return j;
+}
@@ -0,0 +1,133 @@
+#ifndef MJ_FAIR_SCHEDULER_HPP
+#define MJ_FAIR_SCHEDULER_HPP
+
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace mj {
+
+// Per-tenant scheduling policy
+struct TenantPolicy
+{
+    double weight = 1.0;     // share of worker capacity relative to other tenants
+    int max_concurrency = 0; // admitted requests at once, 0 = unlimited
+    std::size_t max_pixels = 0; // per image, 0 = the server's limit
+};
+
+struct SchedulerConfig
+{
+    int worker_slots = 0;                          // concurrent image jobs, 0 = hardware concurrency
+    double quantum = 1 << 20;                      // cost units credited per round at weight 1.0
+    std::chrono::milliseconds max_queue_time{0};   // 0 = wait indefinitely
+    TenantPolicy default_policy;
+    std::map<std::string, TenantPolicy> tenants;
+    std::map<std::string, std::string> api_keys;   // API key -> tenant name
+
+    // {"workers": 8, "quantum": 1048576, "max_queue_ms": 2000,
+    //  "default": {"weight": 1}, "tenants": {"batch": {"weight": 0.2, "max_concurrency": 2, "max_pixels": 50000000}},
+    //  "api_keys": {"<key>": "batch"}}
+    static SchedulerConfig from_json(nlohmann::json const &j);
+
+    // Policy of a tenant as named by FairScheduler::resolve_tenant
+    TenantPolicy const &policy_for(std::string const &tenant) const;
+};
+
+// Weighted deficit round robin in front of the image workers.
+//
+// Each request is charged its estimated cost (pixels x pipeline stages) rather
+// than counting as one unit, so a tenant sending 24 MP images consumes its share
+// in a few requests while small interactive calls from other tenants keep
+// flowing. Session threads block in acquire() until a worker slot is granted.
+class FairScheduler
+{
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Waiter
+    {
+        double cost;
+        clock::time_point enqueued;
+        std::condition_variable cv;
+        bool granted = false;
+    };
+
+    struct TenantState
+    {
+        std::string name;
+        TenantPolicy policy;
+        std::deque<Waiter *> queue;
+        double deficit = 0.0;
+        bool active = false;
+        int in_flight = 0;
+
+        // metrics
+        std::uint64_t admitted = 0;
+        std::uint64_t rejected = 0;
+        double cost_admitted = 0.0;
+        double queue_ms_total = 0.0;
+        double queue_ms_max = 0.0;
+        std::uint64_t queue_us_hist[32] = {}; // log2 buckets of queue time in microseconds
+    };
+
+public:
+    // RAII grant of one worker slot; releases it on destruction
+    class Admission
+    {
+    public:
+        Admission() = default;
+        Admission(Admission &&other) noexcept;
+        Admission &operator=(Admission &&other) noexcept;
+        Admission(Admission const &) = delete;
+        Admission &operator=(Admission const &) = delete;
+        ~Admission();
+
+        bool granted() const { return _tenant != nullptr; }
+        double queue_ms() const { return _queue_ms; }
+        void release();
+
+    private:
+        friend class FairScheduler;
+        Admission(FairScheduler *scheduler, TenantState *tenant, double queue_ms);
+
+        FairScheduler *_scheduler = nullptr;
+        TenantState *_tenant = nullptr;
+        double _queue_ms = 0.0;
+    };
+
+    explicit FairScheduler(SchedulerConfig config);
+
+    // Blocks until the request may run. Returns a non-granted admission when
+    // max_queue_time expires first.
+    Admission acquire(std::string const &tenant, double cost);
+
+    // Tenant from the API key mapping first, then the explicit tenant header
+    // when it is 1-64 of [A-Za-z0-9._-], else the default tenant
+    std::string resolve_tenant(std::string const &tenant_header, std::string const &api_key) const;
+
+    nlohmann::json metrics() const;
+    SchedulerConfig const &config() const { return _config; }
+
+private:
+    TenantState &tenant_locked(std::string const &name);
+    bool at_capacity(TenantState const &tenant) const;
+    void dispatch_locked();
+    void grant_locked(TenantState &tenant);
+    void release(TenantState *tenant);
+    static void record_wait(TenantState &tenant, double queue_ms);
+
+    SchedulerConfig _config;
+    mutable std::mutex _mutex;
+    std::map<std::string, TenantState> _tenants;
+    std::deque<TenantState *> _active;
+    int _free_slots;
+};
+
+} // namespace mj
+
+#endif // MJ_FAIR_SCHEDULER_HPP
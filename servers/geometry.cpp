@@ -0,0 +1,165 @@
+#include "geometry.hpp"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace mj;
+
+cv::Matx23d ResizeTransform::matrix(cv::Size input) const
+{
+    double sx = static_cast<double>(_size.width) / input.width;
+    double sy = static_cast<double>(_size.height) / input.height;
+    return cv::Matx23d(sx, 0, 0.5 * sx - 0.5,
+                       0, sy, 0.5 * sy - 0.5);
+}
+
+cv::Matx23d RotateTransform::matrix(cv::Size input) const
+{
+    cv::Point2f center(input.width / 2.0F, input.height / 2.0F);
+    cv::Matx23d m = cv::getRotationMatrix2D(center, _angle, 1.0);
+    return m;
+}
+
+static cv::Matx33d homogeneous(cv::Matx23d const &m)
+{
+    return cv::Matx33d(m(0, 0), m(0, 1), m(0, 2),
+                       m(1, 0), m(1, 1), m(1, 2),
+                       0, 0, 1);
+}
+
+cv::Matx23d mj::compose(GeometricSteps const &steps, cv::Size input, cv::Size &output)
+{
+    cv::Matx33d total = cv::Matx33d::eye();
+    output = input;
+    for (auto const &step : steps)
+    {
+        total = homogeneous(step->matrix(output)) * total;
+        output = step->output_size(output);
+    }
+    return cv::Matx23d(total(0, 0), total(0, 1), total(0, 2),
+                       total(1, 0), total(1, 1), total(1, 2));
+}
+
+// Number of pyrDown halvings before the bilinear warp: while every direction
+// still shrinks by 2x or more
+static int pyramid_levels(cv::Matx23d m, cv::Size size)
+{
+    int levels = 0;
+    for (;;)
+    {
+        double scale_x = std::hypot(m(0, 0), m(1, 0));
+        double scale_y = std::hypot(m(0, 1), m(1, 1));
+        if (std::max(scale_x, scale_y) > 0.5 || size.width < 2 || size.height < 2)
+            return levels;
+
+        size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+        for (int r = 0; r < 2; ++r)
+        {
+            m(r, 0) *= 2.0;
+            m(r, 1) *= 2.0;
+        }
+        ++levels;
+    }
+}
+
+void mj::warp_fused(cv::Mat const &src, cv::Mat &dst, GeometricSteps const &steps)
+{
+    cv::Size out;
+    cv::Matx23d m = compose(steps, src.size(), out);
+
+    // A composite that is exactly a resize of the source goes through cv::resize
+    cv::Matx23d plain = ResizeTransform(out.width, out.height).matrix(src.size());
+    double deviation = 0;
+    for (int i = 0; i < 6; ++i)
+        deviation = std::max(deviation, std::abs(m.val[i] - plain.val[i]));
+    if (deviation < 1e-9)
+    {
+        bool downscale = out.width <= src.cols && out.height <= src.rows;
+        cv::resize(src, dst, out, 0, 0, downscale ? cv::INTER_AREA : cv::INTER_LINEAR);
+        return;
+    }
+
+    // pyrDown output pixel i is centred on input pixel 2i
+    cv::Mat base = src;
+    for (int level = pyramid_levels(m, src.size()); level > 0; --level)
+    {
+        cv::Mat reduced;
+        cv::pyrDown(base, reduced);
+        base = reduced;
+        for (int r = 0; r < 2; ++r)
+        {
+            m(r, 0) *= 2.0;
+            m(r, 1) *= 2.0;
+        }
+    }
+
+    cv::warpAffine(base, dst, m, out, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+cv::Rect mj::source_window(GeometricSteps const &steps, cv::Size input, cv::Rect window, bool pyramid)
+{
+    cv::Size out;
+    cv::Matx23d m = compose(steps, input, out);
+    int levels = pyramid ? pyramid_levels(m, input) : 0;
+    double scale = static_cast<double>(1 << levels);
+
+    // Where the window's pixel centres sample the source, in level coordinates
+    cv::Matx23d inverse;
+    cv::invertAffineTransform(m, inverse);
+    double min_x = HUGE_VAL, min_y = HUGE_VAL, max_x = -HUGE_VAL, max_y = -HUGE_VAL;
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        cv::Vec3d p(window.x + (corner & 1 ? window.width - 1 : 0), window.y + (corner & 2 ? window.height - 1 : 0), 1);
+        cv::Vec2d q = inverse * p;
+        min_x = std::min(min_x, q[0] / scale);
+        max_x = std::max(max_x, q[0] / scale);
+        min_y = std::min(min_y, q[1] / scale);
+        max_y = std::max(max_y, q[1] / scale);
+    }
+
+    // Bilinear taps, then each pyrDown level's 5-tap footprint
+    int left = cvFloor(min_x), top = cvFloor(min_y);
+    int right = cvFloor(max_x) + 1, bottom = cvFloor(max_y) + 1;
+    for (int level = 0; level < levels; ++level)
+    {
+        left = 2 * left - 2;
+        top = 2 * top - 2;
+        right = 2 * right + 2;
+        bottom = 2 * bottom + 2;
+    }
+
+    cv::Rect region = cv::Rect(left, top, right - left + 1, bottom - top + 1) & cv::Rect(cv::Point(), input);
+    if (region.empty())
+        region = cv::Rect(0, 0, 1, 1); // every sample falls outside the source
+
+    int align = 1 << levels;
+    int shift_x = region.x % align, shift_y = region.y % align;
+    return cv::Rect(region.x - shift_x, region.y - shift_y, region.width + shift_x, region.height + shift_y);
+}
+
+void mj::warp_window(cv::Mat const &src, cv::Point origin, cv::Size input, GeometricSteps const &steps,
+                     cv::Rect window, bool pyramid, int border, cv::Mat &dst)
+{
+    cv::Size out;
+    cv::Matx23d m = compose(steps, input, out);
+
+    cv::Mat base = src;
+    for (int level = pyramid ? pyramid_levels(m, input) : 0; level > 0; --level)
+    {
+        cv::Mat reduced;
+        cv::pyrDown(base, reduced);
+        base = reduced;
+        origin.x /= 2;
+        origin.y /= 2;
+        for (int r = 0; r < 2; ++r)
+        {
+            m(r, 0) *= 2.0;
+            m(r, 1) *= 2.0;
+        }
+    }
+
+    // Re-express the map between the two windows' own pixel grids
+    for (int r = 0; r < 2; ++r)
+        m(r, 2) += m(r, 0) * origin.x + m(r, 1) * origin.y - (r == 0 ? window.x : window.y);
+    cv::warpAffine(base, dst, m, window.size(), cv::INTER_LINEAR, border);
+}
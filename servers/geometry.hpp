@@ -0,0 +1,83 @@
+#ifndef MJ_GEOMETRY_HPP
+#define MJ_GEOMETRY_HPP
+
+#include <opencv2/core.hpp>
+#include <memory>
+#include <vector>
+
+namespace mj {
+
+// A stage that only moves pixels. Adjacent geometric stages are folded into a
+// single affine map so the image is resampled once from the source, unless an
+// intermediate frame loses something the later ones would sample: the corners
+// a Rotate crops, or detail a smaller Resize drops (pipeline.cpp, joins_run).
+// A folded run samples the same scene as the chained stages, but resamples
+// once: reductions are filtered (INTER_AREA or pyrDown) where chained bilinear
+// resizes alias, so detailed areas differ by that filtering, and edges by
+// about half a source pixel of border.
+class GeometricTransform
+{
+public:
+    virtual cv::Size output_size(cv::Size input) const = 0;
+
+    // Forward map from input pixel coordinates to output pixel coordinates
+    virtual cv::Matx23d matrix(cv::Size input) const = 0;
+
+    virtual ~GeometricTransform() = default;
+};
+
+using GeometricSteps = std::vector<std::shared_ptr<GeometricTransform const>>;
+
+// Same pixel-centre convention as cv::resize
+class ResizeTransform : public GeometricTransform
+{
+public:
+    ResizeTransform(int width, int height) : _size(width, height) {}
+    cv::Size output_size(cv::Size) const override { return _size; }
+    cv::Matx23d matrix(cv::Size input) const override;
+
+private:
+    cv::Size _size;
+};
+
+// Rotation about the image centre keeping the input size, as RotateProcessor does
+class RotateTransform : public GeometricTransform
+{
+public:
+    explicit RotateTransform(double angle) : _angle(angle) {}
+    cv::Size output_size(cv::Size input) const override { return input; }
+    cv::Matx23d matrix(cv::Size input) const override;
+
+private:
+    double _angle;
+};
+
+// Composite forward map and output size of a run of steps applied to `input`
+cv::Matx23d compose(GeometricSteps const &steps, cv::Size input, cv::Size &output);
+
+// Resamples `src` once through the composite of `steps`. A composite that is a
+// pure downscale uses INTER_AREA; other large reductions are pre-reduced with
+// pyrDown so bilinear sampling does not alias. Uncovered pixels are black.
+void warp_fused(cv::Mat const &src, cv::Mat &dst, GeometricSteps const &steps);
+
+// Windowed warps for region-of-interest runs. `pyramid` and `border` select
+// the resampling: warp_fused's pyrDown + bilinear with a black border, or one
+// bilinear pass as ResizeProcessor (replicated border) and RotateProcessor
+// (black border) do. Windows are resampled on their own pixel grid, so the
+// 1/32 pixel coordinate rounding of warpAffine can move a value by one grey
+// level against the full-frame warp. A window of warp_fused whose composite
+// is a pure resize is computed the pyramid way rather than with INTER_AREA
+// and can differ by a few levels.
+
+// Source pixels the output `window` depends on, clipped to the source and
+// aligned so pyramid levels line up with the full image's
+cv::Rect source_window(GeometricSteps const &steps, cv::Size input, cv::Rect window, bool pyramid);
+
+// Output pixels `window` of warping a source of size `input`, of which `src`
+// holds source_window(steps, input, window, pyramid) at `origin`
+void warp_window(cv::Mat const &src, cv::Point origin, cv::Size input, GeometricSteps const &steps,
+                 cv::Rect window, bool pyramid, int border, cv::Mat &dst);
+
+} // namespace mj
+
+#endif // MJ_GEOMETRY_HPP
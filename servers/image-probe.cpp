@@ -0,0 +1,103 @@
+#include "image-probe.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+using namespace mj;
+
+namespace {
+
+std::uint32_t be16(unsigned char const *p) { return std::uint32_t(p[0]) << 8 | p[1]; }
+std::uint32_t be32(unsigned char const *p) { return be16(p) << 16 | be16(p + 2); }
+std::uint32_t le16(unsigned char const *p) { return std::uint32_t(p[1]) << 8 | p[0]; }
+std::uint32_t le24(unsigned char const *p) { return std::uint32_t(p[2]) << 16 | le16(p); }
+std::uint32_t le32(unsigned char const *p) { return std::uint32_t(p[3]) << 24 | le24(p); }
+
+std::optional<cv::Size> checked(std::uint32_t width, std::uint32_t height)
+{
+    if (width == 0 || height == 0 || width > (1u << 30) || height > (1u << 30))
+        return std::nullopt;
+    return cv::Size(static_cast<int>(width), static_cast<int>(height));
+}
+
+// Walks the marker segments up to the first start-of-frame
+std::optional<cv::Size> probe_jpeg(unsigned char const *p, std::size_t size)
+{
+    std::size_t at = 2;
+    while (at + 4 <= size)
+    {
+        if (p[at] != 0xFF)
+            return std::nullopt;
+        unsigned marker = p[at + 1];
+        if (marker == 0xFF) // fill byte
+        {
+            ++at;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) // no length
+        {
+            at += 2;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) // end of image, or scan data before any frame
+            return std::nullopt;
+
+        std::size_t length = be16(p + at + 2);
+        bool frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (frame)
+        {
+            if (at + 9 > size)
+                return std::nullopt;
+            return checked(be16(p + at + 7), be16(p + at + 5));
+        }
+        if (length < 2)
+            return std::nullopt;
+        at += 2 + length;
+    }
+    return std::nullopt;
+}
+
+std::optional<cv::Size> probe_webp(unsigned char const *p, std::size_t size)
+{
+    if (size < 30)
+        return std::nullopt;
+    if (std::memcmp(p + 12, "VP8 ", 4) == 0 && p[23] == 0x9D && p[24] == 0x01 && p[25] == 0x2A)
+        return checked(le16(p + 26) & 0x3FFF, le16(p + 28) & 0x3FFF);
+    if (std::memcmp(p + 12, "VP8L", 4) == 0 && p[20] == 0x2F)
+    {
+        std::uint32_t bits = le32(p + 21);
+        return checked((bits & 0x3FFF) + 1, ((bits >> 14) & 0x3FFF) + 1);
+    }
+    if (std::memcmp(p + 12, "VP8X", 4) == 0)
+        return checked(le24(p + 24) + 1, le24(p + 27) + 1);
+    return std::nullopt;
+}
+
+} // namespace
+
+std::optional<cv::Size> mj::probe_image_size(std::vector<unsigned char> const &data)
+{
+    return probe_image_size(data.data(), data.size());
+}
+
+std::optional<cv::Size> mj::probe_image_size(unsigned char const *p, std::size_t size)
+{
+    if (size >= 4 && p[0] == 0xFF && p[1] == 0xD8)
+        return probe_jpeg(p, size);
+    if (size >= 24 && std::memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0 && std::memcmp(p + 12, "IHDR", 4) == 0)
+        return checked(be32(p + 16), be32(p + 20));
+    if (size >= 12 && std::memcmp(p, "RIFF", 4) == 0 && std::memcmp(p + 8, "WEBP", 4) == 0)
+        return probe_webp(p, size);
+    if (size >= 10 && (std::memcmp(p, "GIF87a", 6) == 0 || std::memcmp(p, "GIF89a", 6) == 0))
+        return checked(le16(p + 6), le16(p + 8));
+    if (size >= 26 && p[0] == 'B' && p[1] == 'M')
+    {
+        std::uint32_t header = le32(p + 14);
+        if (header == 12)
+            return checked(le16(p + 18), le16(p + 20));
+        // Negative height marks a top-down bitmap
+        std::int32_t height = static_cast<std::int32_t>(le32(p + 22));
+        return checked(le32(p + 18), static_cast<std::uint32_t>(std::abs(static_cast<long long>(height))));
+    }
+    return std::nullopt;
+}
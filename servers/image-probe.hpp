@@ -0,0 +1,22 @@
+#ifndef MJ_IMAGE_PROBE_HPP
+#define MJ_IMAGE_PROBE_HPP
+
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace mj {
+
+// Width and height from an encoded image's header, without decoding pixels,
+// so a request can be sized (and refused) before imdecode allocates. Reads
+// JPEG (SOF), PNG (IHDR), WebP (VP8, VP8L, VP8X), GIF and BMP headers;
+// nullopt for other formats and truncated or malformed headers. EXIF
+// orientation is not applied, so a rotated JPEG may report width and height
+// swapped; the pixel count is the same.
+std::optional<cv::Size> probe_image_size(std::vector<unsigned char> const &data);
+std::optional<cv::Size> probe_image_size(unsigned char const *data, std::size_t size);
+
+} // namespace mj
+
+#endif // MJ_IMAGE_PROBE_HPP
@@ -3,18 +3,37 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/photo.hpp>
+#include <algorithm>
+#include "morphology.hpp"
+#include "blur.hpp"
+#include "tracing.hpp"
 
 // BaseProcessor
 Mat BaseProcessor::process(const Mat &image) {
     return image.clone();
 }
 
-// Grayscale
-GrayscaleProcessor::GrayscaleProcessor(std::unique_ptr<ImageProcessor> processor)
+// ProcessorDecorator
+ProcessorDecorator::ProcessorDecorator(std::unique_ptr<ImageProcessor> processor)
     : wrapped_processor(std::move(processor)) {}
 
-Mat GrayscaleProcessor::process(const Mat &image) {
+Mat ProcessorDecorator::process(const Mat &image) {
     Mat input = wrapped_processor->process(image);
+    if (label.empty())
+        return apply(input);
+    mj::TraceScope span(label, true);
+    return apply(input);
+}
+
+bool ProcessorDecorator::temporal() const {
+    return wrapped_processor && wrapped_processor->temporal();
+}
+
+// Grayscale
+GrayscaleProcessor::GrayscaleProcessor(std::unique_ptr<ImageProcessor> processor)
+    : ProcessorDecorator(std::move(processor)) {}
+
+Mat GrayscaleProcessor::apply(const Mat &input) const {
     Mat gray;
     cvtColor(input, gray, COLOR_BGR2GRAY);
     cvtColor(gray, gray, COLOR_GRAY2BGR);
@@ -23,32 +42,56 @@ Mat GrayscaleProcessor::process(const Mat &image) {
 
 // Resize
 ResizeProcessor::ResizeProcessor(std::unique_ptr<ImageProcessor> processor, int w, int h)
-    : wrapped_processor(std::move(processor)), width(w), height(h) {}
+    : ProcessorDecorator(std::move(processor)), width(w), height(h) {}
 
-Mat ResizeProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat ResizeProcessor::apply(const Mat &input) const {
     Mat resized;
     resize(input, resized, Size(width, height));
     return resized;
 }
 
+// Fused geometric stages
+GeometricProcessor::GeometricProcessor(std::unique_ptr<ImageProcessor> processor, mj::GeometricSteps s)
+    : ProcessorDecorator(std::move(processor)), steps(std::move(s)) {}
+
+Mat GeometricProcessor::apply(const Mat &input) const {
+    Mat warped;
+    mj::warp_fused(input, warped, steps);
+    return warped;
+}
+
+// Colour-tracked run
+ColorTrackedProcessor::ColorTrackedProcessor(std::unique_ptr<ImageProcessor> processor, std::vector<std::unique_ptr<mj::TrackedStage>> s)
+    : ProcessorDecorator(std::move(processor)), stages(std::move(s)) {}
+
+Mat ColorTrackedProcessor::apply(const Mat &input) const {
+    mj::TrackedImage image(input);
+    for (auto const &stage : stages)
+        stage->apply(image);
+    return image.to_bgr();
+}
+
+bool ColorTrackedProcessor::temporal() const {
+    if (ProcessorDecorator::temporal())
+        return true;
+    return std::any_of(stages.begin(), stages.end(), [](auto const &stage) { return stage->temporal(); });
+}
+
 // Blur
 BlurProcessor::BlurProcessor(std::unique_ptr<ImageProcessor> processor, int kernel)
-    : wrapped_processor(std::move(processor)), kernel_size(kernel) {}
+    : ProcessorDecorator(std::move(processor)), kernel_size(kernel) {}
 
-Mat BlurProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat BlurProcessor::apply(const Mat &input) const {
     Mat blurred;
-    GaussianBlur(input, blurred, Size(kernel_size, kernel_size), 0);
+    mj::gaussian_blur(input, blurred, kernel_size, 0);
     return blurred;
 }
 
 // Edge Detection
 EdgeDetectionProcessor::EdgeDetectionProcessor(std::unique_ptr<ImageProcessor> processor)
-    : wrapped_processor(std::move(processor)) {}
+    : ProcessorDecorator(std::move(processor)) {}
 
-Mat EdgeDetectionProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat EdgeDetectionProcessor::apply(const Mat &input) const {
     Mat gray, edges;
     cvtColor(input, gray, COLOR_BGR2GRAY);
     Canny(gray, edges, 100, 200);
@@ -58,10 +101,9 @@ Mat EdgeDetectionProcessor::process(const Mat &image) {
 
 // Rotate
 RotateProcessor::RotateProcessor(std::unique_ptr<ImageProcessor> processor, double angle)
-    : wrapped_processor(std::move(processor)), angle(angle) {}
+    : ProcessorDecorator(std::move(processor)), angle(angle) {}
 
-Mat RotateProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat RotateProcessor::apply(const Mat &input) const {
     Point2f center(input.cols / 2.0F, input.rows / 2.0F);
     Mat rot = getRotationMatrix2D(center, angle, 1.0);
     Mat rotated;
@@ -71,10 +113,9 @@ Mat RotateProcessor::process(const Mat &image) {
 
 // Brightness and Contrast
 BrightnessContrastProcessor::BrightnessContrastProcessor(std::unique_ptr<ImageProcessor> processor, int b, double c)
-    : wrapped_processor(std::move(processor)), brightness(b), contrast(c) {}
+    : ProcessorDecorator(std::move(processor)), brightness(b), contrast(c) {}
 
-Mat BrightnessContrastProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat BrightnessContrastProcessor::apply(const Mat &input) const {
     Mat adjusted;
     input.convertTo(adjusted, -1, contrast, brightness);
     return adjusted;
@@ -82,11 +123,10 @@ Mat BrightnessContrastProcessor::process(const Mat &image) {
 
 // Sharpen
 SharpenProcessor::SharpenProcessor(std::unique_ptr<ImageProcessor> processor)
-    : wrapped_processor(std::move(processor)) {}
+    : ProcessorDecorator(std::move(processor)) {}
 
-Mat SharpenProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
-    Mat kernel = (Mat_<float>(3,3) <<
+Mat SharpenProcessor::apply(const Mat &input) const {
+    static const Mat kernel = (Mat_<float>(3,3) <<
                   0, -1, 0,
                  -1, 5,-1,
                   0, -1, 0);
@@ -98,13 +138,12 @@ Mat SharpenProcessor::process(const Mat &image) {
 
 // Gamma Correction
 GammaCorrectionProcessor::GammaCorrectionProcessor(std::unique_ptr<ImageProcessor> processor, double g)
-    : wrapped_processor(std::move(processor)), gamma(g) {}
-
-Mat GammaCorrectionProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
-    Mat lut(1, 256, CV_8UC1);
+    : ProcessorDecorator(std::move(processor)), gamma(g), lut(1, 256, CV_8UC1) {
     for (int i = 0; i < 256; ++i)
         lut.at<uchar>(i) = pow(i / 255.0, gamma) * 255.0;
+}
+
+Mat GammaCorrectionProcessor::apply(const Mat &input) const {
     Mat result;
     LUT(input, lut, result);
     return result;
@@ -112,20 +151,27 @@ Mat GammaCorrectionProcessor::process(const Mat &image) {
 
 // Watermark
 WatermarkProcessor::WatermarkProcessor(std::unique_ptr<ImageProcessor> processor, const std::string &txt)
-    : wrapped_processor(std::move(processor)), text(txt) {}
+    : ProcessorDecorator(std::move(processor)), text(txt), mask(mj::text_mask(txt, 1, 2, Scalar(255, 255, 255), false)) {}
 
-Mat WatermarkProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
-    putText(input, text, Point(10, input.rows - 10), FONT_HERSHEY_SIMPLEX, 1, Scalar(255, 255, 255), 2);
-    return input;
+Mat WatermarkProcessor::apply(const Mat &input) const {
+    Mat output = input.clone();
+    mj::blend_overlay(output, *mask, Point(10, output.rows - 10) - mask->anchor);
+    return output;
+}
+
+// Overlay
+OverlayProcessor::OverlayProcessor(std::unique_ptr<ImageProcessor> processor, const nlohmann::json &params)
+    : ProcessorDecorator(std::move(processor)), overlay(params) {}
+
+Mat OverlayProcessor::apply(const Mat &input) const {
+    return overlay.apply(input);
 }
 
 
 ColorInversionProcessor::ColorInversionProcessor(std::unique_ptr<ImageProcessor> processor)
-    : wrapped_processor(std::move(processor)) {}
+    : ProcessorDecorator(std::move(processor)) {}
 
-cv::Mat ColorInversionProcessor::process(const cv::Mat& image) {
-    cv::Mat input = wrapped_processor->process(image);
+cv::Mat ColorInversionProcessor::apply(const cv::Mat& input) const {
     cv::Mat inverted;
     cv::bitwise_not(input, inverted);
     return inverted;
@@ -134,11 +180,10 @@ cv::Mat ColorInversionProcessor::process(const cv::Mat& image) {
 
 // Sepia
 SepiaProcessor::SepiaProcessor(std::unique_ptr<ImageProcessor> processor)
-    : wrapped_processor(std::move(processor)) {}
+    : ProcessorDecorator(std::move(processor)) {}
 
-Mat SepiaProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
-    Mat kernel = (Mat_<float>(3,3) <<
+Mat SepiaProcessor::apply(const Mat &input) const {
+    static const Mat kernel = (Mat_<float>(3,3) <<
          0.272, 0.534, 0.131,
          0.349, 0.686, 0.168,
          0.393, 0.769, 0.189);
@@ -149,10 +194,9 @@ Mat SepiaProcessor::process(const Mat &image) {
 
 // Median Blur
 MedianBlurProcessor::MedianBlurProcessor(std::unique_ptr<ImageProcessor> processor, int k)
-    : wrapped_processor(std::move(processor)), kernel_size(k) {}
+    : ProcessorDecorator(std::move(processor)), kernel_size(k) {}
 
-Mat MedianBlurProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat MedianBlurProcessor::apply(const Mat &input) const {
     Mat blurred;
     medianBlur(input, blurred, kernel_size);
     return blurred;
@@ -160,10 +204,9 @@ Mat MedianBlurProcessor::process(const Mat &image) {
 
 // Histogram Stretch
 HistogramStretchProcessor::HistogramStretchProcessor(std::unique_ptr<ImageProcessor> processor)
-    : wrapped_processor(std::move(processor)) {}
+    : ProcessorDecorator(std::move(processor)) {}
 
-Mat HistogramStretchProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat HistogramStretchProcessor::apply(const Mat &input) const {
     Mat result;
     normalize(input, result, 0, 255, NORM_MINMAX);
     return result;
@@ -171,51 +214,58 @@ Mat HistogramStretchProcessor::process(const Mat &image) {
 
 // Unsharp Mask
 UnsharpMaskProcessor::UnsharpMaskProcessor(std::unique_ptr<ImageProcessor> processor, double s)
-    : wrapped_processor(std::move(processor)), strength(s) {}
+    : ProcessorDecorator(std::move(processor)), strength(s) {}
 
-Mat UnsharpMaskProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat UnsharpMaskProcessor::apply(const Mat &input) const {
     Mat blurred;
-    GaussianBlur(input, blurred, Size(0, 0), 3);
-    Mat sharp = input + strength * (input - blurred);
+    mj::gaussian_blur(input, blurred, 0, 3);
+    Mat sharp;
+    mj::unsharp_mask(input, blurred, sharp, strength);
     return sharp;
 }
 
 // Dilation
 DilationProcessor::DilationProcessor(std::unique_ptr<ImageProcessor> processor, int k)
-    : wrapped_processor(std::move(processor)), kernel_size(k) {}
+    : ProcessorDecorator(std::move(processor)), kernel_size(k) {}
 
-Mat DilationProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat DilationProcessor::apply(const Mat &input) const {
     Mat result;
-    Mat kernel = getStructuringElement(MORPH_RECT, Size(kernel_size, kernel_size));
-    dilate(input, result, kernel);
+    mj::dilate_rect(input, result, Size(kernel_size, kernel_size));
     return result;
 }
 
 // Erosion
 ErosionProcessor::ErosionProcessor(std::unique_ptr<ImageProcessor> processor, int k)
-    : wrapped_processor(std::move(processor)), kernel_size(k) {}
+    : ProcessorDecorator(std::move(processor)), kernel_size(k) {}
 
-Mat ErosionProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat ErosionProcessor::apply(const Mat &input) const {
+    Mat result;
+    mj::erode_rect(input, result, Size(kernel_size, kernel_size));
+    return result;
+}
+
+// Opening / Closing / Gradient
+MorphologyProcessor::MorphologyProcessor(std::unique_ptr<ImageProcessor> processor, int op, int k)
+    : ProcessorDecorator(std::move(processor)), operation(op), kernel_size(k) {}
+
+Mat MorphologyProcessor::apply(const Mat &input) const {
     Mat result;
-    Mat kernel = getStructuringElement(MORPH_RECT, Size(kernel_size, kernel_size));
-    erode(input, result, kernel);
+    mj::morphology_rect(input, result, operation, Size(kernel_size, kernel_size));
     return result;
 }
 
 // CLAHE
 CLAHEProcessor::CLAHEProcessor(std::unique_ptr<ImageProcessor> processor, double clip)
-    : wrapped_processor(std::move(processor)), clip_limit(clip) {}
+    : ProcessorDecorator(std::move(processor)), clip_limit(clip) {}
 
-Mat CLAHEProcessor::process(const Mat &image) {
-    Mat input = wrapped_processor->process(image);
+Mat CLAHEProcessor::apply(const Mat &input) const {
     Mat lab_image;
     cvtColor(input, lab_image, COLOR_BGR2Lab);
     std::vector<Mat> lab_planes(3);
     split(lab_image, lab_planes);
-    Ptr<CLAHE> clahe = createCLAHE(clip_limit);
+    // CLAHE keeps scratch buffers between calls, so each thread reuses its own instance
+    thread_local Ptr<CLAHE> clahe = createCLAHE();
+    clahe->setClipLimit(clip_limit);
     clahe->apply(lab_planes[0], lab_planes[0]);
     merge(lab_planes, lab_image);
     Mat result;
@@ -225,10 +275,9 @@ Mat CLAHEProcessor::process(const Mat &image) {
 
 // EqualizeHistogramProcessor
 EqualizeHistogramProcessor::EqualizeHistogramProcessor(std::unique_ptr<ImageProcessor> processor)
-    : wrapped_processor(std::move(processor)) {}
+    : ProcessorDecorator(std::move(processor)) {}
 
-cv::Mat EqualizeHistogramProcessor::process(const cv::Mat& image) {
-    cv::Mat input = wrapped_processor->process(image);
+cv::Mat EqualizeHistogramProcessor::apply(const cv::Mat& input) const {
     cv::Mat ycrcb;
     cv::cvtColor(input, ycrcb, cv::COLOR_BGR2YCrCb);
     std::vector<cv::Mat> channels;
@@ -1,3 +1,6 @@
+#ifndef IMAGE_PROCESSOR_HPP
+#define IMAGE_PROCESSOR_HPP
+
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -8,12 +11,20 @@
 #include "opencv2/imgproc.hpp"
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
+#include "geometry.hpp"
+#include "color-space.hpp"
+#include "overlay.hpp"
 using namespace cv;
 
 class ImageProcessor
 {
 public:
     virtual Mat process(const Mat &image) = 0;
+
+    // True if the output depends on earlier frames (temporal filters). Such
+    // chains must see frames one at a time and in order.
+    virtual bool temporal() const { return false; }
+
     virtual ~ImageProcessor() = default;
 };
 
@@ -26,228 +37,277 @@ public:
 };
 
 // Decorators
-class GrayscaleProcessor : public ImageProcessor
+//
+// Each decorator runs its wrapped chain and then apply(), which holds only this
+// stage's work. apply() is const and must not touch shared mutable state, so a
+// compiled chain can be run by many session threads at once.
+class ProcessorDecorator : public ImageProcessor
 {
-private:
+protected:
     std::unique_ptr<ImageProcessor> wrapped_processor;
+    std::string label; // stage name in timing spans; unlabeled stages are not timed
 
 public:
-    explicit GrayscaleProcessor(std::unique_ptr<ImageProcessor> processor);
+    explicit ProcessorDecorator(std::unique_ptr<ImageProcessor> processor);
+
+    void set_label(std::string name) { label = std::move(name); }
 
     Mat process(const Mat &image) override;
+    virtual Mat apply(const Mat &input) const = 0;
+
+    // Stages that keep state between frames override this to return true
+    bool temporal() const override;
+    virtual ~ProcessorDecorator() = default;
+};
+
+class GrayscaleProcessor : public ProcessorDecorator
+{
+public:
+    explicit GrayscaleProcessor(std::unique_ptr<ImageProcessor> processor);
+
+    Mat apply(const Mat &input) const override;
     virtual ~GrayscaleProcessor() = default;
 };
 
-class ResizeProcessor : public ImageProcessor
+class ResizeProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     int width, height;
 
 public:
     ResizeProcessor(std::unique_ptr<ImageProcessor> processor, int w, int h);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~ResizeProcessor() = default;
 };
 
-class BlurProcessor : public ImageProcessor
+// Adjacent geometric stages resampled once through their composite transform
+class GeometricProcessor : public ProcessorDecorator
+{
+private:
+    mj::GeometricSteps steps;
+
+public:
+    GeometricProcessor(std::unique_ptr<ImageProcessor> processor, mj::GeometricSteps steps);
+
+    Mat apply(const Mat &input) const override;
+    virtual ~GeometricProcessor() = default;
+};
+
+// A run of stages executed on a tracked colour representation, so consecutive
+// luma stages share one conversion and greyscale images are processed as one plane
+class ColorTrackedProcessor : public ProcessorDecorator
+{
+private:
+    std::vector<std::unique_ptr<mj::TrackedStage>> stages;
+
+public:
+    ColorTrackedProcessor(std::unique_ptr<ImageProcessor> processor, std::vector<std::unique_ptr<mj::TrackedStage>> stages);
+
+    Mat apply(const Mat &input) const override;
+    bool temporal() const override;
+    virtual ~ColorTrackedProcessor() = default;
+};
+
+class BlurProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     int kernel_size;
 
 public:
     BlurProcessor(std::unique_ptr<ImageProcessor> processor, int kernel);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~BlurProcessor() = default;
 };
 
-class EdgeDetectionProcessor : public ImageProcessor
+class EdgeDetectionProcessor : public ProcessorDecorator
 {
-private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
-
 public:
     EdgeDetectionProcessor(std::unique_ptr<ImageProcessor> processor);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~EdgeDetectionProcessor() = default;
 };
 
-class RotateProcessor : public ImageProcessor
+class RotateProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     double angle;
 
 public:
     RotateProcessor(std::unique_ptr<ImageProcessor> processor, double angle);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~RotateProcessor() = default;
 };
 
-class BrightnessContrastProcessor : public ImageProcessor
+class BrightnessContrastProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     int brightness;
     double contrast;
 
 public:
     BrightnessContrastProcessor(std::unique_ptr<ImageProcessor> processor, int b, double c);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~BrightnessContrastProcessor() = default;
 };
 
-class SharpenProcessor : public ImageProcessor
+class SharpenProcessor : public ProcessorDecorator
 {
-private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
-
 public:
     SharpenProcessor(std::unique_ptr<ImageProcessor> processor);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~SharpenProcessor() = default;
 };
 
-class EqualizeHistogramProcessor : public ImageProcessor
+class EqualizeHistogramProcessor : public ProcessorDecorator
 {
-private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
-
 public:
     EqualizeHistogramProcessor(std::unique_ptr<ImageProcessor> processor);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~EqualizeHistogramProcessor() = default;
 };
 
-class GammaCorrectionProcessor : public ImageProcessor
+class GammaCorrectionProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     double gamma;
+    Mat lut;
 
 public:
     GammaCorrectionProcessor(std::unique_ptr<ImageProcessor> processor, double g);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~GammaCorrectionProcessor() = default;
 };
 
-class WatermarkProcessor : public ImageProcessor
+// Draws `text` as putText did, from a cached mask (overlay.hpp)
+class WatermarkProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     std::string text;
+    std::shared_ptr<mj::OverlayMask const> mask;
 
 public:
     WatermarkProcessor(std::unique_ptr<ImageProcessor> processor, const std::string &text);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~WatermarkProcessor() = default;
 };
 
-class ColorInversionProcessor : public ImageProcessor
+class OverlayProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
+    mj::Overlay overlay;
 
+public:
+    OverlayProcessor(std::unique_ptr<ImageProcessor> processor, const nlohmann::json &params);
+
+    Mat apply(const Mat &input) const override;
+    virtual ~OverlayProcessor() = default;
+};
+
+class ColorInversionProcessor : public ProcessorDecorator
+{
 public:
     ColorInversionProcessor(std::unique_ptr<ImageProcessor> processor);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~ColorInversionProcessor() = default;
 };
 
-class SepiaProcessor : public ImageProcessor
+class SepiaProcessor : public ProcessorDecorator
 {
-private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
-
 public:
     SepiaProcessor(std::unique_ptr<ImageProcessor> processor);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~SepiaProcessor() = default;
 };
 
-class MedianBlurProcessor : public ImageProcessor
+class MedianBlurProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     int kernel_size;  // ← make sure this line exists!
 
 public:
     MedianBlurProcessor(std::unique_ptr<ImageProcessor> processor, int kernel_size);
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~MedianBlurProcessor() = default;
 };
 
 
-class HistogramStretchProcessor : public ImageProcessor
+class HistogramStretchProcessor : public ProcessorDecorator
 {
-private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
-
 public:
     HistogramStretchProcessor(std::unique_ptr<ImageProcessor> processor);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~HistogramStretchProcessor() = default;
 };
 
-class UnsharpMaskProcessor : public ImageProcessor
+class UnsharpMaskProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     double strength;
 
 public:
     UnsharpMaskProcessor(std::unique_ptr<ImageProcessor> processor, double s);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~UnsharpMaskProcessor() = default;
 };
 
-class DilationProcessor : public ImageProcessor
+class DilationProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     int kernel_size; // ← Add this line
 
 public:
     DilationProcessor(std::unique_ptr<ImageProcessor> processor, int k);
-    cv::Mat process(const cv::Mat &image) override;
+    cv::Mat apply(const cv::Mat &input) const override;
     virtual ~DilationProcessor() = default;
 };
 
-class ErosionProcessor : public ImageProcessor
+class ErosionProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     int kernel_size; // ← Add this line
 
 public:
     ErosionProcessor(std::unique_ptr<ImageProcessor> processor, int k);
-    cv::Mat process(const cv::Mat &image) override;
+    cv::Mat apply(const cv::Mat &input) const override;
     virtual ~ErosionProcessor() = default;
 };
 
-class CLAHEProcessor : public ImageProcessor
+// Opening, closing and morphological gradient with a square element
+class MorphologyProcessor : public ProcessorDecorator
+{
+private:
+    int operation; // MORPH_OPEN, MORPH_CLOSE or MORPH_GRADIENT
+    int kernel_size;
+
+public:
+    MorphologyProcessor(std::unique_ptr<ImageProcessor> processor, int op, int k);
+    cv::Mat apply(const cv::Mat &input) const override;
+    virtual ~MorphologyProcessor() = default;
+};
+
+class CLAHEProcessor : public ProcessorDecorator
 {
 private:
-    std::unique_ptr<ImageProcessor> wrapped_processor;
     double clip_limit;
 
 public:
     CLAHEProcessor(std::unique_ptr<ImageProcessor> processor, double clip_limit);
 
-    Mat process(const Mat &image) override;
+    Mat apply(const Mat &input) const override;
     virtual ~CLAHEProcessor() = default;
 };
+
+#endif // IMAGE_PROCESSOR_HPP
@@ -0,0 +1,228 @@
+#include "image-stats.hpp"
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+using json = nlohmann::json;
+using namespace mj;
+
+// Rows per parallel stripe
+static constexpr int STRIPE_ROWS = 64;
+
+AnalysisOptions mj::parse_analysis(json const &request)
+{
+    AnalysisOptions options;
+    auto it = request.find("analysis");
+    if (it == request.end() || it->is_null())
+        return options;
+    if (!it->is_object())
+        throw std::invalid_argument("'analysis' must be an object");
+
+    options.reduce = it->value("reduce", options.reduce);
+    options.bins = it->value("bins", options.bins);
+    options.edge_threshold = it->value("edge_threshold", options.edge_threshold);
+    if (options.reduce != 1 && options.reduce != 2 && options.reduce != 4 && options.reduce != 8)
+        throw std::invalid_argument("'reduce' must be 1, 2, 4 or 8");
+    if (options.bins < 0 || options.bins > 256 || (options.bins & (options.bins - 1)) != 0)
+        throw std::invalid_argument("'bins' must be 0 or a power of two up to 256");
+    if (options.edge_threshold < 0)
+        throw std::invalid_argument("'edge_threshold' must not be negative");
+    return options;
+}
+
+namespace {
+
+using Histogram = std::array<std::uint64_t, 256>;
+
+// What one stripe gathers; merged once at the end
+struct Partial
+{
+    std::vector<Histogram> channels;
+    Histogram luma{};
+    std::int64_t laplacian_sum = 0;
+    std::int64_t laplacian_squares = 0;
+    std::uint64_t edges = 0;
+};
+
+ChannelStats summarize(Histogram const &histogram)
+{
+    ChannelStats stats;
+    stats.histogram = histogram;
+    std::uint64_t count = 0;
+    double sum = 0, squares = 0;
+    for (int v = 0; v < 256; ++v)
+    {
+        count += histogram[v];
+        sum += static_cast<double>(histogram[v]) * v;
+        squares += static_cast<double>(histogram[v]) * v * v;
+    }
+    if (count == 0)
+        return stats;
+
+    stats.mean = sum / static_cast<double>(count);
+    stats.stddev = std::sqrt(std::max(0.0, squares / static_cast<double>(count) - stats.mean * stats.mean));
+    while (histogram[stats.min] == 0)
+        ++stats.min;
+    stats.max = 255;
+    while (histogram[stats.max] == 0)
+        --stats.max;
+    return stats;
+}
+
+// Counts one row into the histograms when `count` is set, and writes its
+// luma (cvtColor's fixed-point BGR2GRAY) to `luma` for colour images
+void scan_row(unsigned char const *row, int cols, int cn, unsigned char *luma, Partial &partial, bool count)
+{
+    if (cn == 1)
+    {
+        if (count)
+            for (int x = 0; x < cols; ++x)
+                ++partial.channels[0][row[x]];
+        return;
+    }
+
+    for (int x = 0; x < cols; ++x, row += cn)
+    {
+        int y = (row[0] * 3735 + row[1] * 19235 + row[2] * 9798 + (1 << 14)) >> 15;
+        luma[x] = static_cast<unsigned char>(y);
+        if (count)
+        {
+            for (int c = 0; c < cn; ++c)
+                ++partial.channels[c][row[c]];
+            ++partial.luma[y];
+        }
+    }
+}
+
+// Laplacian and Sobel at the interior pixels of row `b`, between rows `a` and `c`
+void kernel_row(unsigned char const *a, unsigned char const *b, unsigned char const *c, int cols, int threshold, Partial &partial)
+{
+    std::int64_t sum = 0, squares = 0;
+    std::uint64_t edges = 0;
+    for (int x = 1; x < cols - 1; ++x)
+    {
+        int laplacian = a[x] + c[x] + b[x - 1] + b[x + 1] - 4 * b[x];
+        sum += laplacian;
+        squares += laplacian * laplacian;
+
+        int gx = (a[x + 1] + 2 * b[x + 1] + c[x + 1]) - (a[x - 1] + 2 * b[x - 1] + c[x - 1]);
+        int gy = (c[x - 1] + 2 * c[x] + c[x + 1]) - (a[x - 1] + 2 * a[x] + a[x + 1]);
+        edges += std::abs(gx) + std::abs(gy) > threshold;
+    }
+    partial.laplacian_sum += sum;
+    partial.laplacian_squares += squares;
+    partial.edges += edges;
+}
+
+} // namespace
+
+ImageStats mj::analyze_image(cv::Mat const &image, int edge_threshold)
+{
+    cv::Mat src = image;
+    if (src.depth() != CV_8U)
+        src.convertTo(src, CV_8U);
+    const int cn = src.channels();
+    if (cn != 1 && cn != 3 && cn != 4)
+        throw std::invalid_argument("Analysis needs 1, 3 or 4 channels");
+
+    const int rows = src.rows;
+    const int cols = src.cols;
+    const int stripes = std::max(1, (rows + STRIPE_ROWS - 1) / STRIPE_ROWS);
+    std::vector<Partial> partials(stripes);
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        std::vector<unsigned char> window(cn == 1 ? 0 : std::size_t(3) * cols);
+        for (int s = range.start; s < range.end; ++s)
+        {
+            Partial &partial = partials[s];
+            partial.channels.resize(cn);
+            const int r0 = s * STRIPE_ROWS;
+            const int r1 = std::min(rows, r0 + STRIPE_ROWS);
+
+            // Rows r0 - 1 and r1 are read for the kernels only; luma row y
+            // sits in window slot y % 3, or is the image row itself in grey
+            auto luma_row = [&](int y) {
+                return cn == 1 ? src.ptr<unsigned char>(y) : window.data() + std::size_t(y % 3) * cols;
+            };
+            for (int y = std::max(r0 - 1, 0); y < std::min(r1 + 1, rows); ++y)
+            {
+                scan_row(src.ptr<unsigned char>(y), cols, cn, luma_row(y), partial, y >= r0 && y < r1);
+                // The kernel centred on the previous row now has all three rows
+                int centre = y - 1;
+                if (centre >= std::max(r0, 1) && centre < r1 && cols >= 3)
+                    kernel_row(luma_row(centre - 1), luma_row(centre), luma_row(y), cols, edge_threshold, partial);
+            }
+        }
+    });
+
+    // Merge the stripes
+    Partial total;
+    total.channels.resize(cn);
+    for (Partial const &partial : partials)
+    {
+        for (int c = 0; c < cn; ++c)
+            for (int v = 0; v < 256; ++v)
+                total.channels[c][v] += partial.channels[c][v];
+        for (int v = 0; v < 256; ++v)
+            total.luma[v] += partial.luma[v];
+        total.laplacian_sum += partial.laplacian_sum;
+        total.laplacian_squares += partial.laplacian_squares;
+        total.edges += partial.edges;
+    }
+
+    ImageStats stats;
+    stats.size = src.size();
+    for (int c = 0; c < cn; ++c)
+        stats.channels.push_back(summarize(total.channels[c]));
+    stats.luma = cn == 1 ? stats.channels[0] : summarize(total.luma);
+
+    double interior = static_cast<double>(std::max(rows - 2, 0)) * std::max(cols - 2, 0);
+    if (interior > 0)
+    {
+        double mean = static_cast<double>(total.laplacian_sum) / interior;
+        stats.sharpness = std::max(0.0, static_cast<double>(total.laplacian_squares) / interior - mean * mean);
+        stats.edge_density = static_cast<double>(total.edges) / interior;
+    }
+    return stats;
+}
+
+namespace {
+
+json channel_json(ChannelStats const &stats, int bins)
+{
+    json out = {{"mean", stats.mean}, {"stddev", stats.stddev}, {"min", stats.min}, {"max", stats.max}};
+    if (bins > 0)
+    {
+        // Consecutive values summed into `bins` equal bins
+        std::vector<std::uint64_t> histogram(bins, 0);
+        const int width = 256 / bins;
+        for (int v = 0; v < 256; ++v)
+            histogram[v / width] += stats.histogram[v];
+        out["histogram"] = std::move(histogram);
+    }
+    return out;
+}
+
+} // namespace
+
+json mj::stats_json(ImageStats const &stats, int bins)
+{
+    static const char *const COLOR_NAMES[] = {"blue", "green", "red", "alpha"};
+
+    json channels = json::object();
+    if (stats.channels.size() == 1)
+        channels["gray"] = channel_json(stats.channels[0], bins);
+    else
+        for (std::size_t c = 0; c < stats.channels.size(); ++c)
+            channels[COLOR_NAMES[c]] = channel_json(stats.channels[c], bins);
+
+    return {{"width", stats.size.width},
+            {"height", stats.size.height},
+            {"channels", std::move(channels)},
+            {"luma", channel_json(stats.luma, bins)},
+            {"sharpness", stats.sharpness},
+            {"edge_density", stats.edge_density}};
+}
@@ -0,0 +1,65 @@
+#ifndef MJ_IMAGE_STATS_HPP
+#define MJ_IMAGE_STATS_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace mj {
+
+// Statistics for POST /analyze, which answers "is this image too dark or
+// blurry" without encoding anything. The body is the same as for POST /
+// (the pipeline runs first, so a client can analyse a processed image) plus:
+//
+//   "analysis": {"reduce": 4, "bins": 32, "edge_threshold": 100}
+//
+// "reduce" (1, 2, 4 or 8) decodes at that fraction of the size, which JPEG
+// does in the DCT at a fraction of the cost. "bins" (a power of two up to
+// 256, 0 = none) sets the histogram resolution in the response.
+struct AnalysisOptions
+{
+    int reduce = 1;
+    int bins = 256;
+    int edge_threshold = 100;
+};
+
+// Defaults if the request has no "analysis". Throws std::invalid_argument
+// or nlohmann::json::exception when malformed.
+AnalysisOptions parse_analysis(nlohmann::json const &request);
+
+struct ChannelStats
+{
+    std::array<std::uint64_t, 256> histogram{};
+    double mean = 0;
+    double stddev = 0;
+    int min = 0;
+    int max = 0;
+};
+
+struct ImageStats
+{
+    cv::Size size;
+    std::vector<ChannelStats> channels; // in the image's channel order
+    ChannelStats luma;                  // BT.601 as cv::COLOR_BGR2GRAY
+    double sharpness = 0;               // variance of the 4-neighbour Laplacian of luma
+    double edge_density = 0;            // fraction of pixels with |Sobel x| + |Sobel y| over the threshold
+};
+
+// One pass over row stripes in parallel: each row is read once for the
+// channel and luma histograms, and its luma is kept in a three-row window
+// for the Laplacian and Sobel. Mean, deviation and range come from the
+// histograms. The Laplacian and Sobel cover interior pixels only. `image`
+// is 8-bit with one, three (BGR) or four (BGRA) channels; other depths are
+// saturated to 8 bits first.
+ImageStats analyze_image(cv::Mat const &image, int edge_threshold = 100);
+
+// {"width", "height", "channels": {"blue": {...}, ...}, "luma", "sharpness",
+// "edge_density"}, each channel with mean, stddev, min, max and a histogram
+// of `bins` bins (none for 0)
+nlohmann::json stats_json(ImageStats const &stats, int bins);
+
+} // namespace mj
+
+#endif // MJ_IMAGE_STATS_HPP
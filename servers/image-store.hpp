@@ -0,0 +1,83 @@
+#ifndef MJ_IMAGE_STORE_HPP
+#define MJ_IMAGE_STORE_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mj {
+
+// Lowercase hex SHA-256 of a byte range
+std::string sha256_hex(unsigned char const *data, std::size_t size);
+
+// Uploaded images kept server side so clients can send "img_ref": "<hash>"
+// instead of re-uploading the same image with every request.
+//
+// Entries are keyed by the SHA-256 of the encoded bytes, so uploading the
+// same file twice stores it once. Each entry holds the encoded bytes and,
+// with `keep_decoded`, the decoded Mat, which requests then share read-only
+// instead of decoding again. Memory is bounded by `budget_bytes` (encoded
+// plus decoded) with least recently used eviction, and entries expire `ttl`
+// after their last use.
+class ImageStore
+{
+public:
+    struct Image
+    {
+        std::string hash;
+        std::vector<unsigned char> encoded;
+        cv::Mat decoded; // empty unless the store keeps decoded pixels; never written to
+        cv::Size size;
+
+        std::size_t bytes() const { return encoded.size() + decoded.total() * decoded.elemSize(); }
+    };
+
+    ImageStore(std::size_t budget_bytes, std::chrono::seconds ttl, bool keep_decoded = true);
+
+    // Stores `encoded`, which decodes to `decoded`, and returns its hash.
+    // Throws std::length_error if the image alone exceeds the budget.
+    std::string put(std::vector<unsigned char> encoded, cv::Mat decoded);
+
+    // Refreshes the entry's LRU position and TTL; nullptr if unknown or expired
+    std::shared_ptr<Image const> get(std::string const &hash);
+
+    bool remove(std::string const &hash);
+
+    nlohmann::json metrics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::shared_ptr<Image const> image;
+        Clock::time_point last_used;
+        std::list<std::string>::iterator lru; // position in _lru, front = most recent
+    };
+
+    void erase(std::unordered_map<std::string, Entry>::iterator it);
+    void evict_locked(std::size_t incoming);
+
+    std::size_t _budget;
+    std::chrono::seconds _ttl;
+    bool _keep_decoded;
+    std::size_t _bytes = 0;
+    std::unordered_map<std::string, Entry> _entries;
+    std::list<std::string> _lru;
+    std::uint64_t _hits = 0;
+    std::uint64_t _misses = 0;
+    std::uint64_t _evicted = 0;
+    std::uint64_t _expired = 0;
+    mutable std::mutex _mutex;
+};
+
+} // namespace mj
+
+#endif // MJ_IMAGE_STORE_HPP
@@ -0,0 +1,60 @@
+#include "jpeg-support.hpp"
+
+#ifdef MJ_HAVE_JPEG_CROP
+
+#include <cstring>
+
+using namespace mj;
+
+namespace {
+
+void jpeg_fail(j_common_ptr cinfo)
+{
+    std::longjmp(reinterpret_cast<JpegError *>(cinfo->err)->jump, 1);
+}
+
+void jpeg_quiet(j_common_ptr) {}
+
+} // namespace
+
+jpeg_error_mgr *mj::quiet_jpeg_errors(JpegError &error)
+{
+    jpeg_std_error(&error.manager);
+    error.manager.error_exit = jpeg_fail;
+    error.manager.output_message = jpeg_quiet;
+    return &error.manager;
+}
+
+int mj::exif_orientation(jpeg_decompress_struct const &cinfo)
+{
+    for (jpeg_saved_marker_ptr marker = cinfo.marker_list; marker; marker = marker->next)
+    {
+        unsigned char const *d = marker->data;
+        unsigned int n = marker->data_length;
+        if (marker->marker != JPEG_APP0 + 1 || n < 14 || std::memcmp(d, "Exif\0\0", 6) != 0)
+            continue;
+        d += 6;
+        n -= 6;
+
+        bool little = d[0] == 'I';
+        auto u16 = [&](unsigned int at) -> unsigned int { return little ? d[at] | d[at + 1] << 8 : d[at] << 8 | d[at + 1]; };
+        auto u32 = [&](unsigned int at) { return little ? u16(at) | u16(at + 2) << 16 : u16(at) << 16 | u16(at + 2); };
+
+        // Offsets come from the file; compared as n - offset so they cannot wrap
+        unsigned int ifd = u32(4);
+        if (ifd > n || n - ifd < 2)
+            return 1;
+        unsigned int entries = u16(ifd);
+        for (unsigned int i = 0; i < entries; ++i)
+        {
+            unsigned int entry = ifd + 2 + 12 * i; // ifd < 64 KiB, so no wrap
+            if (entry > n || n - entry < 12)
+                return 1;
+            if (u16(entry) == 0x0112)
+                return u16(entry + 8);
+        }
+    }
+    return 1;
+}
+
+#endif
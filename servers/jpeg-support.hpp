@@ -0,0 +1,32 @@
+#ifndef MJ_JPEG_SUPPORT_HPP
+#define MJ_JPEG_SUPPORT_HPP
+
+// libjpeg plumbing shared by the partial (region-decode.cpp) and planar
+// (jpeg-yuv.cpp) JPEG codecs. Only available with MJ_HAVE_JPEG_CROP.
+#ifdef MJ_HAVE_JPEG_CROP
+
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+
+namespace mj {
+
+// Errors longjmp back to the caller's setjmp(jump) instead of exiting
+struct JpegError
+{
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+};
+
+// Sets up `error` for cinfo.err: silent, and longjmp-ing on errors
+jpeg_error_mgr *quiet_jpeg_errors(JpegError &error);
+
+// EXIF orientation tag (1 = as stored), 1 when absent or unreadable. Needs
+// jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff) before the header is read.
+int exif_orientation(jpeg_decompress_struct const &cinfo);
+
+} // namespace mj
+
+#endif
+
+#endif // MJ_JPEG_SUPPORT_HPP
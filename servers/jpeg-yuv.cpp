@@ -0,0 +1,208 @@
+#include "jpeg-yuv.hpp"
+#include "jpeg-support.hpp"
+#include <opencv2/core.hpp>
+#include <cstdlib>
+
+using namespace mj;
+
+#ifdef MJ_HAVE_JPEG_CROP
+
+namespace {
+
+// Layouts handled: greyscale, or YCbCr with full resolution or 2x luma
+bool supported(jpeg_decompress_struct const &cinfo)
+{
+    if (cinfo.data_precision != 8)
+        return false;
+    if (cinfo.jpeg_color_space == JCS_GRAYSCALE && cinfo.num_components == 1)
+        return true;
+    if (cinfo.jpeg_color_space != JCS_YCbCr || cinfo.num_components != 3)
+        return false;
+
+    jpeg_component_info const *comp = cinfo.comp_info;
+    for (int c = 1; c < 3; ++c)
+        if (comp[c].h_samp_factor != 1 || comp[c].v_samp_factor != 1)
+            return false;
+    return comp[0].h_samp_factor <= 2 && comp[0].v_samp_factor <= 2;
+}
+
+// Points rows[c] at the rows of planes[c] that row group `group` covers
+void point_rows(std::vector<cv::Mat> &planes, jpeg_component_info const *comp, int group,
+                std::vector<std::vector<JSAMPROW>> &rows, std::vector<JSAMPARRAY> &arrays)
+{
+    for (std::size_t c = 0; c < planes.size(); ++c)
+    {
+        int lines = comp[c].v_samp_factor * DCTSIZE;
+        rows[c].resize(lines);
+        for (int r = 0; r < lines; ++r)
+            rows[c][r] = planes[c].ptr<unsigned char>(group * lines + r);
+        arrays[c] = rows[c].data();
+    }
+}
+
+} // namespace
+
+bool mj::decode_jpeg_yuv(std::vector<unsigned char> const &data, YuvImage &out)
+{
+    if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8 || data[2] != 0xFF)
+        return false;
+
+    // Declared before setjmp so a decode error does not skip their destructors
+    std::vector<cv::Mat> planes;
+    std::vector<std::vector<JSAMPROW>> rows;
+    std::vector<JSAMPARRAY> arrays;
+    jpeg_decompress_struct cinfo;
+    JpegError error;
+    cinfo.err = quiet_jpeg_errors(error);
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data.data()), static_cast<unsigned long>(data.size()));
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // imdecode rotates by EXIF orientation
+    if (!supported(cinfo) || exif_orientation(cinfo) > 1)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cinfo.out_color_space = cinfo.jpeg_color_space;
+    cinfo.raw_data_out = TRUE;
+    jpeg_start_decompress(&cinfo);
+
+    // Raw data comes in groups of max_v_samp_factor * DCTSIZE luma rows and
+    // whole blocks across, so the planes are padded to that
+    int group = cinfo.max_v_samp_factor * DCTSIZE;
+    int groups = static_cast<int>((cinfo.output_height + group - 1) / group);
+    int count = cinfo.num_components;
+    planes.resize(count);
+    rows.resize(count);
+    arrays.resize(count);
+    for (int c = 0; c < count; ++c)
+    {
+        jpeg_component_info const &comp = cinfo.comp_info[c];
+        planes[c].create(groups * comp.v_samp_factor * DCTSIZE, static_cast<int>(comp.width_in_blocks) * DCTSIZE, CV_8U);
+    }
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        point_rows(planes, cinfo.comp_info, static_cast<int>(cinfo.output_scanline) / group, rows, arrays);
+        if (jpeg_read_raw_data(&cinfo, arrays.data(), static_cast<JDIMENSION>(group)) == 0)
+            break;
+    }
+    bool complete = cinfo.output_scanline >= cinfo.output_height;
+
+    std::vector<cv::Mat> visible;
+    for (int c = 0; c < count; ++c)
+    {
+        jpeg_component_info const &comp = cinfo.comp_info[c];
+        visible.push_back(planes[c](cv::Rect(0, 0, static_cast<int>(comp.downsampled_width), static_cast<int>(comp.downsampled_height))));
+    }
+    out.subsampling = cv::Size(cinfo.comp_info[0].h_samp_factor, cinfo.comp_info[0].v_samp_factor);
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    if (!complete)
+        return false;
+
+    out.y = visible[0];
+    out.chroma.assign(visible.begin() + 1, visible.end());
+    if (out.chroma.empty())
+        out.subsampling = cv::Size(1, 1);
+    return true;
+}
+
+bool mj::encode_jpeg_yuv(YuvImage const &image, std::vector<unsigned char> &out, int quality)
+{
+    if (image.y.empty() || image.y.type() != CV_8U || (image.chroma.size() != 0 && image.chroma.size() != 2))
+        return false;
+    bool gray = image.chroma.empty();
+
+    // Declared before setjmp so an encode error does not skip their destructors
+    std::vector<cv::Mat> planes;
+    std::vector<std::vector<JSAMPROW>> rows;
+    std::vector<JSAMPARRAY> arrays;
+    unsigned char *buffer = nullptr;
+    unsigned long size = 0;
+    jpeg_compress_struct cinfo;
+    JpegError error;
+    cinfo.err = quiet_jpeg_errors(error);
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        std::free(buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+    cinfo.image_width = static_cast<JDIMENSION>(image.y.cols);
+    cinfo.image_height = static_cast<JDIMENSION>(image.y.rows);
+    cinfo.input_components = gray ? 1 : 3;
+    cinfo.in_color_space = gray ? JCS_GRAYSCALE : JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+    if (!gray)
+    {
+        cinfo.comp_info[0].h_samp_factor = image.subsampling.width;
+        cinfo.comp_info[0].v_samp_factor = image.subsampling.height;
+        for (int c = 1; c < 3; ++c)
+            cinfo.comp_info[c].h_samp_factor = cinfo.comp_info[c].v_samp_factor = 1;
+    }
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // Each plane is read in whole blocks and row groups; the padding repeats
+    // the edge, as libjpeg does for the planes it downsamples itself
+    int group = cinfo.max_v_samp_factor * DCTSIZE;
+    int groups = static_cast<int>((cinfo.image_height + group - 1) / group);
+    planes.push_back(image.y);
+    planes.insert(planes.end(), image.chroma.begin(), image.chroma.end());
+    rows.resize(planes.size());
+    arrays.resize(planes.size());
+    for (std::size_t c = 0; c < planes.size(); ++c)
+    {
+        jpeg_component_info const &comp = cinfo.comp_info[c];
+        int width = static_cast<int>(comp.width_in_blocks) * DCTSIZE;
+        int height = groups * comp.v_samp_factor * DCTSIZE;
+        // Planes come from decode_jpeg_yuv with the same sampling
+        if (planes[c].type() != CV_8U || planes[c].cols != static_cast<int>(comp.downsampled_width) ||
+            planes[c].rows != static_cast<int>(comp.downsampled_height))
+        {
+            jpeg_destroy_compress(&cinfo);
+            std::free(buffer);
+            return false;
+        }
+        if (planes[c].cols != width || planes[c].rows != height)
+            cv::copyMakeBorder(planes[c], planes[c], 0, height - planes[c].rows, 0, width - planes[c].cols, cv::BORDER_REPLICATE);
+    }
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        point_rows(planes, cinfo.comp_info, static_cast<int>(cinfo.next_scanline) / group, rows, arrays);
+        jpeg_write_raw_data(&cinfo, arrays.data(), static_cast<JDIMENSION>(group));
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(buffer, buffer + size);
+    std::free(buffer);
+    return true;
+}
+
+#else
+
+bool mj::decode_jpeg_yuv(std::vector<unsigned char> const &, YuvImage &)
+{
+    return false;
+}
+
+bool mj::encode_jpeg_yuv(YuvImage const &, std::vector<unsigned char> &, int)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef MJ_JPEG_YUV_HPP
+#define MJ_JPEG_YUV_HPP
+
+#include <vector>
+#include "color-space.hpp"
+
+namespace mj {
+
+// JPEG to and from YuvImage without colour conversion or chroma resampling.
+//
+// cv::imdecode turns a JPEG's YCbCr into BGR and cv::imencode turns it back,
+// so a pipeline that only touches luma pays for two full-image conversions
+// (plus the stages' own BGR <-> YCrCb / Lab round trips). Here libjpeg hands
+// over the planes as stored (raw data), and they are written back with the
+// same subsampling, so untouched chroma is passed through as decoded.
+//
+// Needs libjpeg-turbo (MJ_HAVE_JPEG_CROP); without it both return false.
+
+// False for anything other than an 8-bit YCbCr or greyscale JPEG with 4:4:4,
+// 4:2:2, 4:4:0 or 4:2:0 sampling and no EXIF rotation; the caller then
+// decodes with cv::imdecode.
+bool decode_jpeg_yuv(std::vector<unsigned char> const &data, YuvImage &out);
+
+// Baseline JPEG at cv::imencode's default quality (95). Greyscale images are
+// written with a single component.
+bool encode_jpeg_yuv(YuvImage const &image, std::vector<unsigned char> &out, int quality = 95);
+
+} // namespace mj
+
+#endif // MJ_JPEG_YUV_HPP
@@ -0,0 +1,447 @@
+#include "local-server.hpp"
+#include "image-probe.hpp"
+#include "threading.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using namespace mj;
+
+static constexpr std::size_t MAX_HEADER = 64 * 1024;
+static constexpr long long MAX_LOCAL_IMAGE = 1LL << 30; // 1 GiB
+static constexpr long long MAX_DIMENSION = 1 << 16;
+
+namespace {
+
+std::runtime_error errno_error(std::string const &what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+json error_reply(std::string const &message)
+{
+    return {{"status", "error"}, {"message", message}};
+}
+
+json too_many_pixels(std::size_t max_pixels)
+{
+    return error_reply("Image has more than " + std::to_string(max_pixels) + " pixels");
+}
+
+// The plan's peak for `input` plus the result buffer
+std::size_t working_memory(PipelinePlan const &plan, cv::Size input)
+{
+    cv::Size output = plan.output_size(input);
+    double bytes = static_cast<double>(plan.peak_bytes(input)) + 3.0 * output.width * output.height;
+    return static_cast<std::size_t>(std::min(bytes, 1e18));
+}
+
+// Read-only bytes of a client descriptor
+class SharedInput
+{
+public:
+    SharedInput(int fd, long long offset, long long length)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            throw errno_error("fstat");
+        if (offset > st.st_size || length > st.st_size - offset)
+            throw std::invalid_argument("Image extends past the end of the shared buffer");
+
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (seals != -1 && (seals & F_SEAL_SHRINK))
+        {
+            long long page = sysconf(_SC_PAGESIZE);
+            long long start = offset - offset % page;
+            _map_length = static_cast<std::size_t>(length + (offset - start));
+            void *p = mmap(nullptr, _map_length, PROT_READ, MAP_SHARED, fd, start);
+            if (p == MAP_FAILED)
+                throw errno_error("mmap");
+            _map = p;
+            _data = static_cast<unsigned char const *>(p) + (offset - start);
+            return;
+        }
+
+        _copy.resize(static_cast<std::size_t>(length));
+        std::size_t done = 0;
+        while (done < _copy.size())
+        {
+            ssize_t n = pread(fd, _copy.data() + done, _copy.size() - done, offset + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw errno_error("pread");
+            if (n == 0)
+                throw std::invalid_argument("Shared buffer shrank while being read");
+            done += static_cast<std::size_t>(n);
+        }
+        _data = _copy.data();
+    }
+
+    ~SharedInput()
+    {
+        if (_map)
+            munmap(_map, _map_length);
+    }
+
+    SharedInput(SharedInput const &) = delete;
+    SharedInput &operator=(SharedInput const &) = delete;
+
+    unsigned char *data() const { return const_cast<unsigned char *>(_data); }
+
+private:
+    void *_map = nullptr;
+    std::size_t _map_length = 0;
+    std::vector<unsigned char> _copy;
+    unsigned char const *_data = nullptr;
+};
+
+// Sealed memfd holding `size` bytes written by `fill`
+template <typename Fill>
+int result_memfd(std::size_t size, Fill fill)
+{
+    int fd = memfd_create("vision_tools-result", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        throw errno_error("memfd_create");
+
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        auto error = errno_error("Cannot allocate result buffer");
+        close(fd);
+        throw error;
+    }
+
+    fill(static_cast<unsigned char *>(p));
+    munmap(p, size);
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+// Receives one packet and at most one descriptor (extra ones are closed).
+// Returns the packet length, 0 when the peer closed, -1 on error.
+ssize_t receive_packet(int connection, std::vector<char> &buffer, int &fd, bool &truncated)
+{
+    fd = -1;
+    iovec iov{buffer.data(), buffer.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 4)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do
+        n = recvmsg(connection, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return n;
+
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        std::size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int received;
+            std::memcpy(&received, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (fd < 0)
+                fd = received;
+            else
+                close(received);
+        }
+    }
+    truncated = (msg.msg_flags & MSG_TRUNC) != 0;
+    return n;
+}
+
+bool send_packet(int connection, json const &reply, int fd)
+{
+    std::string text = reply.dump();
+    iovec iov{text.data(), text.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+
+    ssize_t n;
+    do
+        n = sendmsg(connection, &msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    return n >= 0;
+}
+
+} // namespace
+
+LocalServer::LocalServer(std::string path, FairScheduler &scheduler, PlanCache &plans, MemoryGovernor &memory, std::size_t max_pixels)
+    : _path(std::move(path)), _scheduler(scheduler), _plans(plans), _memory(memory), _max_pixels(max_pixels)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (_path.empty() || _path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Invalid Unix socket path: " + _path);
+    std::memcpy(addr.sun_path, _path.c_str(), _path.size() + 1);
+
+    // A socket left behind by an earlier run is replaced; anything else is an error
+    struct stat st;
+    if (lstat(_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(_path.c_str());
+
+    _listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (_listener < 0)
+        throw errno_error("socket");
+    if (bind(_listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        chmod(_path.c_str(), 0660) != 0 || listen(_listener, SOMAXCONN) != 0)
+    {
+        auto error = errno_error("Cannot listen on " + _path);
+        close(_listener);
+        throw error;
+    }
+}
+
+LocalServer::~LocalServer()
+{
+    if (_listener >= 0)
+    {
+        close(_listener);
+        unlink(_path.c_str());
+    }
+}
+
+void LocalServer::run()
+{
+    std::cerr << "Local socket listening on " << _path << std::endl;
+
+    for (;;)
+    {
+        int connection = accept4(_listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EBADF || errno == EINVAL)
+                return;
+            std::cerr << "Local accept failed: " << std::strerror(errno) << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        // Spawn thread to serve this connection
+        std::thread(&LocalServer::do_session, this, connection).detach();
+    }
+}
+
+void LocalServer::do_session(int connection)
+{
+    std::vector<char> buffer(MAX_HEADER);
+
+    for (;;)
+    {
+        int image_fd = -1;
+        bool truncated = false;
+        ssize_t n = receive_packet(connection, buffer, image_fd, truncated);
+        if (n <= 0)
+            break;
+
+        json reply;
+        int result_fd = -1;
+        if (truncated)
+        {
+            reply = error_reply("Request header exceeds 64 KiB");
+        }
+        else
+        {
+            try
+            {
+                json request = json::parse(buffer.begin(), buffer.begin() + n);
+                reply = handle_request(request, image_fd, result_fd);
+            }
+            catch (const json::exception &e)
+            {
+                reply = error_reply(std::string("Invalid request: ") + e.what());
+            }
+            catch (const std::exception &e)
+            {
+                reply = error_reply(e.what());
+            }
+        }
+        if (image_fd >= 0)
+            close(image_fd);
+
+        bool sent = send_packet(connection, reply, result_fd);
+        if (result_fd >= 0)
+            close(result_fd);
+        if (!sent)
+            break;
+    }
+    close(connection);
+}
+
+json LocalServer::handle_request(json const &request, int image_fd, int &result_fd)
+{
+    if (image_fd < 0)
+        return error_reply("Missing image descriptor");
+
+    std::string format = request.value("format", std::string("encoded"));
+    std::string output = request.value("output", std::string("raw"));
+    long long offset = request.value("offset", 0LL);
+    if (output != "raw" && output != "jpeg" && output != "png")
+        return error_reply("Unknown output format: " + output);
+    if (offset < 0)
+        return error_reply("Invalid offset");
+
+    // Look up the plan first so a bad pipeline costs no image I/O; compiling
+    // is bounded by the registry's parameter limits, so needs no reservation
+    std::shared_ptr<PipelinePlan const> plan = _plans.get(request.value("pipeline", json::object()));
+
+    std::string tenant = _scheduler.resolve_tenant(request.value("tenant", std::string()), request.value("api_key", std::string()));
+    std::size_t policy_pixels = _scheduler.config().policy_for(tenant).max_pixels;
+    std::size_t max_pixels = policy_pixels > 0 ? policy_pixels : _max_pixels;
+
+    MemoryGovernor::Reservation memory;
+    std::unique_ptr<SharedInput> input;
+    cv::Mat image;
+    if (format == "raw")
+    {
+        long long width = request.at("width").get<long long>();
+        long long height = request.at("height").get<long long>();
+        int channels = request.value("channels", 3);
+        if (width <= 0 || height <= 0 || width > MAX_DIMENSION || height > MAX_DIMENSION)
+            return error_reply("Invalid image dimensions");
+        if (channels != 1 && channels != 3 && channels != 4)
+            return error_reply("channels must be 1, 3 or 4");
+
+        long long row = width * channels;
+        long long stride = request.value("stride", row);
+        if (stride < row)
+            return error_reply("stride is smaller than a row");
+        long long length = stride * (height - 1) + row;
+        if (length > MAX_LOCAL_IMAGE)
+            return error_reply("Image too large");
+        if (static_cast<double>(width) * static_cast<double>(height) > static_cast<double>(max_pixels))
+            return too_many_pixels(max_pixels);
+        if (auto refused = reserve_memory(working_memory(*plan, cv::Size(static_cast<int>(width), static_cast<int>(height))), memory))
+            return *refused;
+
+        input = std::make_unique<SharedInput>(image_fd, offset, length);
+        image = cv::Mat(static_cast<int>(height), static_cast<int>(width), CV_8UC(channels), input->data(), static_cast<std::size_t>(stride));
+
+        // Stages expect BGR, as imdecode gives the HTTP path
+        if (channels == 1)
+            cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+        else if (channels == 4)
+            cv::cvtColor(image, image, cv::COLOR_BGRA2BGR);
+    }
+    else if (format == "encoded")
+    {
+        long long size = request.at("size").get<long long>();
+        if (size <= 0 || size > MAX_LOCAL_IMAGE)
+            return error_reply("Invalid encoded size");
+
+        input = std::make_unique<SharedInput>(image_fd, offset, size);
+
+        // Size the image from its header before imdecode allocates; without
+        // one it is assumed to be a square of max_pixels, as over HTTP
+        std::optional<cv::Size> probed = probe_image_size(input->data(), static_cast<std::size_t>(size));
+        if (probed && static_cast<double>(probed->width) * probed->height > static_cast<double>(max_pixels))
+            return too_many_pixels(max_pixels);
+        int side = static_cast<int>(std::min(std::sqrt(static_cast<double>(max_pixels)), 1073741824.0));
+        std::size_t bytes = working_memory(*plan, probed ? *probed : cv::Size(side, side));
+        if (!probed)
+            bytes = std::min(bytes, _memory.budget());
+        if (auto refused = reserve_memory(bytes, memory))
+            return *refused;
+
+        cv::Mat encoded(1, static_cast<int>(size), CV_8UC1, input->data());
+        image = cv::imdecode(encoded, cv::IMREAD_COLOR);
+        if (image.empty())
+            return error_reply("Failed to decode image");
+        if (!probed && image.total() > max_pixels)
+            return too_many_pixels(max_pixels);
+    }
+    else
+    {
+        return error_reply("Unknown input format: " + format);
+    }
+
+    double cost = static_cast<double>(image.total()) * std::max<double>(1.0, static_cast<double>(plan->size()));
+    FairScheduler::Admission admission = _scheduler.acquire(tenant, cost);
+    if (!admission.granted())
+        return error_reply("Server busy, queue time limit exceeded");
+
+    cv::Mat processed;
+    {
+        IntraOpScope threads(image.total());
+        processed = plan->run(image);
+    }
+    // The pipeline copied what it needed; let go of the client's buffer
+    image.release();
+    input.reset();
+
+    json reply = {{"status", "ok"}, {"format", output}, {"width", processed.cols}, {"height", processed.rows}};
+    if (output == "raw")
+    {
+        std::size_t row = processed.cols * processed.elemSize();
+        std::size_t size = row * processed.rows;
+        result_fd = result_memfd(size, [&](unsigned char *dst) {
+            for (int y = 0; y < processed.rows; ++y)
+                std::memcpy(dst + y * row, processed.ptr(y), row);
+        });
+        reply["channels"] = processed.channels();
+        reply["stride"] = row;
+        reply["size"] = size;
+    }
+    else
+    {
+        std::vector<unsigned char> encoded;
+        if (!cv::imencode(output == "png" ? ".png" : ".jpg", processed, encoded))
+            return error_reply("Failed to encode processed image");
+        result_fd = result_memfd(encoded.size(), [&](unsigned char *dst) {
+            std::memcpy(dst, encoded.data(), encoded.size());
+        });
+        reply["size"] = encoded.size();
+    }
+    admission.release();
+    return reply;
+}
+
+std::optional<json> LocalServer::reserve_memory(std::size_t bytes, MemoryGovernor::Reservation &memory)
+{
+    MemoryGovernor::Outcome outcome;
+    memory = _memory.reserve(bytes, outcome);
+    if (outcome == MemoryGovernor::Outcome::TooLarge)
+        return error_reply("Image needs more working memory than the server allows");
+    if (outcome == MemoryGovernor::Outcome::TimedOut)
+        return error_reply("Server busy, memory budget exhausted");
+    return std::nullopt;
+}
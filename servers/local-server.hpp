@@ -0,0 +1,73 @@
+#ifndef MJ_LOCAL_SERVER_HPP
+#define MJ_LOCAL_SERVER_HPP
+
+#include <nlohmann/json.hpp>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include "fair-scheduler.hpp"
+#include "memory-governor.hpp"
+#include "pipeline.hpp"
+
+namespace mj {
+
+// Local-only transport for co-located clients (Linux).
+//
+// Listens on a SOCK_SEQPACKET Unix domain socket. Each request is one packet
+// holding a JSON header, with the image passed as a file descriptor
+// (SCM_RIGHTS): a memfd, a POSIX shared-memory object or a plain file.
+//
+//   {"format": "raw", "width": 1920, "height": 1080, "channels": 3,
+//    "stride": 5760, "offset": 0,
+//    "pipeline": {"Resize": {"width": 640, "height": 360}},
+//    "output": "raw", "tenant": "preproc"}
+//
+// "raw" is 8-bit pixels in BGR order (1, 3 or 4 channels) with an optional row
+// stride. "encoded" is any format cv::imdecode reads, given as "size" bytes.
+// "pipeline" takes the same keys as the HTTP request body, or is an ordered
+// stage array as in its "pipeline" field. "output" is "raw"
+// (default), "jpeg" or "png". "tenant" and "api_key" play the role of the
+// X-Tenant-ID and X-API-Key headers.
+//
+// The reply is one packet: {"status": "ok", "format": ..., "width", "height",
+// "channels", "stride", "size"} with a sealed memfd holding the result, or
+// {"status": "error", "message": ...} with no descriptor.
+//
+// Memfds sealed against shrinking (F_SEAL_SHRINK) are mapped and read in
+// place. Other descriptors could be truncated while mapped, which would fault
+// the server, so they are read into private memory instead.
+//
+// Images are held to the same limits as HTTP requests: over `max_pixels` (or
+// the tenant's max_pixels) they are refused from the header or the encoded
+// header probe, and each request reserves its working memory from the shared
+// MemoryGovernor before decoding.
+class LocalServer
+{
+public:
+    // Binds the socket (replacing a stale one at `path`); throws std::runtime_error
+    LocalServer(std::string path, FairScheduler &scheduler, PlanCache &plans, MemoryGovernor &memory, std::size_t max_pixels);
+    ~LocalServer();
+
+    LocalServer(LocalServer const &) = delete;
+    LocalServer &operator=(LocalServer const &) = delete;
+
+    // Accept loop (blocking)
+    void run();
+
+private:
+    std::string _path;
+    FairScheduler &_scheduler;
+    PlanCache &_plans;
+    MemoryGovernor &_memory;
+    std::size_t _max_pixels;
+    int _listener = -1;
+
+    void do_session(int connection);
+    nlohmann::json handle_request(nlohmann::json const &request, int image_fd, int &result_fd);
+    // The error reply when the reservation is refused
+    std::optional<nlohmann::json> reserve_memory(std::size_t bytes, MemoryGovernor::Reservation &memory);
+};
+
+} // namespace mj
+
+#endif // MJ_LOCAL_SERVER_HPP
@@ -0,0 +1,271 @@
+#include "logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+enum Destination : std::uint32_t
+{
+    ErrorLog = 0,
+    AccessLog = 1,
+};
+
+// Single-producer, single-consumer byte ring. A record is a 4-byte header
+// (length << 1 | destination) followed by the line, wrapping at the end.
+class Ring
+{
+public:
+    explicit Ring(std::size_t capacity) : _data(capacity) {}
+
+    // Owning thread only; false if the line does not fit right now
+    bool push(Destination destination, std::string_view line)
+    {
+        std::uint32_t header = static_cast<std::uint32_t>(line.size()) << 1 | destination;
+        std::size_t need = sizeof(header) + line.size();
+        std::uint64_t tail = _tail.load(std::memory_order_relaxed);
+        std::uint64_t head = _head.load(std::memory_order_acquire);
+        if (need > _data.size() - (tail - head))
+            return false;
+        copy_in(tail, &header, sizeof(header));
+        copy_in(tail + sizeof(header), line.data(), line.size());
+        _tail.store(tail + need, std::memory_order_release);
+        return true;
+    }
+
+    // Flusher only; appends each record to out[destination] and counts it in lines[destination]
+    void drain(std::string out[2], std::uint64_t lines[2])
+    {
+        std::uint64_t head = _head.load(std::memory_order_relaxed);
+        std::uint64_t tail = _tail.load(std::memory_order_acquire);
+        while (head < tail)
+        {
+            std::uint32_t header;
+            copy_out(head, &header, sizeof(header));
+            std::size_t length = header >> 1;
+            std::string &text = out[header & 1];
+            std::size_t offset = text.size();
+            text.resize(offset + length);
+            copy_out(head + sizeof(header), &text[offset], length);
+            ++lines[header & 1];
+            head += sizeof(header) + length;
+        }
+        _head.store(head, std::memory_order_release);
+    }
+
+    std::atomic<bool> retired{false}; // the owning thread has exited
+
+private:
+    void copy_in(std::uint64_t position, void const *src, std::size_t size)
+    {
+        std::size_t at = position % _data.size();
+        std::size_t first = std::min(size, _data.size() - at);
+        std::memcpy(&_data[at], src, first);
+        std::memcpy(&_data[0], static_cast<char const *>(src) + first, size - first);
+    }
+
+    void copy_out(std::uint64_t position, void *dst, std::size_t size) const
+    {
+        std::size_t at = position % _data.size();
+        std::size_t first = std::min(size, _data.size() - at);
+        std::memcpy(dst, &_data[at], first);
+        std::memcpy(static_cast<char *>(dst) + first, &_data[0], size - first);
+    }
+
+    std::vector<char> _data;
+    alignas(64) std::atomic<std::uint64_t> _head{0}; // advanced by the flusher
+    alignas(64) std::atomic<std::uint64_t> _tail{0}; // advanced by the owner
+};
+
+std::atomic<bool> started{false};
+std::atomic<bool> access_enabled{false};
+std::size_t ring_bytes = 16 * 1024;
+int access_fd = -1;
+
+std::mutex rings_mutex;
+std::vector<std::shared_ptr<Ring>> rings;
+
+std::atomic<std::uint64_t> written[2];
+std::atomic<std::uint64_t> dropped[2];
+
+// Marks the thread's ring for removal once the flusher has emptied it
+struct ThreadRing
+{
+    std::shared_ptr<Ring> ring;
+
+    ~ThreadRing()
+    {
+        if (ring)
+            ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+thread_local ThreadRing thread_ring;
+
+Ring &local_ring()
+{
+    if (!thread_ring.ring)
+    {
+        thread_ring.ring = std::make_shared<Ring>(ring_bytes);
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(thread_ring.ring);
+    }
+    return *thread_ring.ring;
+}
+
+void write_all(int fd, std::string const &text)
+{
+    std::size_t done = 0;
+    while (done < text.size())
+    {
+        ssize_t n = ::write(fd, text.data() + done, text.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        done += static_cast<std::size_t>(n);
+    }
+}
+
+void flush_loop()
+{
+    std::vector<std::shared_ptr<Ring>> snapshot;
+    std::string out[2];
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            snapshot = rings;
+        }
+
+        std::uint64_t lines[2] = {0, 0};
+        for (auto const &ring : snapshot)
+        {
+            // Read the flag first: a retired ring gets no more records
+            bool retired = ring->retired.load(std::memory_order_acquire);
+            ring->drain(out, lines);
+            if (retired)
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                rings.erase(std::find(rings.begin(), rings.end(), ring));
+            }
+        }
+        snapshot.clear();
+
+        bool idle = out[ErrorLog].empty() && out[AccessLog].empty();
+        if (!out[ErrorLog].empty())
+            write_all(STDERR_FILENO, out[ErrorLog]);
+        if (!out[AccessLog].empty())
+            write_all(access_fd, out[AccessLog]);
+        for (int d = 0; d < 2; ++d)
+        {
+            written[d].fetch_add(lines[d], std::memory_order_relaxed);
+            out[d].clear();
+        }
+
+        if (idle)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void enqueue(Destination destination, std::string const &line)
+{
+    if (!started.load(std::memory_order_acquire))
+    {
+        if (destination == ErrorLog)
+            std::cerr << line;
+        return;
+    }
+    if (!local_ring().push(destination, line))
+        dropped[destination].fetch_add(1, std::memory_order_relaxed);
+}
+
+// UTC, millisecond precision: 2024-05-01T12:00:00.123Z
+std::string timestamp()
+{
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+    std::tm utc;
+    gmtime_r(&seconds, &utc);
+    char text[32];
+    std::size_t n = std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(text + n, sizeof(text) - n, ".%03dZ", millis);
+    return text;
+}
+
+} // namespace
+
+void mj::start_logging(LogOptions const &options)
+{
+    if (started.load())
+        throw std::logic_error("Logging is already started");
+
+    if (options.access_log == "-")
+        access_fd = STDOUT_FILENO;
+    else if (!options.access_log.empty())
+    {
+        access_fd = ::open(options.access_log.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (access_fd < 0)
+            throw std::runtime_error("Cannot open access log " + options.access_log + ": " + std::strerror(errno));
+    }
+    ring_bytes = std::max<std::size_t>(options.ring_bytes, 1024);
+    access_enabled = access_fd >= 0;
+
+    std::thread(flush_loop).detach();
+    started.store(true, std::memory_order_release);
+}
+
+void mj::log_error(std::string_view message)
+{
+    std::string line = timestamp();
+    line += " error: ";
+    line += message;
+    line += '\n';
+    enqueue(ErrorLog, line);
+}
+
+void mj::log_access(json record)
+{
+    if (!access_enabled.load(std::memory_order_relaxed))
+        return;
+    record["ts"] = timestamp();
+    // Paths come from clients and need not be valid UTF-8
+    std::string line = record.dump(-1, ' ', false, json::error_handler_t::replace);
+    line += '\n';
+    enqueue(AccessLog, line);
+}
+
+bool mj::access_log_enabled()
+{
+    return access_enabled.load(std::memory_order_relaxed);
+}
+
+json mj::logging_metrics()
+{
+    std::size_t threads;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        threads = rings.size();
+    }
+    return {{"errors", {{"written", written[ErrorLog].load()}, {"dropped", dropped[ErrorLog].load()}}},
+            {"access", {{"written", written[AccessLog].load()}, {"dropped", dropped[AccessLog].load()}}},
+            {"threads", threads}};
+}
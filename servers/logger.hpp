@@ -0,0 +1,42 @@
+#ifndef MJ_LOGGER_HPP
+#define MJ_LOGGER_HPP
+
+#include <nlohmann/json.hpp>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace mj {
+
+// Error and access logging off the request path.
+//
+// Each thread that logs gets its own single-producer ring buffer, so writing
+// a line is a copy into memory owned by that thread with no lock and no
+// system call. One background thread drains all rings every few milliseconds
+// into stderr (errors) and the access log. When a ring is full the line is
+// dropped and counted rather than making the request wait.
+//
+// Before start_logging() (and in the batch, video and replay modes) lines go
+// straight to std::cerr.
+
+struct LogOptions
+{
+    std::string access_log;               // file for access lines, "-" = stdout, empty = none
+    std::size_t ring_bytes = 16 * 1024;   // per logging thread
+};
+
+void start_logging(LogOptions const &options);
+
+// Timestamped "error: ..." line on stderr
+void log_error(std::string_view message);
+
+// One JSON line in the access log; a no-op without one
+void log_access(nlohmann::json record);
+bool access_log_enabled();
+
+// Lines written and dropped, per destination
+nlohmann::json logging_metrics();
+
+} // namespace mj
+
+#endif // MJ_LOGGER_HPP
@@ -0,0 +1,134 @@
+#include "memory-governor.hpp"
+#include <algorithm>
+
+#include <unistd.h>
+
+using json = nlohmann::json;
+using namespace mj;
+
+std::size_t mj::default_memory_budget()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0)
+        return std::size_t(4) << 30;
+    return static_cast<std::size_t>(pages) * static_cast<std::size_t>(page_size) / 2;
+}
+
+// -----------------------------------------------------------------------------
+// Reservation
+// -----------------------------------------------------------------------------
+
+MemoryGovernor::Reservation::Reservation(MemoryGovernor *governor, std::size_t bytes)
+    : _governor(governor), _bytes(bytes) {}
+
+MemoryGovernor::Reservation::Reservation(Reservation &&other) noexcept
+    : _governor(other._governor), _bytes(other._bytes)
+{
+    other._governor = nullptr;
+}
+
+MemoryGovernor::Reservation &MemoryGovernor::Reservation::operator=(Reservation &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        _governor = other._governor;
+        _bytes = other._bytes;
+        other._governor = nullptr;
+    }
+    return *this;
+}
+
+MemoryGovernor::Reservation::~Reservation()
+{
+    release();
+}
+
+void MemoryGovernor::Reservation::release()
+{
+    if (_governor)
+    {
+        _governor->release(_bytes);
+        _governor = nullptr;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// MemoryGovernor
+// -----------------------------------------------------------------------------
+
+MemoryGovernor::MemoryGovernor(std::size_t budget_bytes, std::chrono::milliseconds max_wait)
+    : _budget(budget_bytes), _max_wait(max_wait) {}
+
+MemoryGovernor::Reservation MemoryGovernor::reserve(std::size_t bytes, Outcome &outcome)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (bytes > _budget)
+    {
+        ++_too_large;
+        outcome = Outcome::TooLarge;
+        return Reservation();
+    }
+
+    Waiter waiter;
+    waiter.bytes = bytes;
+    _queue.push_back(&waiter);
+    grant_locked();
+    if (!waiter.granted)
+    {
+        ++_waited;
+        auto ready = [&] { return waiter.granted; };
+        if (_max_wait.count() > 0)
+            waiter.cv.wait_for(lock, _max_wait, ready);
+        else
+            waiter.cv.wait(lock, ready);
+    }
+
+    if (!waiter.granted)
+    {
+        // Leaving the head may let the next waiter in
+        _queue.erase(std::find(_queue.begin(), _queue.end(), &waiter));
+        grant_locked();
+        ++_timed_out;
+        outcome = Outcome::TimedOut;
+        return Reservation();
+    }
+    ++_granted;
+    outcome = Outcome::Granted;
+    return Reservation(this, bytes);
+}
+
+void MemoryGovernor::release(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _in_use -= bytes;
+    grant_locked();
+}
+
+// Grants from the head of the queue while the next request fits
+void MemoryGovernor::grant_locked()
+{
+    while (!_queue.empty() && _in_use + _queue.front()->bytes <= _budget)
+    {
+        Waiter *waiter = _queue.front();
+        _queue.pop_front();
+        _in_use += waiter->bytes;
+        _peak = std::max(_peak, _in_use);
+        waiter->granted = true;
+        waiter->cv.notify_one();
+    }
+}
+
+json MemoryGovernor::metrics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return {{"budget_bytes", _budget},
+            {"in_use_bytes", _in_use},
+            {"peak_bytes", _peak},
+            {"waiting", _queue.size()},
+            {"granted", _granted},
+            {"waited", _waited},
+            {"rejected_too_large", _too_large},
+            {"rejected_timeout", _timed_out}};
+}
@@ -0,0 +1,94 @@
+#ifndef MJ_MEMORY_GOVERNOR_HPP
+#define MJ_MEMORY_GOVERNOR_HPP
+
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace mj {
+
+// Half of physical memory (4 GiB if unknown), the budget when none is configured
+std::size_t default_memory_budget();
+
+// Process-wide budget for image working memory.
+//
+// Each request reserves its estimated peak (decoded source plus pipeline
+// intermediates, see PipelinePlan::peak_bytes) before decoding and returns it
+// when done, so the sum of what concurrent requests may allocate stays under
+// the budget however large the individual images are. Waiters are served in
+// arrival order, so a large request is not starved by a stream of small ones.
+class MemoryGovernor
+{
+private:
+    struct Waiter
+    {
+        std::size_t bytes;
+        std::condition_variable cv;
+        bool granted = false;
+    };
+
+public:
+    enum class Outcome
+    {
+        Granted,
+        TooLarge, // more than the whole budget
+        TimedOut  // waited max_wait without enough memory freeing up
+    };
+
+    // RAII hold on reserved bytes; returns them on destruction
+    class Reservation
+    {
+    public:
+        Reservation() = default;
+        Reservation(Reservation &&other) noexcept;
+        Reservation &operator=(Reservation &&other) noexcept;
+        Reservation(Reservation const &) = delete;
+        Reservation &operator=(Reservation const &) = delete;
+        ~Reservation();
+
+        bool granted() const { return _governor != nullptr; }
+        std::size_t bytes() const { return _bytes; }
+        void release();
+
+    private:
+        friend class MemoryGovernor;
+        Reservation(MemoryGovernor *governor, std::size_t bytes);
+
+        MemoryGovernor *_governor = nullptr;
+        std::size_t _bytes = 0;
+    };
+
+    // `max_wait` of 0 waits indefinitely
+    MemoryGovernor(std::size_t budget_bytes, std::chrono::milliseconds max_wait);
+
+    Reservation reserve(std::size_t bytes, Outcome &outcome);
+
+    std::size_t budget() const { return _budget; }
+
+    nlohmann::json metrics() const;
+
+private:
+    void release(std::size_t bytes);
+    void grant_locked();
+
+    std::size_t _budget;
+    std::chrono::milliseconds _max_wait;
+    mutable std::mutex _mutex;
+    std::size_t _in_use = 0;
+    std::size_t _peak = 0;
+    std::deque<Waiter *> _queue;
+
+    // metrics
+    std::uint64_t _granted = 0;
+    std::uint64_t _waited = 0;
+    std::uint64_t _too_large = 0;
+    std::uint64_t _timed_out = 0;
+};
+
+} // namespace mj
+
+#endif // MJ_MEMORY_GOVERNOR_HPP
@@ -0,0 +1,210 @@
+#include "morphology.hpp"
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace mj;
+
+// Below this kernel extent OpenCV's own SIMD row/column filters are faster
+static constexpr int MIN_VHGW_KERNEL = 9;
+
+// Column stripe width (bytes) for the vertical pass; keeps the prefix/suffix
+// buffers of one stripe in cache
+static constexpr int COLUMN_STRIPE = 512;
+
+namespace {
+
+struct MaxOp
+{
+    static constexpr unsigned char identity = 0;
+    static unsigned char apply(unsigned char a, unsigned char b) { return a > b ? a : b; }
+};
+
+struct MinOp
+{
+    static constexpr unsigned char identity = 255;
+    static unsigned char apply(unsigned char a, unsigned char b) { return a < b ? a : b; }
+};
+
+template <class Op>
+inline void combine(unsigned char *__restrict dst, const unsigned char *__restrict a, const unsigned char *__restrict b, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = Op::apply(a[i], b[i]);
+}
+
+// One row, `n` pixels of `cn` interleaved channels, window [x - anchor, x - anchor + k - 1].
+// `pad`, `g` and `h` are scratch buffers of (n + k - 1) * cn bytes.
+template <class Op>
+void vhgw_row(const unsigned char *src, unsigned char *dst, int n, int cn, int k, int anchor,
+              unsigned char *pad, unsigned char *g, unsigned char *h)
+{
+    const int len = n + k - 1;
+    const int tail = k - 1 - anchor;
+
+    std::fill(pad, pad + anchor * cn, Op::identity);
+    std::copy(src, src + n * cn, pad + anchor * cn);
+    std::fill(pad + (anchor + n) * cn, pad + (anchor + n + tail) * cn, Op::identity);
+
+    for (int start = 0; start < len; start += k)
+    {
+        const int end = std::min(start + k, len);
+
+        // prefix extrema from the block start
+        std::copy(pad + start * cn, pad + (start + 1) * cn, g + start * cn);
+        for (int j = (start + 1) * cn; j < end * cn; ++j)
+            g[j] = Op::apply(g[j - cn], pad[j]);
+
+        // suffix extrema up to the block end
+        std::copy(pad + (end - 1) * cn, pad + end * cn, h + (end - 1) * cn);
+        for (int j = (end - 1) * cn - 1; j >= start * cn; --j)
+            h[j] = Op::apply(h[j + cn], pad[j]);
+    }
+
+    combine<Op>(dst, h, g + (k - 1) * cn, n * cn);
+}
+
+// Vertical pass over the byte columns [c0, c1) of every row.
+// `g` and `h` are scratch buffers of (rows + k - 1) * (c1 - c0) bytes.
+template <class Op>
+void vhgw_columns(const cv::Mat &src, cv::Mat &dst, int c0, int c1, int k, int anchor,
+                  const unsigned char *identity_row, unsigned char *g, unsigned char *h)
+{
+    const int rows = src.rows;
+    const int len = rows + k - 1;
+    const int width = c1 - c0;
+
+    auto padded = [&](int i) -> const unsigned char * {
+        int y = i - anchor;
+        return y >= 0 && y < rows ? src.ptr<unsigned char>(y) + c0 : identity_row;
+    };
+
+    for (int start = 0; start < len; start += k)
+    {
+        const int end = std::min(start + k, len);
+
+        std::copy(padded(start), padded(start) + width, g + std::size_t(start) * width);
+        for (int i = start + 1; i < end; ++i)
+            combine<Op>(g + std::size_t(i) * width, g + std::size_t(i - 1) * width, padded(i), width);
+
+        std::copy(padded(end - 1), padded(end - 1) + width, h + std::size_t(end - 1) * width);
+        for (int i = end - 2; i >= start; --i)
+            combine<Op>(h + std::size_t(i) * width, h + std::size_t(i + 1) * width, padded(i), width);
+    }
+
+    for (int y = 0; y < rows; ++y)
+        combine<Op>(dst.ptr<unsigned char>(y) + c0, h + std::size_t(y) * width, g + std::size_t(y + k - 1) * width, width);
+}
+
+template <class Op>
+void vhgw(const cv::Mat &src, cv::Mat &dst, cv::Size ksize)
+{
+    const int cn = src.channels();
+    const int kw = ksize.width, kh = ksize.height;
+    const int ax = kw / 2, ay = kh / 2;
+
+    // Row pass, parallel over rows
+    cv::Mat rows_done;
+    if (kw > 1)
+    {
+        rows_done.create(src.size(), src.type());
+        cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range) {
+            std::vector<unsigned char> scratch(std::size_t(src.cols + kw - 1) * cn * 3);
+            unsigned char *pad = scratch.data();
+            unsigned char *g = pad + std::size_t(src.cols + kw - 1) * cn;
+            unsigned char *h = g + std::size_t(src.cols + kw - 1) * cn;
+            for (int y = range.start; y < range.end; ++y)
+                vhgw_row<Op>(src.ptr<unsigned char>(y), rows_done.ptr<unsigned char>(y), src.cols, cn, kw, ax, pad, g, h);
+        });
+    }
+    else
+    {
+        rows_done = src;
+    }
+
+    if (kh == 1)
+    {
+        dst = rows_done.data == src.data ? src.clone() : rows_done;
+        return;
+    }
+
+    // Column pass, parallel over stripes of whole columns; the inner loops run
+    // across contiguous bytes of a row and vectorize
+    cv::Mat out(src.size(), src.type());
+    const int row_bytes = src.cols * cn;
+    const int stripes = (row_bytes + COLUMN_STRIPE - 1) / COLUMN_STRIPE;
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        std::vector<unsigned char> identity_row(COLUMN_STRIPE, Op::identity);
+        std::vector<unsigned char> scratch(std::size_t(src.rows + kh - 1) * COLUMN_STRIPE * 2);
+        unsigned char *g = scratch.data();
+        unsigned char *h = g + std::size_t(src.rows + kh - 1) * COLUMN_STRIPE;
+        for (int s = range.start; s < range.end; ++s)
+        {
+            int c0 = s * COLUMN_STRIPE;
+            int c1 = std::min(c0 + COLUMN_STRIPE, row_bytes);
+            vhgw_columns<Op>(rows_done, out, c0, c1, kh, ay, identity_row.data(), g, h);
+        }
+    });
+    dst = out;
+}
+
+void dilate_or_erode(const cv::Mat &src, cv::Mat &dst, bool dilate, cv::Size ksize)
+{
+    if (src.depth() != CV_8U || std::max(ksize.width, ksize.height) < MIN_VHGW_KERNEL)
+    {
+        cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, ksize);
+        if (dilate)
+            cv::dilate(src, dst, kernel);
+        else
+            cv::erode(src, dst, kernel);
+        return;
+    }
+
+    if (dilate)
+        vhgw<MaxOp>(src, dst, ksize);
+    else
+        vhgw<MinOp>(src, dst, ksize);
+}
+
+} // namespace
+
+void mj::morphology_rect(const cv::Mat &src, cv::Mat &dst, int op, cv::Size ksize)
+{
+    CV_Assert(ksize.width > 0 && ksize.height > 0);
+
+    // With the centred anchor a window of 2 * size - 1 already covers the whole
+    // image from every pixel, and the border never wins, so a larger kernel
+    // gives the same result; clamping bounds the scratch buffers and the int
+    // arithmetic on the padded extents
+    ksize.width = std::min(ksize.width, std::max(1, 2 * src.cols - 1));
+    ksize.height = std::min(ksize.height, std::max(1, 2 * src.rows - 1));
+
+    cv::Mat tmp;
+    switch (op)
+    {
+    case cv::MORPH_DILATE:
+        dilate_or_erode(src, dst, true, ksize);
+        break;
+    case cv::MORPH_ERODE:
+        dilate_or_erode(src, dst, false, ksize);
+        break;
+    case cv::MORPH_OPEN:
+        dilate_or_erode(src, tmp, false, ksize);
+        dilate_or_erode(tmp, dst, true, ksize);
+        break;
+    case cv::MORPH_CLOSE:
+        dilate_or_erode(src, tmp, true, ksize);
+        dilate_or_erode(tmp, dst, false, ksize);
+        break;
+    case cv::MORPH_GRADIENT:
+    {
+        cv::Mat dilated, eroded;
+        dilate_or_erode(src, dilated, true, ksize);
+        dilate_or_erode(src, eroded, false, ksize);
+        cv::subtract(dilated, eroded, dst);
+        break;
+    }
+    default:
+        CV_Error(cv::Error::StsBadArg, "Unsupported morphology operation");
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef MJ_MORPHOLOGY_HPP
+#define MJ_MORPHOLOGY_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace mj {
+
+// Rectangular grey-level morphology whose cost per pixel does not depend on the
+// kernel size (van Herk / Gil-Werman): a row pass then a column pass, each
+// computing block-wise prefix and suffix extrema and combining two of them per
+// output pixel. Results are bit-identical to cv::dilate / cv::erode /
+// cv::morphologyEx with a MORPH_RECT element, default anchor and default
+// border. Small kernels and non-8-bit images are passed through to OpenCV.
+// Kernels larger than 2 * size - 1 are clamped to it, which does not change
+// the result.
+//
+// op is one of cv::MORPH_DILATE, MORPH_ERODE, MORPH_OPEN, MORPH_CLOSE, MORPH_GRADIENT.
+void morphology_rect(const cv::Mat &src, cv::Mat &dst, int op, cv::Size ksize);
+
+inline void dilate_rect(const cv::Mat &src, cv::Mat &dst, cv::Size ksize)
+{
+    morphology_rect(src, dst, cv::MORPH_DILATE, ksize);
+}
+
+inline void erode_rect(const cv::Mat &src, cv::Mat &dst, cv::Size ksize)
+{
+    morphology_rect(src, dst, cv::MORPH_ERODE, ksize);
+}
+
+} // namespace mj
+
+#endif // MJ_MORPHOLOGY_HPP
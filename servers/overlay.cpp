@@ -0,0 +1,404 @@
+#include "overlay.hpp"
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+constexpr std::size_t MASK_CACHE_CAPACITY = 512;
+constexpr std::size_t MASK_CACHE_BYTES = 256u << 20;
+constexpr int FONT = cv::FONT_HERSHEY_SIMPLEX;
+// Bounds on a stage's parameters, so one request cannot make a huge mask;
+// masks are built outside the memory budget, at 8 bytes per pixel
+constexpr double MAX_TEXT_SCALE = 50.0;
+constexpr int MAX_THICKNESS = 100;
+constexpr int MAX_LOGO_WIDTH = 8192;
+constexpr double MAX_MASK_PIXELS = 4 << 20;
+
+struct Logo
+{
+    cv::Mat bgr;
+    cv::Mat alpha; // CV_8UC1
+};
+
+// Written by load_overlay_logos() before serving, read-only after
+std::unordered_map<std::string, Logo> &logos()
+{
+    static std::unordered_map<std::string, Logo> loaded;
+    return loaded;
+}
+
+std::size_t mask_bytes(OverlayMask const &mask)
+{
+    std::size_t bytes = 0;
+    for (cv::Mat const *plane : {&mask.alpha, &mask.color, &mask.gray_alpha, &mask.gray_color})
+        bytes += plane->total() * plane->elemSize();
+    return bytes;
+}
+
+// Least recently inserted masks are evicted past MASK_CACHE_CAPACITY masks
+// or MASK_CACHE_BYTES; a mask larger than the whole budget is not kept
+class MaskCache
+{
+public:
+    std::shared_ptr<OverlayMask const> get(std::string const &key, std::function<OverlayMask()> const &make)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto it = _masks.find(key);
+            if (it != _masks.end())
+            {
+                ++_hits;
+                return it->second;
+            }
+        }
+
+        // Render outside the lock; a concurrent miss on the same key just loses the race
+        ++_misses;
+        auto mask = std::make_shared<OverlayMask const>(make());
+        std::size_t bytes = mask_bytes(*mask);
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        auto it = _masks.find(key);
+        if (it != _masks.end())
+            return it->second;
+        if (bytes > MASK_CACHE_BYTES)
+            return mask;
+        while (!_order.empty() && (_masks.size() >= MASK_CACHE_CAPACITY || _bytes + bytes > MASK_CACHE_BYTES))
+        {
+            auto oldest = _masks.find(_order.front());
+            _bytes -= mask_bytes(*oldest->second);
+            _masks.erase(oldest);
+            _order.pop_front();
+        }
+        _masks.emplace(key, mask);
+        _order.push_back(key);
+        _bytes += bytes;
+        return mask;
+    }
+
+    json metrics() const
+    {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return {{"masks", _masks.size()}, {"capacity", MASK_CACHE_CAPACITY}, {"bytes", _bytes},
+                {"byte_budget", MASK_CACHE_BYTES}, {"hits", _hits.load()}, {"misses", _misses.load()}};
+    }
+
+private:
+    mutable std::shared_mutex _mutex;
+    std::unordered_map<std::string, std::shared_ptr<OverlayMask const>> _masks;
+    std::deque<std::string> _order; // insertion order
+    std::size_t _bytes = 0;
+    std::atomic<std::uint64_t> _hits{0};
+    std::atomic<std::uint64_t> _misses{0};
+};
+
+MaskCache &mask_cache()
+{
+    static MaskCache cache;
+    return cache;
+}
+
+// The blend's per-channel planes from single-plane coverage and BGR colour
+OverlayMask make_mask(cv::Mat const &alpha, cv::Mat const &color)
+{
+    OverlayMask mask;
+    mask.gray_alpha = alpha;
+    cv::merge(std::vector<cv::Mat>{alpha, alpha, alpha}, mask.alpha);
+    mask.color = color;
+    cv::cvtColor(color, mask.gray_color, cv::COLOR_BGR2GRAY);
+    mask.content = cv::Rect(cv::Point(), alpha.size());
+    return mask;
+}
+
+std::string number_key(double value)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+}
+
+// Pixels of text_mask()'s mask
+double text_pixels(std::string const &text, double scale, int thickness)
+{
+    int baseline = 0;
+    cv::Size size = cv::getTextSize(text, FONT, scale, thickness, &baseline);
+    int pad = thickness + 2;
+    return static_cast<double>(size.width + 2 * pad) * (size.height + baseline + 2 * pad);
+}
+
+// Widest a loaded logo may be scaled to: MAX_LOGO_WIDTH, and MAX_MASK_PIXELS
+// at its aspect ratio
+int max_logo_width(std::string const &name)
+{
+    auto it = logos().find(name);
+    if (it == logos().end())
+        return 0;
+    cv::Mat const &bgr = it->second.bgr;
+    double fits = std::sqrt(MAX_MASK_PIXELS * bgr.cols / bgr.rows);
+    return std::max(1, static_cast<int>(std::min<double>(MAX_LOGO_WIDTH, fits)));
+}
+
+cv::Scalar parse_color(std::string const &text)
+{
+    unsigned int r, g, b;
+    char end;
+    if (text.size() != 7 || std::sscanf(text.c_str(), "#%2x%2x%2x%c", &r, &g, &b, &end) != 3)
+        throw std::invalid_argument("'color' must be \"#rrggbb\"");
+    return cv::Scalar(b, g, r);
+}
+
+} // namespace
+
+void mj::load_overlay_logos(std::string const &directory)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::directory_iterator it(directory, ec);
+    if (ec)
+        throw std::runtime_error("Cannot read overlay directory " + directory + ": " + ec.message());
+
+    for (; it != fs::directory_iterator(); it.increment(ec))
+    {
+        if (ec)
+            throw std::runtime_error("Cannot read overlay directory " + directory + ": " + ec.message());
+        if (!it->is_regular_file())
+            continue;
+
+        cv::Mat image = cv::imread(it->path().string(), cv::IMREAD_UNCHANGED);
+        if (image.empty())
+        {
+            std::cerr << "Skipping " << it->path().string() << ": not an image" << std::endl;
+            continue;
+        }
+        if (image.depth() == CV_16U)
+            image.convertTo(image, CV_8U, 1.0 / 257.0);
+        else if (image.depth() != CV_8U)
+            image.convertTo(image, CV_8U, 255.0);
+
+        Logo logo;
+        std::vector<cv::Mat> planes;
+        cv::split(image, planes);
+        if (planes.size() == 2 || planes.size() == 4)
+        {
+            logo.alpha = planes.back();
+            planes.pop_back();
+        }
+        else
+            logo.alpha = cv::Mat(image.size(), CV_8U, cv::Scalar(255));
+        if (planes.size() == 1)
+            planes.assign(3, planes[0]);
+        cv::merge(planes, logo.bgr);
+        logos()[it->path().stem().string()] = std::move(logo);
+    }
+}
+
+int mj::logo_width(std::string const &name)
+{
+    auto it = logos().find(name);
+    return it == logos().end() ? 0 : it->second.bgr.cols;
+}
+
+std::shared_ptr<OverlayMask const> mj::text_mask(std::string const &text, double scale, int thickness, cv::Scalar color, bool antialiased)
+{
+    std::string key = "text|" + number_key(scale) + "|" + std::to_string(thickness) + "|" + number_key(color[0]) + "," +
+                      number_key(color[1]) + "," + number_key(color[2]) + (antialiased ? "|aa|" : "|8|") + text;
+    return mask_cache().get(key, [&] {
+        int baseline = 0;
+        cv::Size size = cv::getTextSize(text, FONT, scale, thickness, &baseline);
+        // Strokes reach past getTextSize's box by about half the thickness
+        int pad = thickness + 2;
+        cv::Mat alpha = cv::Mat::zeros(size.height + baseline + 2 * pad, size.width + 2 * pad, CV_8U);
+        cv::Point origin(pad, pad + size.height);
+        cv::putText(alpha, text, origin, FONT, scale, cv::Scalar(255), thickness, antialiased ? cv::LINE_AA : cv::LINE_8);
+
+        OverlayMask mask = make_mask(alpha, cv::Mat(alpha.size(), CV_8UC3, color));
+        mask.content = cv::Rect(pad, pad, size.width, size.height + baseline);
+        mask.anchor = origin;
+        return mask;
+    });
+}
+
+std::shared_ptr<OverlayMask const> mj::logo_mask(std::string const &name, int width)
+{
+    auto it = logos().find(name);
+    if (it == logos().end())
+        throw std::invalid_argument("Unknown logo '" + name + "'");
+    Logo const &logo = it->second;
+    if (width <= 0)
+        width = logo.bgr.cols;
+
+    return mask_cache().get("logo|" + std::to_string(width) + "|" + name, [&] {
+        if (width == logo.bgr.cols)
+            return make_mask(logo.alpha, logo.bgr);
+
+        // Scaled premultiplied, so transparent pixels' colour does not bleed
+        // into the edges
+        int height = std::max(1, static_cast<int>(std::lround(static_cast<double>(logo.bgr.rows) * width / logo.bgr.cols)));
+        int interpolation = width < logo.bgr.cols ? cv::INTER_AREA : cv::INTER_LINEAR;
+        cv::Mat alpha3, premultiplied, alpha, scaled3, color;
+        cv::merge(std::vector<cv::Mat>{logo.alpha, logo.alpha, logo.alpha}, alpha3);
+        cv::multiply(logo.bgr, alpha3, premultiplied, 1.0 / 255.0);
+        cv::resize(premultiplied, premultiplied, cv::Size(width, height), 0, 0, interpolation);
+        cv::resize(logo.alpha, alpha, cv::Size(width, height), 0, 0, interpolation);
+        cv::merge(std::vector<cv::Mat>{alpha, alpha, alpha}, scaled3);
+        cv::divide(premultiplied, scaled3, color, 255.0);
+        return make_mask(alpha, color);
+    });
+}
+
+void mj::blend_overlay(cv::Mat &image, OverlayMask const &mask, cv::Point at, double opacity)
+{
+    CV_Assert(image.depth() == CV_8U && (image.channels() == 1 || image.channels() == 3));
+    cv::Rect target = cv::Rect(at, mask.size()) & cv::Rect(cv::Point(), image.size());
+    if (target.empty() || opacity <= 0.0)
+        return;
+
+    int channels = image.channels();
+    cv::Mat const &alpha = channels == 1 ? mask.gray_alpha : mask.alpha;
+    cv::Mat const &color = channels == 1 ? mask.gray_color : mask.color;
+    cv::Point source = target.tl() - at;
+    unsigned int weight = static_cast<unsigned int>(std::lround(std::min(opacity, 1.0) * 256.0));
+    int bytes = target.width * channels;
+
+    for (int y = 0; y < target.height; ++y)
+    {
+        unsigned char *d = image.ptr<unsigned char>(target.y + y) + target.x * channels;
+        unsigned char const *a = alpha.ptr<unsigned char>(source.y + y) + source.x * channels;
+        unsigned char const *c = color.ptr<unsigned char>(source.y + y) + source.x * channels;
+        for (int i = 0; i < bytes; ++i)
+        {
+            // Rounded (d * (255 - w) + c * w) / 255
+            unsigned int w = (a[i] * weight) >> 8;
+            unsigned int v = d[i] * (255 - w) + c[i] * w + 128;
+            d[i] = static_cast<unsigned char>((v + (v >> 8)) >> 8);
+        }
+    }
+}
+
+Overlay::Overlay(json const &params)
+    : _text(params.at("text").get<std::string>()), _logo(params.at("logo").get<std::string>()),
+      _scale(params.at("scale").get<double>()), _relative(params.at("relative").get<double>()),
+      _thickness(params.at("thickness").get<int>()), _color(parse_color(params.at("color").get<std::string>())),
+      _opacity(params.at("opacity").get<double>()), _margin(params.at("margin").get<int>()), _spacing(params.at("spacing").get<int>())
+{
+    if (_text.empty() == _logo.empty())
+        throw std::invalid_argument("needs exactly one of 'text' and 'logo'");
+    if (_text.size() > MAX_OVERLAY_TEXT)
+        throw std::invalid_argument("'text' must be at most " + std::to_string(MAX_OVERLAY_TEXT) + " bytes");
+    if (!_logo.empty() && logo_width(_logo) == 0)
+        throw std::invalid_argument("unknown logo '" + _logo + "' (logos are loaded with --overlay-dir)");
+    if (_opacity > 1.0 || _relative > 1.0)
+        throw std::invalid_argument("'opacity' and 'relative' must be at most 1");
+    if (_thickness > MAX_THICKNESS || (_text.empty() ? logo_width(_logo) * _scale > max_logo_width(_logo) : _scale > MAX_TEXT_SCALE))
+        throw std::invalid_argument("overlay too large");
+
+    // Largest font scale whose mask stays within MAX_MASK_PIXELS; the padding
+    // does not scale, so this converges in a step or two
+    _max_scale = MAX_TEXT_SCALE;
+    if (!_text.empty())
+        for (double pixels; (pixels = text_pixels(_text, _max_scale, _thickness)) > MAX_MASK_PIXELS;)
+            _max_scale *= 0.99 * std::sqrt(MAX_MASK_PIXELS / pixels);
+    if (_relative <= 0.0 && !_text.empty() && _scale > _max_scale)
+        throw std::invalid_argument("overlay too large");
+
+    static const std::unordered_map<std::string, Position> positions = {
+        {"top-left", Position::TopLeft},       {"top-right", Position::TopRight}, {"bottom-left", Position::BottomLeft},
+        {"bottom-right", Position::BottomRight}, {"center", Position::Center},      {"tile", Position::Tile}};
+    auto position = positions.find(params.at("position").get<std::string>());
+    if (position == positions.end())
+        throw std::invalid_argument("'position' must be top-left, top-right, bottom-left, bottom-right, center or tile");
+    _position = position->second;
+
+    if (_relative <= 0.0)
+        _fixed = mask_for(cv::Size());
+}
+
+std::shared_ptr<OverlayMask const> Overlay::mask_for(cv::Size image) const
+{
+    if (_fixed)
+        return _fixed;
+
+    if (!_logo.empty())
+    {
+        int width = _relative > 0.0 ? static_cast<int>(std::lround(_relative * image.width))
+                                    : static_cast<int>(std::lround(logo_width(_logo) * _scale));
+        return logo_mask(_logo, std::clamp(width, 1, max_logo_width(_logo)));
+    }
+
+    double scale = _scale;
+    if (_relative > 0.0)
+    {
+        // Font scale that makes the text `relative` of the image wide
+        int baseline = 0;
+        int unit = std::max(cv::getTextSize(_text, FONT, 1.0, _thickness, &baseline).width, 1);
+        scale = std::min(_relative * image.width / unit, _max_scale);
+    }
+    return text_mask(_text, scale, _thickness, _color, true);
+}
+
+cv::Mat Overlay::apply(cv::Mat const &image) const
+{
+    cv::Mat out = image.clone();
+    std::shared_ptr<OverlayMask const> mask = mask_for(image.size());
+    cv::Rect box = mask->content;
+
+    cv::Point corner;
+    switch (_position)
+    {
+    case Position::TopLeft:
+        corner = cv::Point(_margin, _margin);
+        break;
+    case Position::TopRight:
+        corner = cv::Point(out.cols - _margin - box.width, _margin);
+        break;
+    case Position::BottomLeft:
+        corner = cv::Point(_margin, out.rows - _margin - box.height);
+        break;
+    case Position::BottomRight:
+        corner = cv::Point(out.cols - _margin - box.width, out.rows - _margin - box.height);
+        break;
+    case Position::Center:
+        corner = cv::Point((out.cols - box.width) / 2, (out.rows - box.height) / 2);
+        break;
+    case Position::Tile:
+    {
+        // Rows of tiles run in parallel when their masks cannot overlap
+        cv::Size step(box.width + _spacing, box.height + _spacing);
+        int rows = std::max(0, (out.rows - _margin + step.height - 1) / step.height);
+        auto blend_rows = [&](cv::Range const &range) {
+            for (int r = range.start; r < range.end; ++r)
+                for (int x = _margin; x < out.cols; x += step.width)
+                    blend_overlay(out, *mask, cv::Point(x, _margin + r * step.height) - box.tl(), _opacity);
+        };
+        if (step.height >= mask->size().height)
+            cv::parallel_for_(cv::Range(0, rows), blend_rows);
+        else
+            blend_rows(cv::Range(0, rows));
+        return out;
+    }
+    }
+    blend_overlay(out, *mask, corner - box.tl(), _opacity);
+    return out;
+}
+
+json mj::overlay_metrics()
+{
+    json j = mask_cache().metrics();
+    j["logos"] = logos().size();
+    return j;
+}
@@ -0,0 +1,105 @@
+#ifndef MJ_OVERLAY_HPP
+#define MJ_OVERLAY_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <memory>
+#include <string>
+
+namespace mj {
+
+// Text and logo overlays composited by alpha blending.
+//
+// Text is rasterized once (Hershey simplex, as cv::putText) into a coverage
+// mask, and logos are loaded once from the overlay directory and scaled once
+// per size. Masks live in a process-wide cache keyed by content, scale and
+// pixel size, so a stage compiled into a plan, and every plan with the same
+// overlay, share them. Per request an overlay costs a blend over the pixels
+// it covers.
+struct OverlayMask
+{
+    cv::Mat alpha;      // CV_8UC3, coverage repeated per channel
+    cv::Mat color;      // CV_8UC3
+    cv::Mat gray_alpha; // CV_8UC1, for single-plane images
+    cv::Mat gray_color; // CV_8UC1, luma of color
+    cv::Rect content;   // text: getTextSize's box down to the descenders; logo: all of it
+    cv::Point anchor;   // text: start of the baseline (putText's origin); logo: (0, 0)
+
+    cv::Size size() const { return alpha.size(); }
+};
+
+// Loads every image in `directory` as a logo named by its file stem. An alpha
+// channel is kept as coverage; other images are opaque. Call before serving.
+// Throws std::runtime_error if the directory cannot be read.
+void load_overlay_logos(std::string const &directory);
+
+// Longest text, in bytes, that the Watermark and Overlay stages accept
+constexpr std::size_t MAX_OVERLAY_TEXT = 256;
+
+// Coverage mask of `text` as cv::putText draws it in white with
+// FONT_HERSHEY_SIMPLEX. `antialiased` selects LINE_AA over LINE_8.
+std::shared_ptr<OverlayMask const> text_mask(std::string const &text, double scale, int thickness, cv::Scalar color, bool antialiased);
+
+// A loaded logo at `width` pixels (0 = its own size), aspect kept. Throws
+// std::invalid_argument for an unknown name.
+std::shared_ptr<OverlayMask const> logo_mask(std::string const &name, int width);
+
+// Native width of a loaded logo, 0 if unknown
+int logo_width(std::string const &name);
+
+// image = image + (color - image) * alpha * opacity for the part of `mask`
+// placed with its top-left at `at` that lies inside `image` (8-bit, one or
+// three channels). One pass of 16-bit integer arithmetic over contiguous
+// bytes, which the compiler vectorizes.
+void blend_overlay(cv::Mat &image, OverlayMask const &mask, cv::Point at, double opacity = 1.0);
+
+// The Overlay stage:
+//   {"op": "Overlay", "text": "(c) Example", "position": "bottom-right"}
+//   {"op": "Overlay", "logo": "brand", "relative": 0.2, "opacity": 0.6, "position": "tile"}
+// Exactly one of "text" and "logo". "position" is top-left, top-right,
+// bottom-left (default), bottom-right, center or tile (repeated across the
+// image, "spacing" pixels apart). "relative" > 0 sizes the overlay to that
+// fraction of the image width instead of "scale". Parameters are checked at
+// construction, which throws std::invalid_argument; text is at most 256
+// bytes and a mask at most 4 MP ("relative" sizes are capped to that).
+class Overlay
+{
+public:
+    explicit Overlay(nlohmann::json const &params);
+
+    // Returns a copy of `image` with the overlay composited
+    cv::Mat apply(cv::Mat const &image) const;
+
+private:
+    enum class Position
+    {
+        TopLeft,
+        TopRight,
+        BottomLeft,
+        BottomRight,
+        Center,
+        Tile
+    };
+
+    std::shared_ptr<OverlayMask const> mask_for(cv::Size image) const;
+
+    std::string _text;
+    std::string _logo;
+    double _scale;
+    double _max_scale; // text: keeps the mask within the size limit
+    double _relative;
+    int _thickness;
+    cv::Scalar _color;
+    double _opacity;
+    Position _position;
+    int _margin;
+    int _spacing;
+    std::shared_ptr<OverlayMask const> _fixed; // the mask when it does not depend on the image size
+};
+
+// Mask cache counters for /metrics
+nlohmann::json overlay_metrics();
+
+} // namespace mj
+
+#endif // MJ_OVERLAY_HPP
@@ -0,0 +1,617 @@
+#include "pipeline.hpp"
+#include "blur.hpp"
+#include "tracing.hpp"
+#include "presets.hpp"
+#include "processor-registry.hpp"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <stdexcept>
+
+using json = nlohmann::json;
+using namespace mj;
+
+// -----------------------------------------------------------------------------
+// Canonicalization
+// -----------------------------------------------------------------------------
+
+static constexpr std::size_t MAX_PIPELINE_STAGES = 32;
+
+// The legacy form: each registered stage's field, in registration order
+static PipelineSpec legacy_pipeline(ProcessorRegistry const &registry, json const &request)
+{
+    PipelineSpec spec;
+    if (!request.is_object())
+        return spec;
+
+    for (StageDefinition const &definition : registry.definitions())
+    {
+        auto field = request.find(definition.legacy_key);
+        if (field == request.end())
+            continue;
+        if (definition.flag)
+        {
+            if (field->get<bool>())
+                spec.push_back({definition.op, json::object()});
+        }
+        else if (field->is_object())
+        {
+            if (auto params = registry.normalize(definition, *field, false))
+                spec.push_back({definition.op, std::move(*params)});
+        }
+    }
+    return spec;
+}
+
+PipelineSpec mj::canonicalize_pipeline(json const &request)
+{
+    ProcessorRegistry const &registry = processor_registry();
+    PipelineSpec spec = legacy_pipeline(registry, request);
+
+    json const *stages = request.is_array() ? &request : nullptr;
+    if (request.is_object())
+    {
+        auto it = request.find("pipeline");
+        if (it != request.end() && !it->is_null())
+            stages = &*it;
+    }
+    if (!stages)
+        return spec;
+
+    if (!stages->is_array())
+        throw std::invalid_argument("'pipeline' must be an array of stages");
+    if (!spec.empty())
+        throw std::invalid_argument("'pipeline' cannot be combined with the " + spec.front().op + " request field");
+    if (stages->size() > MAX_PIPELINE_STAGES)
+        throw std::invalid_argument("At most " + std::to_string(MAX_PIPELINE_STAGES) + " pipeline stages");
+
+    for (std::size_t i = 0; i < stages->size(); ++i)
+    {
+        json const &entry = (*stages)[i];
+        std::string where = "Pipeline stage " + std::to_string(i);
+        auto op = entry.is_object() ? entry.find("op") : entry.end();
+        if (!entry.is_object() || op == entry.end() || !op->is_string())
+            throw std::invalid_argument(where + " needs an \"op\" name");
+
+        StageDefinition const *definition = registry.find(op->get<std::string>());
+        if (!definition)
+            throw std::invalid_argument(where + ": unknown op '" + op->get<std::string>() + "'");
+
+        json raw = entry;
+        raw.erase("op");
+        try
+        {
+            spec.push_back({definition->op, *registry.normalize(*definition, raw, true)});
+        }
+        catch (const std::invalid_argument &e)
+        {
+            throw std::invalid_argument(where + " (" + definition->op + "): " + e.what());
+        }
+    }
+    return spec;
+}
+
+std::optional<RegionOfInterest> mj::parse_roi(json const &request)
+{
+    auto it = request.find("roi");
+    if (it == request.end() || it->is_null())
+        return std::nullopt;
+    if (!it->is_object())
+        throw std::invalid_argument("'roi' must be an object");
+
+    RegionOfInterest roi;
+    roi.rect = cv::Rect(it->value("x", 0), it->value("y", 0), it->at("width").get<int>(), it->at("height").get<int>());
+    if (roi.rect.x < 0 || roi.rect.y < 0 || roi.rect.width <= 0 || roi.rect.height <= 0)
+        throw std::invalid_argument("'roi' needs x, y >= 0 and a positive width and height");
+
+    std::string apply = it->value("apply", std::string("after"));
+    if (apply != "after" && apply != "before")
+        throw std::invalid_argument("'roi.apply' must be \"before\" or \"after\"");
+    roi.before = apply == "before";
+    return roi;
+}
+
+std::string mj::pipeline_key(PipelineSpec const &spec)
+{
+    json stages = json::array();
+    for (auto const &stage : spec)
+        stages.push_back({{"op", stage.op}, {"params", stage.params}});
+    return stages.dump();
+}
+
+json mj::pipeline_json(PipelineSpec const &spec)
+{
+    json stages = json::array();
+    for (auto const &stage : spec)
+    {
+        json entry = stage.params;
+        entry["op"] = stage.op;
+        stages.push_back(std::move(entry));
+    }
+    return stages;
+}
+
+// -----------------------------------------------------------------------------
+// Compilation
+// -----------------------------------------------------------------------------
+
+// Pixel-moving stages that can be folded into a neighbour's resample
+static std::shared_ptr<GeometricTransform const> geometric_step(StageSpec const &stage)
+{
+    json const &p = stage.params;
+
+    if (stage.op == "Resize")
+        return std::make_shared<ResizeTransform>(p.at("width").get<int>(), p.at("height").get<int>());
+    if (stage.op == "Rotate")
+        return std::make_shared<RotateTransform>(p.at("angle").get<double>());
+    return nullptr;
+}
+
+namespace {
+
+// A compiled unit: one stage, or a run of geometric stages folded into one warp
+struct Unit
+{
+    std::string op;
+    StageSpec const *stage = nullptr;
+    GeometricSteps steps;
+    std::string label; // name in timing spans
+};
+
+} // namespace
+
+// Whether geometric stage `next` can join the run spec[begin, next) in one
+// warp without changing the result beyond edge rounding. A second Rotate
+// would sample what the first cropped away, and a Resize larger than an
+// earlier one would sample detail that smaller frame had lost (a pixelating
+// Resize down and back up would become an identity). Across a Rotate the
+// axes mix, so there the larger side must fit the earlier smaller one.
+static bool joins_run(PipelineSpec const &spec, std::size_t begin, std::size_t next)
+{
+    StageSpec const &stage = spec[next];
+    bool rotated = false;
+    for (std::size_t i = next; i-- > begin;)
+    {
+        StageSpec const &earlier = spec[i];
+        if (earlier.op == "Rotate")
+        {
+            if (stage.op == "Rotate")
+                return false;
+            rotated = true;
+        }
+        else if (stage.op == "Resize")
+        {
+            int width = stage.params.at("width").get<int>(), height = stage.params.at("height").get<int>();
+            int earlier_width = earlier.params.at("width").get<int>(), earlier_height = earlier.params.at("height").get<int>();
+            bool fits = rotated ? std::max(width, height) <= std::min(earlier_width, earlier_height)
+                                : width <= earlier_width && height <= earlier_height;
+            if (!fits)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Runs of two or more geometric stages that joins_run() allows become a
+// single warp
+static std::vector<Unit> fold_units(PipelineSpec const &spec)
+{
+    std::vector<Unit> units;
+    for (std::size_t i = 0; i < spec.size();)
+    {
+        GeometricSteps steps;
+        std::size_t end = i;
+        for (; end < spec.size(); ++end)
+        {
+            auto step = geometric_step(spec[end]);
+            if (!step || (end > i && !joins_run(spec, i, end)))
+                break;
+            steps.push_back(std::move(step));
+        }
+
+        if (steps.size() >= 2)
+        {
+            std::string label = spec[i].op;
+            for (std::size_t j = i + 1; j < end; ++j)
+                label += "+" + spec[j].op;
+            units.push_back({"Geometric", nullptr, std::move(steps), label});
+            i = end;
+        }
+        else
+        {
+            units.push_back({spec[i].op, &spec[i], {}, spec[i].op});
+            ++i;
+        }
+    }
+    return units;
+}
+
+static std::unique_ptr<ImageProcessor> wrap_unit(std::unique_ptr<ImageProcessor> chain, Unit const &unit)
+{
+    if (unit.stage)
+        return processor_registry().wrap(std::move(chain), *unit.stage);
+    return std::make_unique<GeometricProcessor>(std::move(chain), unit.steps);
+}
+
+// Stages that read or produce luma only
+static bool is_luma_op(std::string const &op)
+{
+    return op == "Grayscale" || op == "DetectEdges" || op == "EqualizeHistogram" || op == "CLAHE";
+}
+
+static std::unique_ptr<TrackedStage> tracked_stage(Unit const &unit)
+{
+    if (unit.op == "Grayscale")
+        return std::make_unique<GrayscaleStage>();
+    if (unit.op == "DetectEdges")
+        return std::make_unique<EdgeStage>();
+    if (unit.op == "EqualizeHistogram")
+        return std::make_unique<EqualizeStage>();
+    if (unit.op == "CLAHE")
+        return std::make_unique<ClaheStage>(unit.stage->params.at("clip_limit").get<double>());
+
+    // Everything else runs its ordinary processor, detached from any chain
+    std::shared_ptr<ProcessorDecorator const> processor(static_cast<ProcessorDecorator *>(wrap_unit(nullptr, unit).release()));
+    StageFunction fn = [processor](cv::Mat const &image) { return processor->apply(image); };
+    if (unit.op == "Sepia" || unit.op == "Overlay")
+        return std::make_unique<BgrStage>(std::move(fn), processor->temporal());
+    return std::make_unique<ChannelwiseStage>(std::move(fn), processor->temporal());
+}
+
+// A stage on a JPEG's planes: luma stages on Y, and point stages whose
+// effect on chroma is known. Null for stages that need BGR.
+static std::function<void(YuvImage &)> yuv_stage(StageSpec const &stage)
+{
+    json const &p = stage.params;
+    if (stage.op == "Grayscale")
+        return [](YuvImage &image) { image.chroma.clear(); };
+    if (stage.op == "EqualizeHistogram")
+        return [](YuvImage &image) { cv::equalizeHist(image.y, image.y); };
+    if (stage.op == "CLAHE")
+    {
+        double clip_limit = p.at("clip_limit").get<double>();
+        return [clip_limit](YuvImage &image) {
+            thread_local cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE();
+            clahe->setClipLimit(clip_limit);
+            clahe->apply(image.y, image.y);
+        };
+    }
+    if (stage.op == "BrightnessContrast")
+    {
+        // c * BGR + b is c * Y + b on luma and c * (C - 128) + 128 on chroma,
+        // since the luma weights sum to 1 and the chroma weights to 0
+        double contrast = p.at("contrast").get<double>();
+        int brightness = p.at("brightness").get<int>();
+        cv::Mat luma(1, 256, CV_8U), chroma(1, 256, CV_8U);
+        for (int v = 0; v < 256; ++v)
+        {
+            luma.at<uchar>(v) = cv::saturate_cast<uchar>(v * contrast + brightness);
+            chroma.at<uchar>(v) = cv::saturate_cast<uchar>((v - 128) * contrast + 128);
+        }
+        return [luma, chroma](YuvImage &image) {
+            cv::LUT(image.y, luma, image.y);
+            for (cv::Mat &plane : image.chroma)
+                cv::LUT(plane, chroma, plane);
+        };
+    }
+    if (stage.op == "GammaCorrection")
+    {
+        double gamma = p.at("gamma").get<double>();
+        cv::Mat table(1, 256, CV_8U);
+        for (int v = 0; v < 256; ++v)
+            table.at<uchar>(v) = static_cast<uchar>(std::pow(v / 255.0, gamma) * 255.0);
+        return [table](YuvImage &image) { cv::LUT(image.y, table, image.y); };
+    }
+    return nullptr;
+}
+
+// Footprint of a unit for region runs, with its own detached processor
+static RegionStage region_stage(Unit const &unit)
+{
+    RegionStage region;
+    region.label = unit.label;
+
+    if (!unit.stage)
+    {
+        region.kind = RegionStage::Kind::Geometric;
+        region.steps = unit.steps;
+        region.pyramid = true;
+        return region;
+    }
+    if (auto step = geometric_step(*unit.stage))
+    {
+        region.kind = RegionStage::Kind::Geometric;
+        region.steps = {step};
+        region.border = unit.op == "Resize" ? cv::BORDER_REPLICATE : cv::BORDER_CONSTANT;
+        return region;
+    }
+
+    region.processor.reset(static_cast<ProcessorDecorator *>(wrap_unit(nullptr, unit).release()));
+    std::string const &op = unit.op;
+    json const &p = unit.stage->params;
+    if (op == "Grayscale" || op == "BrightnessContrast" || op == "GammaCorrection" || op == "InvertColors" || op == "Sepia")
+        region.halo = 0;
+    else if (op == "Sharpen")
+        region.halo = 1;
+    else if (op == "Blur")
+        region.halo = gaussian_radius(p.at("kernel_size").get<int>(), 0);
+    else if (op == "UnsharpMask")
+        region.halo = gaussian_radius(0, 3);
+    else if (op == "MedianBlur" || op == "Dilation" || op == "Erosion" || op == "MorphGradient")
+        region.halo = p.at("kernel").get<int>() / 2;
+    else if (op == "Opening" || op == "Closing")
+        region.halo = 2 * (p.at("kernel").get<int>() / 2);
+    else
+        region.kind = RegionStage::Kind::Global;
+    return region;
+}
+
+// The decorator chain for `units`. From the first luma stage on, the colour
+// space is tracked instead of converting back to BGR after every stage.
+static std::unique_ptr<ImageProcessor> build_chain(std::vector<Unit> const &units)
+{
+    auto first_luma = std::find_if(units.begin(), units.end(), [](Unit const &u) { return is_luma_op(u.op); });
+    std::size_t tracked = first_luma - units.begin();
+    if (units.size() - tracked < 2)
+        tracked = units.size();
+
+    // wrap_unit only ever returns decorators
+    std::unique_ptr<ImageProcessor> chain = std::make_unique<BaseProcessor>();
+    auto label = [&chain](std::string name) { static_cast<ProcessorDecorator &>(*chain).set_label(std::move(name)); };
+
+    for (std::size_t i = 0; i < tracked; ++i)
+    {
+        chain = wrap_unit(std::move(chain), units[i]);
+        label(units[i].label);
+    }
+
+    if (tracked < units.size())
+    {
+        std::vector<std::unique_ptr<TrackedStage>> stages;
+        std::string name = "Tracked:";
+        for (std::size_t i = tracked; i < units.size(); ++i)
+        {
+            stages.push_back(tracked_stage(units[i]));
+            name += (i > tracked ? "+" : "") + units[i].label;
+        }
+        chain = std::make_unique<ColorTrackedProcessor>(std::move(chain), std::move(stages));
+        label(name);
+    }
+    return chain;
+}
+
+static const cv::Size PROBE_SIZE(128, 96);
+
+// The spec the probe runs: Resize targets no larger than the probe, so that
+// client parameters cannot make compiling a plan allocate more than a few
+// probe-sized images. The frames are smaller, the code paths the same.
+static PipelineSpec probe_spec(PipelineSpec spec)
+{
+    for (StageSpec &stage : spec)
+        if (stage.op == "Resize")
+        {
+            stage.params["width"] = std::min(stage.params.at("width").get<int>(), PROBE_SIZE.width);
+            stage.params["height"] = std::min(stage.params.at("height").get<int>(), PROBE_SIZE.height);
+        }
+    return spec;
+}
+
+// A specialized pipeline must give the dynamic chain's pixels; checked on
+// noise, which reaches every table entry and rounding case often enough
+static bool same_result(StaticRunner const &runner, ImageProcessor &chain)
+{
+    cv::Mat probe(PROBE_SIZE, CV_8UC3);
+    cv::RNG rng(0x5eed);
+    rng.fill(probe, cv::RNG::UNIFORM, 0, 256);
+    cv::Mat expected = chain.process(probe);
+    cv::Mat actual = runner(probe);
+    return actual.size() == expected.size() && actual.type() == expected.type() && cv::norm(actual, expected, cv::NORM_INF) == 0;
+}
+
+// same_result() for `spec`, on its probe_spec() when that differs
+static bool same_result(PipelineSpec const &spec, StaticRunner const &runner, ImageProcessor &chain)
+{
+    PipelineSpec probe = probe_spec(spec);
+    if (pipeline_key(probe) == pipeline_key(spec))
+        return same_result(runner, chain);
+    StaticRunner probe_runner = compile_static(probe);
+    return probe_runner && same_result(probe_runner, *build_chain(fold_units(probe)));
+}
+
+PipelinePlan::PipelinePlan(PipelineSpec spec) : _spec(std::move(spec)), _key(pipeline_key(_spec))
+{
+    std::vector<Unit> units = fold_units(_spec);
+    for (Unit const &unit : units)
+        _regions.push_back(region_stage(unit));
+    _chain = build_chain(units);
+
+    _yuv_capable = true;
+    _yuv_label = "Yuv:";
+    for (std::size_t i = 0; i < _spec.size() && _yuv_capable; ++i)
+    {
+        auto stage = yuv_stage(_spec[i]);
+        _yuv_capable = static_cast<bool>(stage);
+        _yuv.push_back(std::move(stage));
+        _yuv_label += (i > 0 ? "+" : "") + _spec[i].op;
+    }
+    if (!_yuv_capable)
+        _yuv.clear();
+
+    if (StaticRunner runner = compile_static(_spec); runner && !temporal() && same_result(_spec, runner, *_chain))
+    {
+        _static = std::move(runner);
+        _static_label = "Static:";
+        for (std::size_t i = 0; i < _spec.size(); ++i)
+            _static_label += (i > 0 ? "+" : "") + _spec[i].op;
+    }
+}
+
+cv::Mat PipelinePlan::run(cv::Mat const &image) const
+{
+    if (_static)
+    {
+        TraceScope span(_static_label, true);
+        return _static(image);
+    }
+    return _chain->process(image);
+}
+
+void PipelinePlan::run_yuv(YuvImage &image) const
+{
+    CV_Assert(_yuv_capable);
+    TraceScope span(_yuv_label, true);
+    for (auto const &stage : _yuv)
+        stage(image);
+}
+
+bool PipelinePlan::temporal() const
+{
+    return _chain->temporal();
+}
+
+std::vector<cv::Rect> PipelinePlan::region_chain(cv::Size input, cv::Rect roi, std::vector<cv::Size> &sizes) const
+{
+    sizes.assign(1, input);
+    for (RegionStage const &stage : _regions)
+    {
+        cv::Size next = sizes.back();
+        if (stage.kind == RegionStage::Kind::Geometric)
+            compose(stage.steps, next, next);
+        sizes.push_back(next);
+    }
+
+    std::vector<cv::Rect> regions(sizes.size());
+    regions.back() = roi & cv::Rect(cv::Point(), sizes.back());
+
+    // Once a stage needs its whole input, so does everything before it.
+    // State kept between frames lives in the chain, so temporal plans run it whole.
+    bool whole = temporal();
+    for (std::size_t i = _regions.size(); i-- > 0;)
+    {
+        RegionStage const &stage = _regions[i];
+        cv::Rect full(cv::Point(), sizes[i]);
+        cv::Rect out = regions[i + 1];
+        if (whole || stage.kind == RegionStage::Kind::Global)
+        {
+            whole = true;
+            regions[i] = full;
+        }
+        else if (stage.kind == RegionStage::Kind::Geometric)
+            regions[i] = source_window(stage.steps, sizes[i], out, stage.pyramid);
+        else
+            regions[i] = cv::Rect(out.x - stage.halo, out.y - stage.halo, out.width + 2 * stage.halo, out.height + 2 * stage.halo) & full;
+    }
+    return regions;
+}
+
+cv::Size PipelinePlan::output_size(cv::Size input) const
+{
+    std::vector<cv::Size> sizes;
+    region_chain(input, cv::Rect(), sizes);
+    return sizes.back();
+}
+
+std::size_t PipelinePlan::peak_bytes(cv::Size input) const
+{
+    std::vector<cv::Size> sizes;
+    region_chain(input, cv::Rect(), sizes);
+    // Size::area() is int and probed headers may claim more
+    auto pixels = [](cv::Size size) { return static_cast<double>(size.width) * size.height; };
+    double widest = 0.0;
+    for (std::size_t i = 0; i + 1 < sizes.size(); ++i)
+        widest = std::max(widest, pixels(sizes[i]) + 2.0 * pixels(sizes[i + 1]));
+    return static_cast<std::size_t>((pixels(input) + widest) * 3.0);
+}
+
+cv::Rect PipelinePlan::source_region(cv::Size input, cv::Rect roi) const
+{
+    std::vector<cv::Size> sizes;
+    return region_chain(input, roi, sizes).front();
+}
+
+cv::Mat PipelinePlan::run_region(cv::Mat const &source, cv::Size input, cv::Rect roi) const
+{
+    std::vector<cv::Size> sizes;
+    std::vector<cv::Rect> regions = region_chain(input, roi, sizes);
+    CV_Assert(source.size() == regions.front().size());
+
+    if (temporal())
+        return run(source)(regions.back());
+
+    // Each stage produces exactly the next region; the pixels it computes
+    // beyond that from a clipped neighbourhood are dropped
+    cv::Mat image = source;
+    for (std::size_t i = 0; i < _regions.size(); ++i)
+    {
+        RegionStage const &stage = _regions[i];
+        TraceScope span(stage.label, true);
+        cv::Mat next;
+        if (stage.kind == RegionStage::Kind::Geometric)
+            warp_window(image, regions[i].tl(), sizes[i], stage.steps, regions[i + 1], stage.pyramid, stage.border, next);
+        else
+            next = stage.processor->apply(image)(regions[i + 1] - regions[i].tl());
+        image = next;
+    }
+    return image;
+}
+
+// -----------------------------------------------------------------------------
+// PlanCache
+// -----------------------------------------------------------------------------
+
+PlanCache::PlanCache(std::size_t capacity) : _capacity(std::max<std::size_t>(capacity, 1)) {}
+
+std::shared_ptr<PipelinePlan const> PlanCache::get(json const &request)
+{
+    return get(canonicalize_pipeline(request));
+}
+
+std::shared_ptr<PipelinePlan const> PlanCache::get(PipelineSpec spec)
+{
+    std::string key = pipeline_key(spec);
+    {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        auto it = _plans.find(key);
+        if (it != _plans.end())
+        {
+            ++_hits;
+            it->second.used.store(++_clock, std::memory_order_relaxed);
+            return it->second.plan;
+        }
+    }
+
+    // Compile outside the lock; a concurrent miss on the same key just loses the race
+    ++_misses;
+    auto plan = std::make_shared<PipelinePlan const>(std::move(spec));
+
+    // Per-stream state must not leak between requests
+    if (plan->temporal())
+        return plan;
+
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    auto it = _plans.find(key);
+    if (it != _plans.end())
+        return it->second.plan;
+    if (_plans.size() >= _capacity)
+    {
+        auto oldest = std::min_element(_plans.begin(), _plans.end(), [](auto const &a, auto const &b) {
+            return a.second.used.load(std::memory_order_relaxed) < b.second.used.load(std::memory_order_relaxed);
+        });
+        _plans.erase(oldest);
+    }
+    _plans.try_emplace(std::move(key), plan, ++_clock);
+    return plan;
+}
+
+json PlanCache::metrics() const
+{
+    std::shared_lock<std::shared_mutex> lock(_mutex);
+    json j;
+    j["plans"] = _plans.size();
+    j["capacity"] = _capacity;
+    j["hits"] = _hits.load();
+    j["misses"] = _misses.load();
+    j["specialized"] = std::count_if(_plans.begin(), _plans.end(), [](auto const &entry) { return entry.second.plan->specialized(); });
+    return j;
+}
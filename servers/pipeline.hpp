@@ -0,0 +1,172 @@
+#ifndef MJ_PIPELINE_HPP
+#define MJ_PIPELINE_HPP
+
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "image-processor.hpp"
+#include "color-space.hpp"
+
+namespace mj {
+
+// One processing stage with its parameters normalized (defaults filled in,
+// unknown fields dropped), so equal configurations compare equal.
+struct StageSpec
+{
+    std::string op;
+    nlohmann::json params;
+};
+
+using PipelineSpec = std::vector<StageSpec>;
+
+// Extracts the processing stages of a request body. Either an ordered list,
+//   "pipeline": [{"op": "Resize", "width": 640, "height": 480}, {"op": "CLAHE"}]
+// (or a bare array of such stages), where stages may repeat and each op's
+// parameters are validated by the ProcessorRegistry, or the legacy fields
+// ("Resize": {...}, "ApplyCLAHE": {...}) applied in the registry's fixed order.
+// Throws nlohmann::json::exception when a field has the wrong type and
+// std::invalid_argument for an invalid "pipeline" list.
+PipelineSpec canonicalize_pipeline(nlohmann::json const &request);
+
+// Canonical text form of a spec, used as the plan cache key
+std::string pipeline_key(PipelineSpec const &spec);
+
+// A spec in the "pipeline" array form that canonicalize_pipeline accepts
+nlohmann::json pipeline_json(PipelineSpec const &spec);
+
+// Optional region of interest of a request:
+//   "roi": {"x": 0, "y": 0, "width": 256, "height": 256, "apply": "after"}
+// "after" (the default) returns that region of the processed image and
+// computes only what it depends on. "before" crops the source first and
+// processes the crop. Not part of the plan key.
+struct RegionOfInterest
+{
+    cv::Rect rect;
+    bool before = false;
+};
+
+// Throws nlohmann::json::exception or std::invalid_argument when malformed
+std::optional<RegionOfInterest> parse_roi(nlohmann::json const &request);
+
+// How one compiled unit maps an output region back to the input it reads
+struct RegionStage
+{
+    enum class Kind
+    {
+        Local,     // translation invariant, reads `halo` pixels around each output pixel
+        Geometric, // moves pixels through `steps`
+        Global     // reads the whole image (histograms, Canny, position-dependent drawing)
+    };
+
+    Kind kind = Kind::Local;
+    int halo = 0;
+    GeometricSteps steps;
+    bool pyramid = false;
+    int border = cv::BORDER_CONSTANT;
+    std::shared_ptr<ProcessorDecorator const> processor;
+    std::string label;
+};
+
+// Immutable compiled pipeline. Stage resources (kernels, LUTs, structuring
+// elements) are built once at compile time; run() is safe to call from any
+// number of threads. Compilation folds adjacent geometric stages into one warp
+// where no intermediate frame crops or reduces what later ones sample, and runs everything from the first luma stage on in a tracked colour space.
+// Stage sequences with a compiled-in StaticPipeline (presets.hpp) run that
+// instead, once it has reproduced the dynamic chain on a small probe image
+// (with Resize targets cut to the probe's size, so compiling stays cheap).
+class PipelinePlan
+{
+public:
+    explicit PipelinePlan(PipelineSpec spec);
+
+    cv::Mat run(cv::Mat const &image) const;
+
+    // The dynamic chain alone, which a StaticPipeline must reproduce
+    cv::Mat run_chain(cv::Mat const &image) const { return _chain->process(image); }
+
+    // Whether every stage can run on a JPEG's own planes (jpeg-yuv.hpp):
+    // Grayscale, EqualizeHistogram, CLAHE, BrightnessContrast and
+    // GammaCorrection. run_yuv() then matches run() up to rounding, except
+    // that CLAHE works on Y instead of Lab L and gamma on Y alone.
+    bool runs_on_yuv() const { return _yuv_capable; }
+    void run_yuv(YuvImage &image) const;
+
+    PipelineSpec const &spec() const { return _spec; }
+    std::string const &key() const { return _key; }
+    std::size_t size() const { return _spec.size(); }
+    bool specialized() const { return static_cast<bool>(_static); }
+
+    // Some stage keeps state between frames; run frames in order on one thread
+    bool temporal() const;
+
+    cv::Size output_size(cv::Size input) const;
+
+    // Estimated peak bytes run() allocates for an 8-bit BGR `input`, counting
+    // the caller's source: at the widest stage, its input, its output and one
+    // temporary the size of the output
+    std::size_t peak_bytes(cv::Size input) const;
+
+    // Region of interest runs. Working back from `roi` (in output pixels),
+    // each stage's footprint gives the part of its input it needs; stages
+    // before a global one run on the whole image. source_region() is the
+    // part of the source to decode, and run_region() computes `roi` of
+    // run(full source) from `source`, the pixels of that part. The result
+    // matches the full run except where geometry.hpp notes otherwise.
+    cv::Rect source_region(cv::Size input, cv::Rect roi) const;
+    cv::Mat run_region(cv::Mat const &source, cv::Size input, cv::Rect roi) const;
+
+private:
+    // Region each unit must produce, from the source (front) to `roi` (back)
+    std::vector<cv::Rect> region_chain(cv::Size input, cv::Rect roi, std::vector<cv::Size> &sizes) const;
+
+    PipelineSpec _spec;
+    std::string _key;
+    std::unique_ptr<ImageProcessor> _chain;
+    std::vector<RegionStage> _regions;
+    std::function<cv::Mat(cv::Mat const &)> _static;
+    std::string _static_label;
+    bool _yuv_capable = false;
+    std::vector<std::function<void(YuvImage &)>> _yuv;
+    std::string _yuv_label;
+};
+
+// Concurrent map from canonical spec to compiled plan. When full, the least
+// recently used plan is evicted, so one-off specs cannot push out hot ones.
+// Hits only stamp their entry and share the lock; the scan for the oldest
+// entry happens on inserts, which follow a compile anyway.
+class PlanCache
+{
+public:
+    explicit PlanCache(std::size_t capacity = 256);
+
+    std::shared_ptr<PipelinePlan const> get(PipelineSpec spec);
+    std::shared_ptr<PipelinePlan const> get(nlohmann::json const &request);
+
+    nlohmann::json metrics() const;
+
+private:
+    struct Entry
+    {
+        Entry(std::shared_ptr<PipelinePlan const> p, std::uint64_t tick) : plan(std::move(p)), used(tick) {}
+
+        std::shared_ptr<PipelinePlan const> plan;
+        std::atomic<std::uint64_t> used; // _clock at the last lookup
+    };
+
+    std::size_t _capacity;
+    mutable std::shared_mutex _mutex;
+    std::unordered_map<std::string, Entry> _plans;
+    std::atomic<std::uint64_t> _clock{0};
+    std::atomic<std::uint64_t> _hits{0};
+    std::atomic<std::uint64_t> _misses{0};
+};
+
+} // namespace mj
+
+#endif // MJ_PIPELINE_HPP
@@ -0,0 +1,285 @@
+#include "plan-optimizer.hpp"
+#include "processor-registry.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+using json = nlohmann::json;
+using namespace mj;
+
+OptimizeMode mj::parse_optimize_mode(std::string const &name)
+{
+    if (name == "off")
+        return OptimizeMode::Off;
+    if (name == "strict")
+        return OptimizeMode::Strict;
+    if (name == "approx")
+        return OptimizeMode::Approx;
+    throw std::invalid_argument("'optimize' must be \"off\", \"strict\" or \"approx\"");
+}
+
+char const *mj::optimize_mode_name(OptimizeMode mode)
+{
+    switch (mode)
+    {
+    case OptimizeMode::Strict:
+        return "strict";
+    case OptimizeMode::Approx:
+        return "approx";
+    default:
+        return "off";
+    }
+}
+
+namespace {
+
+enum class Swap
+{
+    No,
+    Exact,
+    Approx
+};
+
+StageTraits const &traits_of(StageSpec const &stage)
+{
+    static const StageTraits unknown;
+    StageDefinition const *definition = processor_registry().find(stage.op);
+    return definition ? definition->traits : unknown;
+}
+
+StageKind kind_of(StageSpec const &stage)
+{
+    return traits_of(stage).kind;
+}
+
+// Neighbourhood size, or 0 for stages without one
+int kernel_of(StageSpec const &stage)
+{
+    std::string const &kernel = traits_of(stage).kernel;
+    return kernel.empty() ? 0 : stage.params.at(kernel).get<int>();
+}
+
+// sizes[i] is the input of stage i and sizes.back() the output; Resize is
+// the only stage that changes the size
+std::vector<cv::Size> stage_sizes(PipelineSpec const &spec, cv::Size input)
+{
+    std::vector<cv::Size> sizes{input};
+    for (StageSpec const &stage : spec)
+    {
+        if (stage.op == "Resize")
+            sizes.emplace_back(stage.params.at("width").get<int>(), stage.params.at("height").get<int>());
+        else
+            sizes.push_back(sizes.back());
+    }
+    return sizes;
+}
+
+// The value table a Point stage applies, computed as its processor does
+bool point_table(StageSpec const &stage, std::array<uchar, 256> &table)
+{
+    json const &p = stage.params;
+    for (int v = 0; v < 256; ++v)
+        table[v] = static_cast<uchar>(v);
+
+    if (stage.op == "BrightnessContrast")
+    {
+        cv::Mat row(1, 256, CV_8U, table.data());
+        row.convertTo(row, -1, p.at("contrast").get<double>(), p.at("brightness").get<int>());
+    }
+    else if (stage.op == "GammaCorrection")
+    {
+        double gamma = p.at("gamma").get<double>();
+        for (int v = 0; v < 256; ++v)
+            table[v] = static_cast<uchar>(std::pow(v / 255.0, gamma) * 255.0);
+    }
+    else if (stage.op == "InvertColors")
+    {
+        for (uchar &v : table)
+            v = static_cast<uchar>(255 - v);
+    }
+    else
+        return false;
+    return true;
+}
+
+// Non-decreasing value tables commute exactly with max, min and median filters
+bool monotone(StageSpec const &stage)
+{
+    std::array<uchar, 256> table;
+    if (!point_table(stage, table))
+        return false;
+    return std::is_sorted(table.begin(), table.end());
+}
+
+bool identity(StageSpec const &stage)
+{
+    std::array<uchar, 256> table;
+    if (point_table(stage, table))
+    {
+        for (int v = 0; v < 256; ++v)
+            if (table[v] != v)
+                return false;
+        return true;
+    }
+    // A 1x1 Gaussian, median or rectangle passes pixels through
+    StageKind kind = kind_of(stage);
+    return (kind == StageKind::Linear || kind == StageKind::Rank) && kernel_of(stage) == 1;
+}
+
+// Whether adjacent stages `a`, `b` may run as `b`, `a`
+Swap commutes(StageSpec const &a, StageSpec const &b)
+{
+    StageKind ka = kind_of(a), kb = kind_of(b);
+    auto pair = [&](StageKind x, StageKind y) { return (ka == x && kb == y) || (ka == y && kb == x); };
+
+    if (pair(StageKind::Point, StageKind::Rank))
+        return monotone(ka == StageKind::Point ? a : b) ? Swap::Exact : Swap::No;
+    if (pair(StageKind::Point, StageKind::Geometric) || pair(StageKind::Color, StageKind::Geometric) ||
+        pair(StageKind::Gray, StageKind::Geometric) || pair(StageKind::Gray, StageKind::Linear))
+        return Swap::Approx;
+
+    // Resize against filters whose kernel can follow the scale, and against
+    // whole-image histogram remaps
+    if (a.op == "Resize" || b.op == "Resize")
+    {
+        StageSpec const &other = a.op == "Resize" ? b : a;
+        StageKind kind = kind_of(other);
+        if (((kind == StageKind::Linear || kind == StageKind::Rank) && kernel_of(other) > 0) || kind == StageKind::Histogram)
+            return Swap::Approx;
+    }
+    return Swap::No;
+}
+
+// Odd kernel covering the same part of the scene at `scale` times the size,
+// within the registry's bound
+int scale_kernel(int kernel, double scale)
+{
+    double half = std::min((kernel * scale - 1.0) / 2.0, (MAX_STAGE_KERNEL - 1) / 2.0);
+    int scaled = 2 * static_cast<int>(std::lround(half)) + 1;
+    return std::max(scaled, 1);
+}
+
+// Swaps stages i and i + 1, whose input is `input`. A kernel stage crossing a
+// Resize is scaled to the image it now sees. Returns a description.
+std::string swap_stages(PipelineSpec &spec, std::size_t i, cv::Size input)
+{
+    StageSpec &a = spec[i];
+    StageSpec &b = spec[i + 1];
+    std::string note = b.op + " moved before " + a.op;
+
+    StageSpec *resize = a.op == "Resize" ? &a : b.op == "Resize" ? &b : nullptr;
+    StageSpec *filter = resize == &a ? &b : &a;
+    if (resize && kernel_of(*filter) > 0)
+    {
+        double from = static_cast<double>(input.width) * input.height;
+        double to = static_cast<double>(resize->params.at("width").get<int>()) * resize->params.at("height").get<int>();
+        // A filter moving ahead of the resize sees its output, and the reverse
+        double scale = std::sqrt(resize == &b ? to / from : from / to);
+        std::string const &param = traits_of(*filter).kernel;
+        int kernel = filter->params.at(param).get<int>();
+        int scaled = scale_kernel(kernel, scale);
+        filter->params[param] = scaled;
+        note += " (" + filter->op + " " + param + " " + std::to_string(kernel) + " -> " + std::to_string(scaled) + ")";
+    }
+
+    std::swap(a, b);
+    return note;
+}
+
+// Exact removals; returns true if anything changed
+bool simplify(PipelineSpec &spec, std::vector<std::string> &rewrites)
+{
+    for (std::size_t i = 0; i < spec.size(); ++i)
+    {
+        if (identity(spec[i]))
+        {
+            rewrites.push_back("removed identity " + spec[i].op);
+            spec.erase(spec.begin() + i);
+            return true;
+        }
+        if (i + 1 < spec.size() && spec[i].op == "InvertColors" && spec[i + 1].op == "InvertColors")
+        {
+            rewrites.push_back("removed InvertColors pair");
+            spec.erase(spec.begin() + i, spec.begin() + i + 2);
+            return true;
+        }
+        // Luma of equal B, G and R is that value
+        if (i + 1 < spec.size() && spec[i].op == "Grayscale" && spec[i + 1].op == "Grayscale")
+        {
+            rewrites.push_back("removed repeated Grayscale");
+            spec.erase(spec.begin() + i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+double mj::estimate_cost(PipelineSpec const &spec, cv::Size input)
+{
+    std::vector<cv::Size> sizes = stage_sizes(spec, input);
+    double total = 0.0;
+    double planes = 3.0;
+    for (std::size_t i = 0; i < spec.size(); ++i)
+    {
+        StageTraits const &traits = traits_of(spec[i]);
+        double ns = traits.cost ? traits.cost(spec[i].params) : 1.0;
+        double pixels = static_cast<double>(sizes[i + 1].width) * sizes[i + 1].height;
+        // From Grayscale on PipelinePlan works on one plane, until a stage
+        // makes colour again
+        total += ns * pixels * (traits.kind == StageKind::Gray ? 1.0 : planes / 3.0);
+        if (traits.kind == StageKind::Gray)
+            planes = 1.0;
+        else if (traits.kind == StageKind::Color)
+            planes = 3.0;
+    }
+    return total;
+}
+
+OptimizedPipeline mj::optimize_pipeline(PipelineSpec spec, cv::Size input, OptimizeMode mode)
+{
+    OptimizedPipeline result;
+    result.cost_before = estimate_cost(spec, input);
+    if (mode != OptimizeMode::Off && input.width > 0 && input.height > 0)
+    {
+        while (simplify(spec, result.rewrites))
+        {
+        }
+
+        // Hill climbing over adjacent swaps. Every accepted swap lowers the
+        // cost, so this ends; the pass limit bounds it for long lists.
+        double best = estimate_cost(spec, input);
+        bool improved = true;
+        for (std::size_t pass = 0; improved && pass < spec.size() * spec.size(); ++pass)
+        {
+            improved = false;
+            for (std::size_t i = 0; i + 1 < spec.size(); ++i)
+            {
+                Swap swap = commutes(spec[i], spec[i + 1]);
+                if (swap == Swap::No || (swap == Swap::Approx && mode != OptimizeMode::Approx))
+                    continue;
+
+                PipelineSpec candidate = spec;
+                std::string note = swap_stages(candidate, i, stage_sizes(spec, input)[i]);
+                double cost = estimate_cost(candidate, input);
+                if (cost < best * (1.0 - 1e-9))
+                {
+                    spec = std::move(candidate);
+                    best = cost;
+                    improved = true;
+                    result.rewrites.push_back(std::move(note));
+                }
+            }
+        }
+
+        // Scaled kernels may have become 1
+        while (simplify(spec, result.rewrites))
+        {
+        }
+    }
+    result.cost_after = estimate_cost(spec, input);
+    result.spec = std::move(spec);
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef MJ_PLAN_OPTIMIZER_HPP
+#define MJ_PLAN_OPTIMIZER_HPP
+
+#include <opencv2/core.hpp>
+#include <string>
+#include <vector>
+#include "pipeline.hpp"
+
+namespace mj {
+
+// Cost-based rewriting of a stage list for one input size, using the
+// registry's per-stage cost model and stage kinds (processor-registry.hpp).
+//
+// Strict applies only rewrites that leave every output pixel unchanged:
+// dropping identity stages (a value table that maps every value to itself,
+// a 1-pixel kernel, a repeated Grayscale, two InvertColors in a row) and
+// swapping monotone value tables with rank filters. Approx also swaps stages
+// that commute up to rounding and interpolation: value tables, Sepia and
+// Grayscale with geometric stages, Grayscale with linear filters, and Resize
+// with neighbourhood filters (their kernels scaled by the resize factor) and
+// histogram stages. A swap is kept only when it lowers the estimated cost.
+enum class OptimizeMode
+{
+    Off,
+    Strict,
+    Approx
+};
+
+// "off", "strict" or "approx"; throws std::invalid_argument otherwise
+OptimizeMode parse_optimize_mode(std::string const &name);
+char const *optimize_mode_name(OptimizeMode mode);
+
+// Estimated ns to run `spec` on one thread over 8-bit BGR of size `input`
+double estimate_cost(PipelineSpec const &spec, cv::Size input);
+
+struct OptimizedPipeline
+{
+    PipelineSpec spec;
+    double cost_before = 0.0; // estimate_cost of the original, ns
+    double cost_after = 0.0;
+    std::vector<std::string> rewrites; // in the order applied
+};
+
+OptimizedPipeline optimize_pipeline(PipelineSpec spec, cv::Size input, OptimizeMode mode);
+
+} // namespace mj
+
+#endif // MJ_PLAN_OPTIMIZER_HPP
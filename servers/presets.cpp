@@ -0,0 +1,94 @@
+#include "presets.hpp"
+#include "static-pipeline.hpp"
+#include <stdexcept>
+#include <utility>
+
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+struct Recipe
+{
+    std::vector<std::string> ops;
+    StaticRunner (*bind)(PipelineSpec const &spec);
+};
+
+template <typename... Stages, std::size_t... I>
+StaticRunner bind_stages(PipelineSpec const &spec, std::index_sequence<I...>)
+{
+    StaticPipeline<Stages...> pipeline(Stages(spec[I].params)...);
+    return [pipeline](cv::Mat const &image) { return pipeline.run(image); };
+}
+
+template <typename... Stages>
+Recipe recipe()
+{
+    return {{Stages::op...}, [](PipelineSpec const &spec) { return bind_stages<Stages...>(spec, std::index_sequence_for<Stages...>()); }};
+}
+
+// The hot recipes, matched by op sequence. The legacy request form gives
+// stages in registry order (processor-registry.cpp).
+std::vector<Recipe> const &recipes()
+{
+    using namespace stage;
+    static const std::vector<Recipe> all = {
+        recipe<Grayscale, Resize, Blur>(),
+        recipe<Grayscale, Resize>(),
+        recipe<Resize, Blur>(),
+        recipe<Resize, Sharpen>(),
+        recipe<Resize, Sharpen, Watermark>(),
+        recipe<Resize, Watermark>(),
+        recipe<Resize, BrightnessContrast, GammaCorrection>(),
+        recipe<BrightnessContrast, GammaCorrection>(),
+        recipe<Grayscale, BrightnessContrast>(),
+    };
+    return all;
+}
+
+} // namespace
+
+StaticRunner mj::compile_static(PipelineSpec const &spec)
+{
+    for (Recipe const &recipe : recipes())
+    {
+        if (recipe.ops.size() != spec.size())
+            continue;
+        bool same = true;
+        for (std::size_t i = 0; i < spec.size() && same; ++i)
+            same = recipe.ops[i] == spec[i].op;
+        if (same)
+            return recipe.bind(spec);
+    }
+    return nullptr;
+}
+
+std::vector<std::string> mj::static_recipes()
+{
+    std::vector<std::string> names;
+    for (Recipe const &recipe : recipes())
+    {
+        std::string name;
+        for (std::string const &op : recipe.ops)
+            name += (name.empty() ? "" : "+") + op;
+        names.push_back(std::move(name));
+    }
+    return names;
+}
+
+void mj::apply_preset(json &request, json const &presets)
+{
+    auto it = request.find("preset");
+    if (it == request.end() || it->is_null())
+        return;
+    if (!it->is_string())
+        throw std::invalid_argument("'preset' must be a string");
+
+    std::string name = it->get<std::string>();
+    auto preset = presets.find(name);
+    if (preset == presets.end())
+        throw std::invalid_argument("Unknown preset '" + name + "'");
+    request.erase("preset");
+    for (auto const &[key, value] : preset->items())
+        request[key] = value;
+}
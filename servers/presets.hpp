@@ -0,0 +1,32 @@
+#ifndef MJ_PRESETS_HPP
+#define MJ_PRESETS_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include "pipeline.hpp"
+
+namespace mj {
+
+using StaticRunner = std::function<cv::Mat(cv::Mat const &)>;
+
+// A StaticPipeline for `spec` when its stage sequence is one of the
+// compiled-in recipes (parameters are taken from the spec), else empty.
+// PipelinePlan calls this for every plan it compiles.
+StaticRunner compile_static(PipelineSpec const &spec);
+
+// Compiled-in stage sequences, e.g. "Grayscale+Resize+Blur"
+std::vector<std::string> static_recipes();
+
+// Named presets: request fragments loaded from --presets, e.g.
+//   {"thumb": {"ConvertColorToGray": true, "Resize": {"width": 320, "height": 240}}}
+// A request with "preset": "thumb" gets the preset's keys, replacing its own
+// keys of the same name; "roi", "outputs" and the image are left alone.
+// Throws std::invalid_argument for an unknown preset.
+void apply_preset(nlohmann::json &request, nlohmann::json const &presets);
+
+} // namespace mj
+
+#endif // MJ_PRESETS_HPP
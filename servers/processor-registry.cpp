@@ -0,0 +1,247 @@
+#include "processor-registry.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+using json = nlohmann::json;
+using namespace mj;
+
+void ProcessorRegistry::add(StageDefinition definition)
+{
+    if (_index.count(definition.op))
+        throw std::invalid_argument("Stage " + definition.op + " is already registered");
+    for (StageDefinition const &existing : _definitions)
+        if (existing.legacy_key == definition.legacy_key)
+            throw std::invalid_argument("Request field " + definition.legacy_key + " is already registered");
+
+    _index.emplace(definition.op, _definitions.size());
+    _definitions.push_back(std::move(definition));
+}
+
+StageDefinition const *ProcessorRegistry::find(std::string const &op) const
+{
+    auto it = _index.find(op);
+    return it == _index.end() ? nullptr : &_definitions[it->second];
+}
+
+std::optional<json> ProcessorRegistry::normalize(StageDefinition const &definition, json const &raw, bool strict) const
+{
+    using Type = StageParam::Type;
+
+    if (strict)
+    {
+        for (auto const &[key, value] : raw.items())
+        {
+            bool known = std::any_of(definition.params.begin(), definition.params.end(), [&](StageParam const &p) { return p.name == key; });
+            if (!known)
+                throw std::invalid_argument("unknown parameter '" + key + "'");
+        }
+    }
+
+    json params = json::object();
+    for (StageParam const &param : definition.params)
+    {
+        auto it = raw.find(param.name);
+        json const &value = it != raw.end() ? *it : param.fallback;
+        if (value.is_null())
+        {
+            if (strict)
+                throw std::invalid_argument("'" + param.name + "' is required");
+            return std::nullopt;
+        }
+
+        double measure;
+        if (param.type == Type::String)
+        {
+            if (strict && !value.is_string())
+                throw std::invalid_argument("'" + param.name + "' must be a string");
+            std::string text = value.get<std::string>();
+            measure = static_cast<double>(text.size());
+            params[param.name] = std::move(text);
+        }
+        else if (param.type == Type::Int)
+        {
+            if (strict && !value.is_number_integer())
+                throw std::invalid_argument("'" + param.name + "' must be an integer");
+            int number = value.get<int>();
+            measure = number;
+            params[param.name] = number;
+        }
+        else
+        {
+            if (strict && !value.is_number())
+                throw std::invalid_argument("'" + param.name + "' must be a number");
+            double number = value.get<double>();
+            measure = number;
+            params[param.name] = number;
+        }
+
+        if (param.min && measure < *param.min)
+        {
+            if (!strict)
+                return std::nullopt;
+            if (param.type == Type::String)
+                throw std::invalid_argument("'" + param.name + "' must not be empty");
+            char bound[32];
+            std::snprintf(bound, sizeof(bound), "%g", *param.min);
+            throw std::invalid_argument("'" + param.name + "' must be at least " + bound);
+        }
+        if (param.max && measure > *param.max)
+        {
+            char bound[32];
+            std::snprintf(bound, sizeof(bound), "%g", *param.max);
+            throw std::invalid_argument("'" + param.name + "' must be at most " + bound + (param.type == Type::String ? " bytes" : ""));
+        }
+    }
+    return params;
+}
+
+std::unique_ptr<ImageProcessor> ProcessorRegistry::wrap(std::unique_ptr<ImageProcessor> inner, StageSpec const &stage) const
+{
+    StageDefinition const *definition = find(stage.op);
+    if (!definition)
+        throw std::invalid_argument("Unknown pipeline stage: " + stage.op);
+    return definition->make(std::move(inner), stage.params);
+}
+
+// -----------------------------------------------------------------------------
+// Built-in stages, in legacy order
+// -----------------------------------------------------------------------------
+
+namespace {
+
+using Type = StageParam::Type;
+using Kind = StageKind;
+using Inner = std::unique_ptr<ImageProcessor>;
+
+// Upper bounds keep what compiling a stage allocates (masks, the static
+// pipeline probe) small: plans are compiled before a request's memory is
+// reserved. Resize sides are also capped so no request asks for a huge frame.
+constexpr double MAX_RESIZE = 16384;
+
+// Costs are ns per output pixel of a 1920x1080 BGR frame on one thread
+// (OpenCV 4/5, x86-64 with AVX2). Only their ratios matter to the optimizer.
+StageTraits traits(Kind kind, double ns, std::string kernel = std::string())
+{
+    return {kind, [ns](json const &) { return ns; }, std::move(kernel)};
+}
+
+// Cost growing linearly with the kernel side, as separable and van Herk filters do
+StageTraits kernel_traits(Kind kind, double ns, double ns_per_step, std::string kernel)
+{
+    return {kind, [=](json const &p) { return ns + ns_per_step * p.at(kernel).get<int>(); }, kernel};
+}
+
+// A stage with no parameters, enabled by `"<key>": true`
+template <typename Processor>
+StageDefinition flag_stage(std::string op, std::string key, StageTraits traits)
+{
+    return {std::move(op), std::move(key), true, {}, [](Inner inner, json const &) -> Inner { return std::make_unique<Processor>(std::move(inner)); },
+            std::move(traits)};
+}
+
+// Structuring-element size of the morphology stages
+StageParam kernel_param()
+{
+    return {"kernel", Type::Int, nullptr, 1.0, MAX_STAGE_KERNEL};
+}
+
+StageDefinition morphology_stage(std::string op, std::string key, int operation, StageTraits traits)
+{
+    return {std::move(op), std::move(key), false, {kernel_param()}, [operation](Inner inner, json const &p) -> Inner {
+                return std::make_unique<MorphologyProcessor>(std::move(inner), operation, p.at("kernel").get<int>());
+            },
+            std::move(traits)};
+}
+
+// medianBlur switches from a sorting network to per-pixel histograms above 5x5
+double median_cost(json const &p)
+{
+    int kernel = p.at("kernel").get<int>();
+    return kernel <= 3 ? 0.7 : kernel <= 5 ? 5.2 : 100.0;
+}
+
+void register_builtins(ProcessorRegistry &registry)
+{
+    registry.add(flag_stage<GrayscaleProcessor>("Grayscale", "ConvertColorToGray", traits(Kind::Gray, 0.7)));
+    registry.add({"Resize", "Resize", false, {{"width", Type::Int, nullptr, 1.0, MAX_RESIZE}, {"height", Type::Int, nullptr, 1.0, MAX_RESIZE}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<ResizeProcessor>(std::move(inner), p.at("width").get<int>(), p.at("height").get<int>());
+                  },
+                  traits(Kind::Geometric, 2.5)});
+    registry.add({"Blur", "Blur", false, {{"kernel_size", Type::Int, nullptr, 1.0, MAX_STAGE_KERNEL}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<BlurProcessor>(std::move(inner), p.at("kernel_size").get<int>());
+                  },
+                  kernel_traits(Kind::Linear, 3.0, 0.4, "kernel_size")});
+    registry.add(flag_stage<EdgeDetectionProcessor>("DetectEdges", "DetectEdges", traits(Kind::Fixed, 3.5)));
+    registry.add({"Rotate", "RotateImage", false, {{"angle", Type::Number, 0.0, std::nullopt}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<RotateProcessor>(std::move(inner), p.at("angle").get<double>());
+                  },
+                  traits(Kind::Geometric, 13.0)});
+    registry.add({"BrightnessContrast", "AdjustBrightnessContrast", false,
+                  {{"brightness", Type::Int, 0, std::nullopt}, {"contrast", Type::Number, 1.0, std::nullopt}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<BrightnessContrastProcessor>(std::move(inner), p.at("brightness").get<int>(), p.at("contrast").get<double>());
+                  },
+                  traits(Kind::Point, 0.8)});
+    registry.add(flag_stage<SharpenProcessor>("Sharpen", "ApplySharpening", traits(Kind::Linear, 2.5)));
+    registry.add(flag_stage<EqualizeHistogramProcessor>("EqualizeHistogram", "EqualizeHistogram", traits(Kind::Histogram, 3.0)));
+    registry.add({"GammaCorrection", "ApplyGammaCorrection", false, {{"gamma", Type::Number, 1.0, std::nullopt}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<GammaCorrectionProcessor>(std::move(inner), p.at("gamma").get<double>());
+                  },
+                  traits(Kind::Point, 1.3)});
+    registry.add({"Watermark", "ApplyWatermark", false, {{"text", Type::String, nullptr, 1.0, MAX_OVERLAY_TEXT}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<WatermarkProcessor>(std::move(inner), p.at("text").get<std::string>());
+                  },
+                  traits(Kind::Fixed, 0.4)});
+    registry.add(flag_stage<ColorInversionProcessor>("InvertColors", "InvertColors", traits(Kind::Point, 0.8)));
+    registry.add(flag_stage<SepiaProcessor>("Sepia", "ApplySepia", traits(Kind::Color, 0.7)));
+    registry.add({"MedianBlur", "ApplyMedianBlur", false, {kernel_param()}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<MedianBlurProcessor>(std::move(inner), p.at("kernel").get<int>());
+                  },
+                  {Kind::Rank, median_cost, "kernel"}});
+    registry.add(flag_stage<HistogramStretchProcessor>("StretchHistogram", "StretchHistogram", traits(Kind::Histogram, 0.8)));
+    registry.add({"UnsharpMask", "ApplyUnsharpMask", false, {{"strength", Type::Number, 1.0, std::nullopt}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<UnsharpMaskProcessor>(std::move(inner), p.at("strength").get<double>());
+                  },
+                  traits(Kind::Linear, 10.0)});
+    registry.add({"Dilation", "ApplyDilation", false, {kernel_param()}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<DilationProcessor>(std::move(inner), p.at("kernel").get<int>());
+                  },
+                  kernel_traits(Kind::Rank, 0.6, 0.06, "kernel")});
+    registry.add({"Erosion", "ApplyErosion", false, {kernel_param()}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<ErosionProcessor>(std::move(inner), p.at("kernel").get<int>());
+                  },
+                  kernel_traits(Kind::Rank, 0.6, 0.06, "kernel")});
+    registry.add(morphology_stage("Opening", "ApplyOpening", MORPH_OPEN, kernel_traits(Kind::Rank, 0.9, 0.11, "kernel")));
+    registry.add(morphology_stage("Closing", "ApplyClosing", MORPH_CLOSE, kernel_traits(Kind::Rank, 0.9, 0.11, "kernel")));
+    registry.add(morphology_stage("MorphGradient", "ApplyMorphGradient", MORPH_GRADIENT, kernel_traits(Kind::Fixed, 1.3, 0.12, "kernel")));
+    registry.add({"CLAHE", "ApplyCLAHE", false, {{"clip_limit", Type::Number, 2.0, std::nullopt}}, [](Inner inner, json const &p) -> Inner {
+                      return std::make_unique<CLAHEProcessor>(std::move(inner), p.at("clip_limit").get<double>());
+                  },
+                  traits(Kind::Histogram, 6.0)});
+    // Last, so legacy requests draw it over everything else
+    registry.add({"Overlay", "ApplyOverlay", false,
+                  {{"text", Type::String, "", std::nullopt, MAX_OVERLAY_TEXT},
+                   {"logo", Type::String, "", std::nullopt},
+                   {"scale", Type::Number, 1.0, 0.05},
+                   {"relative", Type::Number, 0.0, 0.0},
+                   {"thickness", Type::Int, 2, 1.0},
+                   {"color", Type::String, "#ffffff", std::nullopt},
+                   {"opacity", Type::Number, 1.0, 0.0},
+                   {"position", Type::String, "bottom-left", std::nullopt},
+                   {"margin", Type::Int, 10, 0.0},
+                   {"spacing", Type::Int, 100, 0.0}},
+                  [](Inner inner, json const &p) -> Inner { return std::make_unique<OverlayProcessor>(std::move(inner), p); },
+                  traits(Kind::Fixed, 0.3)});
+}
+
+} // namespace
+
+ProcessorRegistry &mj::processor_registry()
+{
+    static ProcessorRegistry registry = [] {
+        ProcessorRegistry builtins;
+        register_builtins(builtins);
+        return builtins;
+    }();
+    return registry;
+}
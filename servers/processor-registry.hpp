@@ -0,0 +1,108 @@
+#ifndef MJ_PROCESSOR_REGISTRY_HPP
+#define MJ_PROCESSOR_REGISTRY_HPP
+
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "image-processor.hpp"
+#include "pipeline.hpp"
+
+namespace mj {
+
+// Largest Blur kernel_size and morphology or median kernel. Beyond it a filter
+// is no longer local, and the blur's box widths grow without bound.
+constexpr int MAX_STAGE_KERNEL = 1023;
+
+// One parameter of a stage. A null `fallback` makes it required. Numbers
+// below `min`, or strings shorter than it, make the stage invalid; numbers
+// above `max`, or strings longer than it, are always rejected.
+struct StageParam
+{
+    enum class Type
+    {
+        Int,
+        Number,
+        String
+    };
+
+    std::string name;
+    Type type;
+    nlohmann::json fallback;
+    std::optional<double> min;
+    std::optional<double> max = std::nullopt;
+};
+
+// What a stage does to pixels, which decides what it may be reordered with
+// (plan-optimizer.cpp)
+enum class StageKind
+{
+    Point,     // maps each channel value independently (a value table)
+    Color,     // maps each pixel's BGR triple
+    Gray,      // BGR to luma
+    Geometric, // moves pixels
+    Linear,    // linear neighbourhood filter
+    Rank,      // order-statistic neighbourhood filter
+    Histogram, // remaps values from whole-image statistics
+    Fixed      // depends on position or scale; never moved
+};
+
+// Optimizer traits of a stage
+struct StageTraits
+{
+    StageKind kind = StageKind::Fixed;
+    // ns per output pixel of 8-bit BGR on one thread, from the parameters
+    std::function<double(nlohmann::json const &params)> cost;
+    // Neighbourhood size parameter that scales with the image, if any
+    std::string kernel;
+};
+
+using StageFactory = std::function<std::unique_ptr<ImageProcessor>(std::unique_ptr<ImageProcessor> inner, nlohmann::json const &params)>;
+
+struct StageDefinition
+{
+    std::string op;         // name in "pipeline" arrays and plan keys
+    std::string legacy_key; // request field of the fixed-order form
+    bool flag = false;      // the legacy field is `true` rather than a parameter object
+    std::vector<StageParam> params;
+    StageFactory make;
+    StageTraits traits;
+};
+
+// Op name -> parameters and decorator factory. Registration order is the
+// stage order of legacy requests. Add stages before serving; lookups are
+// not synchronized with add().
+class ProcessorRegistry
+{
+public:
+    // Throws std::invalid_argument for a duplicate op or legacy key
+    void add(StageDefinition definition);
+
+    StageDefinition const *find(std::string const &op) const;
+    std::vector<StageDefinition> const &definitions() const { return _definitions; }
+
+    // Parameters with defaults filled in and unknown fields dropped. When
+    // strict, an unknown field, a wrong type, a non-integer Int or a missing
+    // or too small value throws std::invalid_argument. Otherwise a missing or
+    // too small value gives nullopt (the legacy form skips the stage) and a
+    // wrong type throws nlohmann::json::exception. A too large value throws
+    // std::invalid_argument either way.
+    std::optional<nlohmann::json> normalize(StageDefinition const &definition, nlohmann::json const &raw, bool strict) const;
+
+    // Throws std::invalid_argument for an unknown op
+    std::unique_ptr<ImageProcessor> wrap(std::unique_ptr<ImageProcessor> inner, StageSpec const &stage) const;
+
+private:
+    std::vector<StageDefinition> _definitions;
+    std::unordered_map<std::string, std::size_t> _index;
+};
+
+// The process-wide registry, holding the built-in stages
+ProcessorRegistry &processor_registry();
+
+} // namespace mj
+
+#endif // MJ_PROCESSOR_REGISTRY_HPP
@@ -0,0 +1,99 @@
+#include "region-decode.hpp"
+#include "jpeg-support.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+
+using namespace mj;
+
+#ifdef MJ_HAVE_JPEG_CROP
+
+namespace {
+
+// False when the image should go through cv::imdecode instead
+bool decode_jpeg_region(std::vector<unsigned char> const &data, std::function<cv::Rect(cv::Size)> const &region_for, cv::Mat &out)
+{
+    // Declared before setjmp so a decode error does not skip its destructor
+    cv::Mat rows;
+    jpeg_decompress_struct cinfo;
+    JpegError error;
+    cinfo.err = quiet_jpeg_errors(error);
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data.data()), static_cast<unsigned long>(data.size()));
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // imdecode rotates by EXIF orientation, and converts CMYK itself
+    if (exif_orientation(cinfo) > 1 || cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cv::Size full(static_cast<int>(cinfo.image_width), static_cast<int>(cinfo.image_height));
+    cv::Rect region = region_for(full) & cv::Rect(cv::Point(), full);
+    if (region.empty())
+    {
+        jpeg_destroy_decompress(&cinfo);
+        out = cv::Mat();
+        return true;
+    }
+
+    cinfo.out_color_space = JCS_EXT_BGR;
+    jpeg_start_decompress(&cinfo);
+
+    // Chroma upsampling at a crop edge replicates instead of reading the
+    // neighbouring iMCU, so keep one iMCU of margin on each side. The crop is
+    // then widened to whole iMCU columns.
+    int margin = cinfo.max_h_samp_factor * DCTSIZE;
+    int left = std::max(0, region.x - margin);
+    int right = std::min(full.width, region.br().x + margin);
+    JDIMENSION x = static_cast<JDIMENSION>(left);
+    JDIMENSION width = static_cast<JDIMENSION>(right - left);
+    jpeg_crop_scanline(&cinfo, &x, &width);
+
+    rows.create(region.height, static_cast<int>(width), CV_8UC3);
+    if (region.y > 0)
+        jpeg_skip_scanlines(&cinfo, static_cast<JDIMENSION>(region.y));
+    while (cinfo.output_scanline < static_cast<JDIMENSION>(region.br().y))
+    {
+        JSAMPROW row = rows.ptr<unsigned char>(static_cast<int>(cinfo.output_scanline) - region.y);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    out = rows(cv::Rect(region.x - static_cast<int>(x), 0, region.width, region.height));
+    return true;
+}
+
+} // namespace
+
+#endif
+
+cv::Mat mj::decode_region(std::vector<unsigned char> const &data, std::function<cv::Rect(cv::Size)> const &region_for)
+{
+    if (data.empty())
+        return cv::Mat();
+
+#ifdef MJ_HAVE_JPEG_CROP
+    if (data.size() > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+    {
+        cv::Mat region;
+        if (decode_jpeg_region(data, region_for, region))
+            return region;
+    }
+#endif
+
+    cv::Mat buf(1, static_cast<int>(data.size()), CV_8U, const_cast<unsigned char *>(data.data()));
+    cv::Mat image = cv::imdecode(buf, cv::IMREAD_COLOR);
+    if (image.empty())
+        return image;
+    cv::Rect region = region_for(image.size()) & cv::Rect(cv::Point(), image.size());
+    return region.empty() ? cv::Mat() : image(region);
+}
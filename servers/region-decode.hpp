@@ -0,0 +1,24 @@
+#ifndef MJ_REGION_DECODE_HPP
+#define MJ_REGION_DECODE_HPP
+
+#include <opencv2/core.hpp>
+#include <functional>
+#include <vector>
+
+namespace mj {
+
+// Decodes the part of an encoded image that `region_for` asks for, given the
+// full image size. The result is what cv::imdecode(IMREAD_COLOR) would give,
+// cropped to that region (intersected with the image); empty on failure.
+// `region_for` may be called twice when a JPEG falls back to cv::imdecode.
+//
+// With libjpeg-turbo (MJ_HAVE_JPEG_CROP) a baseline or progressive JPEG is
+// decoded only from the first needed row to the last, and only across the
+// iMCU columns that overlap the region plus one either side, so decode cost
+// follows the region's area. JPEGs with a non-default EXIF orientation or CMYK data, and all other
+// formats, are decoded whole and a view of the region is returned.
+cv::Mat decode_region(std::vector<unsigned char> const &data, std::function<cv::Rect(cv::Size)> const &region_for);
+
+} // namespace mj
+
+#endif // MJ_REGION_DECODE_HPP
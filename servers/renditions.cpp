@@ -0,0 +1,136 @@
+#include "renditions.hpp"
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+using json = nlohmann::json;
+using namespace mj;
+
+// Upper bound on outputs per request
+static constexpr std::size_t MAX_RENDITIONS = 16;
+
+std::vector<RenditionSpec> mj::parse_renditions(json const &request, PlanCache &plans)
+{
+    std::vector<RenditionSpec> specs;
+    auto it = request.find("outputs");
+    if (it == request.end() || it->is_null())
+        return specs;
+    if (!it->is_object() || it->empty())
+        throw std::invalid_argument("'outputs' must be a non-empty object");
+    if (it->size() > MAX_RENDITIONS)
+        throw std::invalid_argument("At most " + std::to_string(MAX_RENDITIONS) + " outputs per request");
+
+    for (auto const &[name, output] : it->items())
+    {
+        if (!output.is_object())
+            throw std::invalid_argument("Output '" + name + "' must be an object");
+
+        RenditionSpec spec;
+        spec.name = name;
+        spec.width = output.value("width", 0);
+        spec.height = output.value("height", 0);
+        if (spec.width < 0 || spec.height < 0)
+            throw std::invalid_argument("Output '" + name + "' has a negative size");
+        spec.tail = plans.get(output);
+
+        std::string format = output.value("format", std::string("jpg"));
+        int quality = output.value("quality", 95);
+        if (quality < 1 || quality > 100)
+            throw std::invalid_argument("Output '" + name + "' quality must be 1-100");
+        if (format == "jpg" || format == "jpeg")
+            spec.params = {cv::IMWRITE_JPEG_QUALITY, quality};
+        else if (format == "webp")
+            spec.params = {cv::IMWRITE_WEBP_QUALITY, quality};
+        else if (format != "png")
+            throw std::invalid_argument("Output '" + name + "' format must be jpg, png or webp");
+        spec.extension = "." + (format == "jpeg" ? std::string("jpg") : format);
+
+        specs.push_back(std::move(spec));
+    }
+    return specs;
+}
+
+// Missing dimensions follow the base's aspect ratio, saturated so an extreme
+// ratio cannot overflow int; oversized_rendition() refuses such sizes
+cv::Size mj::rendition_size(RenditionSpec const &spec, cv::Size base)
+{
+    auto scaled = [](double value) { return static_cast<int>(std::clamp(std::round(value), 1.0, 1073741824.0)); };
+    if (spec.width > 0 && spec.height > 0)
+        return cv::Size(spec.width, spec.height);
+    if (spec.width > 0)
+        return cv::Size(spec.width, scaled(static_cast<double>(base.height) * spec.width / base.width));
+    if (spec.height > 0)
+        return cv::Size(scaled(static_cast<double>(base.width) * spec.height / base.height), spec.height);
+    return base;
+}
+
+RenditionSpec const *mj::oversized_rendition(std::vector<RenditionSpec> const &specs, cv::Size base, std::size_t max_pixels)
+{
+    for (RenditionSpec const &spec : specs)
+    {
+        cv::Size size = rendition_size(spec, base);
+        if (static_cast<double>(size.width) * size.height > static_cast<double>(max_pixels))
+            return &spec;
+    }
+    return nullptr;
+}
+
+std::vector<Rendition> mj::render(cv::Mat const &base, std::vector<RenditionSpec> const &specs)
+{
+    std::vector<cv::Size> sizes(specs.size());
+    for (std::size_t i = 0; i < specs.size(); ++i)
+        sizes[i] = rendition_size(specs[i], base.size());
+
+    // Resize largest first, each from the smallest level at least twice its size
+    std::vector<std::size_t> order(specs.size());
+    std::iota(order.begin(), order.end(), std::size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return sizes[a].area() > sizes[b].area(); });
+
+    std::vector<cv::Mat> resized(specs.size());
+    std::vector<cv::Mat> levels{base};
+    for (std::size_t i : order)
+    {
+        cv::Size size = sizes[i];
+        if (size == base.size())
+        {
+            resized[i] = base;
+            continue;
+        }
+        if (size.width > base.cols || size.height > base.rows)
+        {
+            cv::resize(base, resized[i], size, 0, 0, cv::INTER_LINEAR);
+            continue;
+        }
+
+        cv::Mat const *source = &base;
+        for (cv::Mat const &level : levels)
+            if (level.cols >= 2 * size.width && level.rows >= 2 * size.height && level.total() < source->total())
+                source = &level;
+        cv::resize(*source, resized[i], size, 0, 0, cv::INTER_AREA);
+        levels.push_back(resized[i]);
+    }
+
+    std::vector<Rendition> out(specs.size());
+    std::vector<std::string> errors(specs.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(specs.size())), [&](cv::Range const &range) {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            RenditionSpec const &spec = specs[i];
+            cv::Mat image = spec.tail->run(resized[i]);
+            out[i].name = spec.name;
+            out[i].format = spec.extension.substr(1);
+            out[i].size = image.size();
+            if (!cv::imencode(spec.extension, image, out[i].encoded, spec.params))
+                errors[i] = "Failed to encode output '" + spec.name + "'";
+        }
+    });
+
+    for (std::string const &error : errors)
+        if (!error.empty())
+            throw std::runtime_error(error);
+    return out;
+}
@@ -0,0 +1,62 @@
+#ifndef MJ_RENDITIONS_HPP
+#define MJ_RENDITIONS_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "pipeline.hpp"
+
+namespace mj {
+
+// Several named outputs from one upload. The request's own stages are the
+// shared prefix; each entry of "outputs" adds a size, its own tail stages
+// (same keys as the request body), and an encoding:
+//
+//   "outputs": {
+//     "thumb":   {"width": 160, "format": "webp", "quality": 70},
+//     "preview": {"width": 800, "ApplySharpening": true, "quality": 85},
+//     "full":    {"format": "png"}
+//   }
+//
+// Giving only width or height keeps the aspect ratio. Downscaled sizes are
+// built largest first, each from the smallest size already built that is at
+// least twice as large (INTER_AREA), so small renditions do not resample the
+// full frame. Tails and encoders run in parallel.
+struct RenditionSpec
+{
+    std::string name;
+    int width = 0;  // 0 = from the aspect ratio, or the prefix output's
+    int height = 0;
+    std::shared_ptr<PipelinePlan const> tail;
+    std::string extension;      // ".jpg", ".png", ".webp"
+    std::vector<int> params;    // cv::imwrite flags
+};
+
+struct Rendition
+{
+    std::string name;
+    std::string format;
+    cv::Size size;
+    std::vector<unsigned char> encoded;
+};
+
+// Empty if the request has no "outputs". Throws std::invalid_argument or
+// nlohmann::json::exception when malformed.
+std::vector<RenditionSpec> parse_renditions(nlohmann::json const &request, PlanCache &plans);
+
+// Size of `spec`'s output before its tail, from a prefix output of `base`
+cv::Size rendition_size(RenditionSpec const &spec, cv::Size base);
+
+// The first output of more than `max_pixels` from a prefix output of `base`,
+// or nullptr
+RenditionSpec const *oversized_rendition(std::vector<RenditionSpec> const &specs, cv::Size base, std::size_t max_pixels);
+
+// Throws std::runtime_error if an output cannot be encoded
+std::vector<Rendition> render(cv::Mat const &base, std::vector<RenditionSpec> const &specs);
+
+} // namespace mj
+
+#endif // MJ_RENDITIONS_HPP
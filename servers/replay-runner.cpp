@@ -0,0 +1,252 @@
+#include "replay-runner.hpp"
+#include "bounded-queue.hpp"
+#include "capture.hpp"
+#include "pipeline.hpp"
+#include "threading.hpp"
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <cppcodec/base64_rfc4648.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using base64 = cppcodec::base64_rfc4648;
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+using namespace mj;
+
+namespace {
+
+struct Job
+{
+    CaptureRecord record;
+    Clock::time_point scheduled;
+};
+
+struct Sample
+{
+    bool ok;
+    double latency_ms;
+    double service_ms;
+};
+
+double ms_between(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+double percentile(std::vector<double> &values, double q)
+{
+    if (values.empty())
+        return 0;
+    std::size_t k = std::min(values.size() - 1, static_cast<std::size_t>(q * static_cast<double>(values.size())));
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(k), values.end());
+    return values[k];
+}
+
+// Same work as the server's request handler, minus HTTP and base64
+bool run_in_process(PlanCache &plans, CaptureRecord const &record)
+{
+    cv::Mat buf(1, static_cast<int>(record.image.size()), CV_8U, const_cast<unsigned char *>(record.image.data()));
+    cv::Mat image = cv::imdecode(buf, cv::IMREAD_COLOR);
+    if (image.empty())
+        return false;
+
+    std::shared_ptr<PipelinePlan const> plan;
+    try
+    {
+        plan = plans.get(record.pipeline);
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    cv::Mat processed;
+    {
+        IntraOpScope threads(image.total());
+        processed = plan->run(image);
+    }
+    std::vector<unsigned char> out;
+    return cv::imencode(".jpg", processed, out);
+}
+
+// One keep-alive connection per worker, reopened after any error
+class HttpReplayer
+{
+public:
+    HttpReplayer(net::io_context &ioc, tcp::resolver::results_type const &endpoints, std::string host)
+        : _stream(ioc), _endpoints(endpoints), _host(std::move(host)) {}
+
+    bool send(CaptureRecord const &record)
+    {
+        json body = record.pipeline;
+        body["img"] = base64::encode(record.image);
+
+        http::request<http::string_body> req{http::verb::post, "/", 11};
+        req.set(http::field::host, _host);
+        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        req.set(http::field::content_type, "application/json");
+        if (!record.tenant.empty())
+            req.set("X-Tenant-ID", record.tenant);
+        req.keep_alive(true);
+        req.body() = body.dump();
+        req.prepare_payload();
+
+        try
+        {
+            if (!_connected)
+            {
+                _stream.connect(_endpoints);
+                _connected = true;
+            }
+            http::write(_stream, req);
+            beast::flat_buffer buffer;
+            http::response<http::string_body> res;
+            http::read(_stream, buffer, res);
+            if (!res.keep_alive())
+                close();
+            return res.result() == http::status::ok;
+        }
+        catch (const std::exception &)
+        {
+            close();
+            return false;
+        }
+    }
+
+private:
+    void close()
+    {
+        beast::error_code ec;
+        _stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+        _stream.close();
+        _connected = false;
+    }
+
+    beast::tcp_stream _stream;
+    tcp::resolver::results_type _endpoints;
+    std::string _host;
+    bool _connected = false;
+};
+
+} // namespace
+
+ReplayReport mj::run_replay(ReplayOptions const &options, std::ostream &progress)
+{
+    CaptureReader reader(options.capture);
+
+    net::io_context ioc;
+    tcp::resolver::results_type endpoints;
+    bool remote = !options.host.empty();
+    if (remote)
+    {
+        beast::error_code ec;
+        endpoints = tcp::resolver(ioc).resolve(options.host, options.port, ec);
+        if (ec)
+            throw std::invalid_argument("Cannot resolve " + options.host + ":" + options.port + ": " + ec.message());
+    }
+
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int concurrency = options.concurrency > 0 ? options.concurrency : cores;
+    PlanCache plans;
+
+    // Capacity 1: the dispatcher stays at most one request ahead of the workers
+    BoundedQueue<Job> jobs(1, 1);
+    std::mutex samples_mutex;
+    std::vector<Sample> samples;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < concurrency; ++i)
+        workers.emplace_back([&] {
+            std::optional<HttpReplayer> http_replayer;
+            if (remote)
+                http_replayer.emplace(ioc, endpoints, options.host);
+            while (auto job = jobs.pop())
+            {
+                auto started = Clock::now();
+                bool ok = false;
+                try
+                {
+                    ok = remote ? http_replayer->send(job->record) : run_in_process(plans, job->record);
+                }
+                catch (const std::exception &)
+                {
+                    ok = false;
+                }
+                auto done = Clock::now();
+                std::lock_guard<std::mutex> lock(samples_mutex);
+                samples.push_back({ok, ms_between(job->scheduled, done), ms_between(started, done)});
+            }
+        });
+
+    // Dispatcher: this thread, in capture order
+    auto start = Clock::now();
+    auto last_print = start;
+    std::optional<std::int64_t> previous_us;
+    Clock::time_point scheduled = start;
+    std::size_t issued = 0;
+    while (options.limit == 0 || issued < options.limit)
+    {
+        std::optional<CaptureRecord> record = reader.next();
+        if (!record)
+            break;
+
+        // Records from separate server runs can be hours apart, and the
+        // writer thread may store near-simultaneous arrivals out of order
+        if (options.speed > 0 && previous_us)
+        {
+            double gap = std::max<double>(0, static_cast<double>(record->ts_us - *previous_us) / 1e6);
+            if (options.max_gap > 0)
+                gap = std::min(gap, options.max_gap);
+            scheduled += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap / options.speed));
+            std::this_thread::sleep_until(scheduled);
+        }
+        else
+            scheduled = Clock::now();
+        previous_us = std::max(record->ts_us, previous_us.value_or(record->ts_us));
+
+        jobs.push({std::move(*record), scheduled});
+        ++issued;
+
+        if (Clock::now() - last_print >= std::chrono::seconds(1))
+        {
+            progress << "\r" << issued << " requests issued" << std::flush;
+            last_print = Clock::now();
+        }
+    }
+    jobs.producer_done();
+    for (auto &t : workers)
+        t.join();
+    progress << "\r" << issued << " requests issued" << std::endl;
+
+    ReplayReport report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report.requests = samples.size();
+    std::vector<double> latency, service;
+    for (Sample const &s : samples)
+    {
+        (s.ok ? report.succeeded : report.failed)++;
+        latency.push_back(s.latency_ms);
+        service.push_back(s.service_ms);
+    }
+    report.throughput = static_cast<double>(report.requests) / std::max(report.seconds, 1e-3);
+    report.latency_p50 = percentile(latency, 0.50);
+    report.latency_p90 = percentile(latency, 0.90);
+    report.latency_p99 = percentile(latency, 0.99);
+    report.latency_max = latency.empty() ? 0 : *std::max_element(latency.begin(), latency.end());
+    report.service_p50 = percentile(service, 0.50);
+    report.service_p99 = percentile(service, 0.99);
+    return report;
+}
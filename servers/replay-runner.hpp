@@ -0,0 +1,52 @@
+#ifndef MJ_REPLAY_RUNNER_HPP
+#define MJ_REPLAY_RUNNER_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace mj {
+
+// Replays a capture file (capture.hpp), either against a running server over
+// HTTP or in-process straight through the pipeline plans.
+//
+// Requests are issued open loop at their captured arrival times, scaled by
+// `speed`. When every connection or worker is busy the next request starts
+// late, and its latency is counted from its scheduled start, so a slow server
+// shows up as latency instead of silently lowering the offered load. With
+// speed 0 requests are issued back to back (closed loop); with speed 0 and
+// concurrency 1 an in-process replay is fully deterministic.
+struct ReplayOptions
+{
+    std::string capture;
+    std::string host;         // empty = in-process
+    std::string port;
+    double speed = 1;         // 1 = real time, 2 = twice as fast, 0 = no pauses
+    double max_gap = 0;       // longest pause in seconds before scaling, 0 = no cap
+    int concurrency = 0;      // requests in flight, 0 = CPU count
+    std::size_t limit = 0;    // records to replay, 0 = all
+};
+
+struct ReplayReport
+{
+    std::size_t requests = 0;
+    std::size_t succeeded = 0;
+    std::size_t failed = 0;
+    double seconds = 0;
+    double throughput = 0;    // requests per second
+    // milliseconds, from scheduled start to response
+    double latency_p50 = 0;
+    double latency_p90 = 0;
+    double latency_p99 = 0;
+    double latency_max = 0;
+    // milliseconds, from actual start to response
+    double service_p50 = 0;
+    double service_p99 = 0;
+};
+
+// Throws std::invalid_argument for an unreadable capture or unknown host
+ReplayReport run_replay(ReplayOptions const &options, std::ostream &progress);
+
+} // namespace mj
+
+#endif // MJ_REPLAY_RUNNER_HPP
@@ -0,0 +1,263 @@
+#ifndef MJ_STATIC_PIPELINE_HPP
+#define MJ_STATIC_PIPELINE_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <array>
+#include <cmath>
+#include <string>
+#include <tuple>
+#include <utility>
+#include "blur.hpp"
+#include "overlay.hpp"
+
+namespace mj {
+
+// Pipelines whose stages are types, for the fixed recipes that carry most of
+// the traffic. StaticPipeline<stage::Grayscale, stage::Resize, stage::Blur>
+// runs with no virtual dispatch and no decorator objects. Adjacent point
+// stages are fused at compile time into one pass: their value tables are
+// composed, and a Grayscale among them is folded into the same row loop.
+// After Grayscale the rest runs on one plane, as the dynamic chain's colour
+// tracking does.
+//
+// Each stage repeats exactly what its ProcessorDecorator does, so results
+// match the dynamic chain. PipelinePlan only uses a static pipeline after
+// checking that on a probe image.
+namespace stage {
+
+using Table = std::array<uchar, 256>;
+
+// Point stages map each channel value through map(), or convert to grey
+struct PointStage
+{
+    static constexpr bool pointwise = true;
+    static constexpr bool to_gray = false;
+};
+
+// Whole-image stages write apply(in) to a new Mat
+struct ImageStage
+{
+    static constexpr bool pointwise = false;
+    static constexpr bool to_gray = false;
+};
+
+struct Grayscale : PointStage
+{
+    static constexpr char const *op = "Grayscale";
+    static constexpr bool to_gray = true;
+
+    explicit Grayscale(nlohmann::json const &) {}
+    void map(Table &) const {}
+};
+
+struct BrightnessContrast : PointStage
+{
+    static constexpr char const *op = "BrightnessContrast";
+
+    explicit BrightnessContrast(nlohmann::json const &p)
+        : brightness(p.at("brightness").get<int>()), contrast(p.at("contrast").get<double>()) {}
+
+    // The same convertTo call, on the table's values
+    void map(Table &table) const
+    {
+        cv::Mat row(1, 256, CV_8U, table.data());
+        row.convertTo(row, -1, contrast, brightness);
+    }
+
+    int brightness;
+    double contrast;
+};
+
+struct GammaCorrection : PointStage
+{
+    static constexpr char const *op = "GammaCorrection";
+
+    explicit GammaCorrection(nlohmann::json const &p)
+    {
+        double gamma = p.at("gamma").get<double>();
+        for (int i = 0; i < 256; ++i)
+            lut[i] = static_cast<uchar>(std::pow(i / 255.0, gamma) * 255.0);
+    }
+
+    void map(Table &table) const
+    {
+        for (uchar &v : table)
+            v = lut[v];
+    }
+
+    Table lut;
+};
+
+struct InvertColors : PointStage
+{
+    static constexpr char const *op = "InvertColors";
+
+    explicit InvertColors(nlohmann::json const &) {}
+
+    void map(Table &table) const
+    {
+        for (uchar &v : table)
+            v = static_cast<uchar>(~v);
+    }
+};
+
+struct Resize : ImageStage
+{
+    static constexpr char const *op = "Resize";
+
+    explicit Resize(nlohmann::json const &p) : size(p.at("width").get<int>(), p.at("height").get<int>()) {}
+    void apply(cv::Mat const &in, cv::Mat &out) const { cv::resize(in, out, size); }
+
+    cv::Size size;
+};
+
+struct Blur : ImageStage
+{
+    static constexpr char const *op = "Blur";
+
+    explicit Blur(nlohmann::json const &p) : kernel(p.at("kernel_size").get<int>()) {}
+    void apply(cv::Mat const &in, cv::Mat &out) const { gaussian_blur(in, out, kernel, 0); }
+
+    int kernel;
+};
+
+struct Sharpen : ImageStage
+{
+    static constexpr char const *op = "Sharpen";
+
+    explicit Sharpen(nlohmann::json const &) : kernel((cv::Mat_<float>(3, 3) << 0, -1, 0, -1, 5, -1, 0, -1, 0)) {}
+    void apply(cv::Mat const &in, cv::Mat &out) const { cv::filter2D(in, out, in.depth(), kernel); }
+
+    cv::Mat kernel;
+};
+
+struct Watermark : ImageStage
+{
+    static constexpr char const *op = "Watermark";
+
+    explicit Watermark(nlohmann::json const &p)
+        : mask(text_mask(p.at("text").get<std::string>(), 1, 2, cv::Scalar(255, 255, 255), false)) {}
+
+    void apply(cv::Mat const &in, cv::Mat &out) const
+    {
+        out = in.clone();
+        blend_overlay(out, *mask, cv::Point(10, out.rows - 10) - mask->anchor);
+    }
+
+    std::shared_ptr<OverlayMask const> mask;
+};
+
+} // namespace stage
+
+template <typename... Stages>
+class StaticPipeline
+{
+public:
+    explicit StaticPipeline(Stages... stages) : _stages(std::move(stages)...) {}
+
+    // `image` is 8-bit BGR and is not modified
+    cv::Mat run(cv::Mat const &image) const
+    {
+        cv::Mat current = image;
+        run_from<0>(current);
+        if (current.channels() == 1 && image.channels() == 3)
+            cv::cvtColor(current, current, cv::COLOR_GRAY2BGR);
+        return current;
+    }
+
+private:
+    static constexpr std::size_t count = sizeof...(Stages);
+    static constexpr std::array<bool, count> pointwise = {Stages::pointwise...};
+    static constexpr std::array<bool, count> to_gray = {Stages::to_gray...};
+
+    // End of the run of point stages starting at `i`
+    static constexpr std::size_t run_end(std::size_t i)
+    {
+        while (i < count && pointwise[i])
+            ++i;
+        return i;
+    }
+
+    static constexpr std::size_t first_gray(std::size_t begin, std::size_t end)
+    {
+        while (begin < end && !to_gray[begin])
+            ++begin;
+        return begin;
+    }
+
+    template <std::size_t I>
+    void run_from(cv::Mat &image) const
+    {
+        if constexpr (I < count)
+        {
+            if constexpr (pointwise[I])
+            {
+                constexpr std::size_t end = run_end(I);
+                point_pass<I, end>(image);
+                run_from<end>(image);
+            }
+            else
+            {
+                cv::Mat next;
+                std::get<I>(_stages).apply(image, next);
+                image = next;
+                run_from<I + 1>(image);
+            }
+        }
+    }
+
+    template <std::size_t From, std::size_t... K>
+    void compose(stage::Table &table, std::index_sequence<K...>) const
+    {
+        (std::get<From + K>(_stages).map(table), ...);
+    }
+
+    // Point stages [Begin, End) in one pass: the tables before a Grayscale,
+    // the conversion, then the tables after it
+    template <std::size_t Begin, std::size_t End>
+    void point_pass(cv::Mat &image) const
+    {
+        constexpr std::size_t gray = first_gray(Begin, End);
+        constexpr std::size_t after_gray = gray < End ? gray + 1 : End;
+
+        stage::Table before, after;
+        for (int v = 0; v < 256; ++v)
+            before[v] = after[v] = static_cast<uchar>(v);
+        compose<Begin>(before, std::make_index_sequence<gray - Begin>());
+        compose<after_gray>(after, std::make_index_sequence<End - after_gray>());
+
+        if (gray == End || image.channels() == 1)
+        {
+            // Grey is already one plane, and Grayscale leaves it as is
+            for (uchar &v : before)
+                v = after[v];
+            cv::Mat lut(1, 256, CV_8U, before.data()), out;
+            cv::LUT(image, lut, out);
+            image = out;
+            return;
+        }
+
+        // cvtColor(BGR2GRAY) fixed point: 15-bit weights, rounded
+        cv::Mat const src = image;
+        cv::Mat gray_plane(src.size(), CV_8UC1);
+        cv::parallel_for_(cv::Range(0, src.rows), [&](cv::Range const &rows) {
+            for (int y = rows.start; y < rows.end; ++y)
+            {
+                uchar const *in = src.ptr<uchar>(y);
+                uchar *out = gray_plane.ptr<uchar>(y);
+                for (int x = 0; x < src.cols; ++x, in += 3)
+                    out[x] = after[(before[in[0]] * 3735 + before[in[1]] * 19235 + before[in[2]] * 9798 + (1 << 14)) >> 15];
+            }
+        });
+        image = gray_plane;
+    }
+
+    std::tuple<Stages...> _stages;
+};
+
+} // namespace mj
+
+#endif // MJ_STATIC_PIPELINE_HPP
@@ -1,55 +1,4 @@
-#ifndef MJ_SYNC_SERVER_REFACTOR_HPP
-#define MJ_SYNC_SERVER_REFACTOR_HPP
-
-#include <boost/beast/core.hpp>
-#include <boost/beast/http.hpp>
-#include <boost/beast/version.hpp>
-#include <boost/asio.hpp>
-#include <boost/asio/ip/tcp.hpp>
-#include <nlohmann/json.hpp>
-#include <cppcodec/base64_rfc4648.hpp>
-#include <opencv2/opencv.hpp>
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <thread>
-#include <memory>
-#include <vector>
-#include <functional>
-#include <system_error>
-#include "image-processor.hpp" // your processor chain
-
-namespace mj {
-
-class SyncServer {
-public:
-    SyncServer(std::string host, std::string port);
-    ~SyncServer();
-
-    // Run the server (blocking)
-    void run();
-
-private:
-    std::string _host;
-    std::string _port;
-
-    // session handling
-    void do_session(boost::asio::ip::tcp::socket socket);
-
-    // route handlers
-    void handle_root_get(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
-    void handle_root_post(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
-
-    // helpers
-    bool decode_base64_image(const std::string &b64, std::vector<unsigned char> &out);
-    cv::Mat decode_image_mat(const std::string &b64, std::string &err_msg);
-    void send_json_response(boost::asio::ip::tcp::socket &socket, nlohmann::json const &j, unsigned version, bool keep_alive);
-    void send_error(boost::asio::ip::tcp::socket &socket, boost::beast::http::status status, std::string const &message, unsigned version, bool keep_alive);
-};
-
-} // namespace mj
-
-#endif // MJ_SYNC_SERVER_REFACTOR_HPP
+#include "sync-server.hpp"
 
 // -----------------------------------------------------------------------------
 // Implementation
@@ -57,6 +6,13 @@ private:
 
 #include <cstdlib>
 #include <cctype>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <unistd.h>
+#include "logger.hpp"
+#include "jpeg-yuv.hpp"
 
 using namespace std;
 using json = nlohmann::json;
@@ -68,7 +24,57 @@ using namespace mj;
 // Constants
 static constexpr std::size_t MAX_REQUEST_BODY = 10 * 1024 * 1024; // 10 MB limit
 
-SyncServer::SyncServer(std::string host, std::string port) : _host(std::move(host)), _port(std::move(port)) {}
+// What the access log records about the request served on this thread
+struct AccessEntry
+{
+    int status = 0;
+    std::size_t bytes_out = 0;
+    cv::Size image;
+    json timings;
+};
+
+static thread_local AccessEntry *current_access = nullptr;
+
+// Called by every response writer
+static void note_response(http::status status, std::size_t bytes)
+{
+    if (!current_access)
+        return;
+    current_access->status = static_cast<int>(status);
+    current_access->bytes_out = bytes;
+    if (RequestTimer const *timer = RequestTimer::active())
+        current_access->timings = timer->timings();
+}
+
+SyncServer::SyncServer(std::string host, std::string port, ServerOptions options)
+    : _host(std::move(host)), _port(std::move(port)),
+      _scheduler(std::make_unique<FairScheduler>(std::move(options.scheduler))),
+      _plans(std::make_unique<PlanCache>()), _server_timing(options.server_timing),
+      _memory_budget(options.memory_budget > 0 ? options.memory_budget : default_memory_budget()),
+      _max_pixels(options.max_pixels), _presets(std::move(options.presets)), _optimize(options.optimize),
+      _jpeg_yuv(options.jpeg_yuv), _warmup_size(options.warmup_size)
+{
+    // Presets are checked and compiled up front
+    if (!_presets.is_object())
+        throw std::invalid_argument("Presets must be a JSON object of name -> request fields");
+    for (auto const &[name, preset] : _presets.items())
+    {
+        if (!preset.is_object())
+            throw std::invalid_argument("Preset '" + name + "' must be an object");
+        auto plan = _plans->get(preset);
+        _preset_plans.push_back(plan);
+        std::cerr << "Preset " << name << ": " << plan->size() << " stages" << (plan->specialized() ? ", specialized" : "") << std::endl;
+    }
+
+    // Waiting for memory counts against the same limit as waiting for a worker
+    _memory = std::make_unique<MemoryGovernor>(_memory_budget, _scheduler->config().max_queue_time);
+    if (!options.local_socket.empty())
+        _local = std::make_unique<LocalServer>(options.local_socket, *_scheduler, *_plans, *_memory, _max_pixels);
+    if (!options.capture.empty())
+        _capture = std::make_unique<CaptureWriter>(options.capture, options.capture_rate);
+    if (options.image_store_bytes > 0)
+        _images = std::make_unique<ImageStore>(options.image_store_bytes, options.image_store_ttl, options.image_store_decoded);
+}
 SyncServer::~SyncServer() {}
 
 void SyncServer::run()
@@ -79,6 +85,10 @@ void SyncServer::run()
         return;
     }
 
+    // The local transport shares the scheduler, plan cache and memory budget with HTTP
+    if (_local)
+        std::thread(&LocalServer::run, _local.get()).detach();
+
     boost::asio::io_context ioc{1};
 
     try
@@ -89,6 +99,9 @@ void SyncServer::run()
         tcp::acceptor acceptor{ioc, {address, port_num}};
         std::cerr << "Server is listening on " << _host << ":" << _port << std::endl;
 
+        // Liveness and readiness probes are answered during warm-up
+        std::thread(&SyncServer::warm_up_then_ready, this).detach();
+
         for (;;)
         {
             boost::system::error_code ec;
@@ -96,7 +109,7 @@ void SyncServer::run()
             acceptor.accept(socket, ec);
             if (ec)
             {
-                std::cerr << "Accept failed: " << ec.message() << std::endl;
+                log_error("Accept failed: " + ec.message());
                 continue;
             }
 
@@ -126,23 +139,49 @@ void SyncServer::do_session(tcp::socket socket)
         }
         if (ec)
         {
-            std::cerr << "read error: " << ec.message() << std::endl;
+            log_error("read error: " + ec.message());
             break;
         }
 
+        // route matching (path only, ignore query for now)
+        std::string target(req.target());
+        auto pos = target.find('?');
+        if (pos != std::string::npos)
+            target.resize(pos);
+
+        // Filled in by the handlers and response writers, written after the response
+        AccessEntry access;
+        current_access = access_log_enabled() ? &access : nullptr;
+        auto started = std::chrono::steady_clock::now();
+        auto log_request = [&] {
+            if (!current_access)
+                return;
+            current_access = nullptr;
+            json record = {{"method", std::string(req.method_string())},
+                           {"route", target},
+                           {"tenant", request_tenant(req)},
+                           {"status", access.status},
+                           {"bytes_in", req.body().size()},
+                           {"bytes_out", access.bytes_out},
+                           {"latency_ms", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count()}};
+            if (!access.image.empty())
+            {
+                record["width"] = access.image.width;
+                record["height"] = access.image.height;
+            }
+            if (!access.timings.is_null())
+                record["timings"] = std::move(access.timings);
+            log_access(std::move(record));
+        };
+
         // Basic body size protection
         if (req.body().size() > MAX_REQUEST_BODY)
         {
             send_error(socket, http::status::payload_too_large, "Request body too large", req.version(), req.keep_alive());
+            log_request();
             break;
         }
 
-        // route matching (path only, ignore query for now)
-        std::string target = req.target();
-        auto pos = target.find('?');
-        if (pos != std::string::npos)
-            target.resize(pos);
-
         try
         {
             if (target == "/")
@@ -154,6 +193,40 @@ void SyncServer::do_session(tcp::socket socket)
                 else
                     send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
             }
+            else if (target == "/analyze")
+            {
+                if (req.method() == http::verb::post)
+                    handle_root_post(socket, req, true);
+                else
+                    send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
+            }
+            else if (target == "/metrics")
+            {
+                if (req.method() == http::verb::get)
+                    handle_metrics_get(socket, req);
+                else
+                    send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
+            }
+            else if (target == "/ready" || target == "/status")
+            {
+                if (req.method() != http::verb::get)
+                    send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
+                else if (target == "/ready")
+                    handle_ready_get(socket, req);
+                else
+                    handle_status_get(socket, req);
+            }
+            else if (target == "/debug/trace")
+            {
+                if (req.method() == http::verb::get)
+                    handle_trace_get(socket, req);
+                else
+                    send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
+            }
+            else if (target == "/images" || target.rfind("/images/", 0) == 0)
+            {
+                handle_images(socket, req, target);
+            }
             else if (target == "/stream")
             {
                 // If you want streaming, implement handle_stream() separately.
@@ -166,16 +239,18 @@ void SyncServer::do_session(tcp::socket socket)
         }
         catch (const std::exception &ex)
         {
-            std::cerr << "Handler exception: " << ex.what() << std::endl;
+            log_error(std::string("Handler exception: ") + ex.what());
             send_error(socket, http::status::internal_server_error, ex.what(), req.version(), req.keep_alive());
             // do not break here; allow socket to continue depending on client
         }
         catch (...)
         {
-            std::cerr << "Unknown handler exception\n";
+            log_error("Unknown handler exception");
             send_error(socket, http::status::internal_server_error, "Unknown error", req.version(), req.keep_alive());
         }
 
+        log_request();
+
         // If connection is not keep-alive, close after one request
         if (!req.keep_alive())
             break;
@@ -212,17 +287,29 @@ void SyncServer::handle_root_get(tcp::socket &socket, http::request<http::string
     res.content_length(size);
     res.keep_alive(req.keep_alive());
 
+    note_response(http::status::ok, size);
     http::write(socket, res, ec);
     if (ec)
-        std::cerr << "write error (GET): " << ec.message() << std::endl;
+        log_error("write error (GET): " + ec.message());
 }
 
-void SyncServer::handle_root_post(tcp::socket &socket, http::request<http::string_body> const &req)
+// POST / returns the processed image. POST /analyze (`analyze`) takes the
+// same body and returns statistics of the processed image instead, with no
+// encode.
+void SyncServer::handle_root_post(tcp::socket &socket, http::request<http::string_body> const &req, bool analyze)
 {
+    // Collects phase and stage durations when asked for a Server-Timing header
+    bool timing_header = _server_timing || req["X-Debug-Timing"] == "1";
+    RequestTimer timer(timing_header || access_log_enabled());
+    // Replays post to "/", so only those requests are captured
+    bool capture = !analyze && _capture && _capture->sample();
+    std::int64_t arrival_us = capture ? capture_clock_us() : 0;
+
     // Parse JSON safely
     json request_json;
     try
     {
+        TraceScope span("parse");
         request_json = json::parse(req.body());
     }
     catch (const std::exception &e)
@@ -231,152 +318,467 @@ void SyncServer::handle_root_post(tcp::socket &socket, http::request<http::strin
         return;
     }
 
-    // Validate img field
-    if (!request_json.contains("img") || !request_json["img"].is_string())
+    // The image is inline ("img") or uploaded earlier to /images ("img_ref")
+    std::shared_ptr<ImageStore::Image const> stored;
+    if (request_json.contains("img_ref"))
+    {
+        if (!_images)
+        {
+            send_error(socket, http::status::bad_request, "'img_ref' needs the image store (--image-store-mb)", req.version(), req.keep_alive());
+            return;
+        }
+        if (!request_json["img_ref"].is_string())
+        {
+            send_error(socket, http::status::bad_request, "Invalid 'img_ref' field", req.version(), req.keep_alive());
+            return;
+        }
+        stored = _images->get(request_json["img_ref"].get<std::string>());
+        if (!stored)
+        {
+            send_error(socket, http::status::not_found, "Unknown or expired img_ref", req.version(), req.keep_alive());
+            return;
+        }
+    }
+    else if (!request_json.contains("img") || !request_json["img"].is_string())
     {
         send_error(socket, http::status::bad_request, "Missing or invalid 'img' field", req.version(), req.keep_alive());
         return;
     }
 
-    // Decode image into cv::Mat (no temporary file)
-    std::string err_msg;
-    cv::Mat image = decode_image_mat(request_json["img"].get<std::string>(), err_msg);
-    if (image.empty())
+    // Look up (or compile once) the plan for this pipeline configuration.
+    // This comes before the memory reservation: the registry's parameter
+    // limits keep what compiling allocates small, for renditions and
+    // optimizer rewrites too.
+    std::shared_ptr<PipelinePlan const> plan;
+    std::optional<RegionOfInterest> roi;
+    std::vector<RenditionSpec> renditions;
+    AnalysisOptions analysis;
+    OptimizeMode optimize = _optimize;
+    try
     {
-        send_error(socket, http::status::bad_request, std::string("Failed to decode image: ") + err_msg, req.version(), req.keep_alive());
+        TraceScope span("plan");
+        apply_preset(request_json, _presets);
+        plan = _plans->get(request_json);
+        if (request_json.contains("optimize"))
+            optimize = parse_optimize_mode(request_json["optimize"].get<std::string>());
+        roi = parse_roi(request_json);
+        renditions = parse_renditions(request_json, *_plans);
+        if (analyze)
+        {
+            analysis = parse_analysis(request_json);
+            if (!renditions.empty())
+                throw std::invalid_argument("'outputs' cannot be analysed");
+            if (roi && analysis.reduce > 1)
+                throw std::invalid_argument("'reduce' cannot be combined with 'roi'");
+        }
+    }
+    catch (const std::exception &e)
+    {
+        send_error(socket, http::status::bad_request, std::string("Invalid pipeline: ") + e.what(), req.version(), req.keep_alive());
         return;
     }
 
-    // Build processor chain using described options
-    std::unique_ptr<ImageProcessor> processor = std::make_unique<BaseProcessor>();
-
-    // Use safe checks for each optional field before accessing
-    if (request_json.value("ConvertColorToGray", false))
+    // With a region of interest only the source pixels it depends on are
+    // decoded (where the codec allows) and processed
+    cv::Size input;
+    cv::Rect roi_rect;
+    auto region_for = [&](cv::Size full) {
+        input = full;
+        if (roi->before)
+            return roi->rect;
+        roi_rect = roi->rect & cv::Rect(cv::Point(), plan->output_size(full));
+        return roi_rect.empty() ? cv::Rect() : plan->source_region(full, roi_rect);
+    };
+
+    // Encoded bytes, inline or from the image store
+    std::vector<unsigned char> encoded;
+    if (!stored)
     {
-        processor = std::make_unique<GrayscaleProcessor>(std::move(processor));
+        TraceScope span("base64");
+        if (!decode_base64_image(request_json["img"].get<std::string>(), encoded))
+        {
+            send_error(socket, http::status::bad_request, "Failed to decode image: Base64 decode failed", req.version(), req.keep_alive());
+            return;
+        }
     }
 
-    if (request_json.contains("Resize") && request_json["Resize"].is_object())
+    // Size the request from the image header and reserve its working memory
+    // before decoding, so oversized images never allocate
+    std::string tenant = request_tenant(req);
+    std::size_t max_pixels = max_pixels_for(tenant);
+    std::optional<cv::Size> probed = stored ? std::optional<cv::Size>(stored->size) : probe_image_size(encoded);
+
+    // The stage order can be rewritten for this size; the response reports
+    // the plan that ran
+    json plan_report = {{"stages", pipeline_json(plan->spec())}};
+    if (optimize != OptimizeMode::Off)
     {
-        int w = request_json["Resize"].value("width", 0);
-        int h = request_json["Resize"].value("height", 0);
-        if (w > 0 && h > 0)
-            processor = std::make_unique<ResizeProcessor>(std::move(processor), w, h);
+        plan_report["optimize"] = optimize_mode_name(optimize);
+        if (probed)
+        {
+            TraceScope span("optimize");
+            OptimizedPipeline optimized = optimize_pipeline(plan->spec(), *probed, optimize);
+            if (!optimized.rewrites.empty())
+                plan = _plans->get(std::move(optimized.spec));
+            plan_report["stages"] = pipeline_json(plan->spec());
+            plan_report["rewrites"] = optimized.rewrites;
+            plan_report["estimated_ms"] = {{"original", optimized.cost_before / 1e6}, {"chosen", optimized.cost_after / 1e6}};
+        }
+        else
+            plan_report["rewrites"] = "skipped: image size unknown before decoding";
     }
 
-    if (request_json.contains("Blur") && request_json["Blur"].is_object())
+    if (probed && !outputs_fit(socket, req, renditions, plan->output_size(*probed), max_pixels))
+        return;
+    MemoryGovernor::Reservation memory;
+    if (!reserve_memory(socket, req, probed, max_pixels, working_memory(*plan, renditions, probed, max_pixels), memory))
+        return;
+
+    // A JPEG whose pipeline only touches luma is processed on its own YCbCr
+    // planes and written back from them, skipping the colour conversions
+    std::optional<YuvImage> yuv;
+    if (_jpeg_yuv && !analyze && !roi && renditions.empty() && plan->runs_on_yuv() && (!stored || stored->decoded.empty()))
     {
-        int kernel = request_json["Blur"].value("kernel_size", 0);
-        if (kernel > 0)
-            processor = std::make_unique<BlurProcessor>(std::move(processor), kernel);
+        TraceScope span("imdecode");
+        yuv.emplace();
+        if (!decode_jpeg_yuv(stored ? stored->encoded : encoded, *yuv))
+            yuv.reset();
     }
+    if (yuv)
+        plan_report["yuv"] = true;
 
-    if (request_json.value("DetectEdges", false))
+    // Decode image into cv::Mat (no temporary file)
+    std::string err_msg;
+    cv::Mat image;
+    if (stored && capture)
+        encoded = stored->encoded;
+    if (yuv)
+        image = yuv->y;
+    else if (stored)
+        image = stored_image_mat(*stored, err_msg, roi ? region_for : std::function<cv::Rect(cv::Size)>(), analysis.reduce);
+    else
+        image = decode_image_mat(encoded, err_msg, roi ? region_for : std::function<cv::Rect(cv::Size)>(), analysis.reduce);
+    if (image.empty() && roi && !input.empty())
     {
-        processor = std::make_unique<EdgeDetectionProcessor>(std::move(processor));
+        send_error(socket, http::status::bad_request, "Region of interest lies outside the image", req.version(), req.keep_alive());
+        return;
     }
-
-    if (request_json.contains("RotateImage") && request_json["RotateImage"].is_object())
+    if (image.empty())
     {
-        double angle = request_json["RotateImage"].value("angle", 0.0);
-        processor = std::make_unique<RotateProcessor>(std::move(processor), angle);
+        send_error(socket, http::status::bad_request, std::string("Failed to decode image: ") + err_msg, req.version(), req.keep_alive());
+        return;
     }
-
-    if (request_json.contains("AdjustBrightnessContrast") && request_json["AdjustBrightnessContrast"].is_object())
+    if (current_access)
+        current_access->image = roi ? input : image.size();
+    // A reduced decode is checked at the size it stands for
+    cv::Size decoded_size = roi ? input : cv::Size(image.cols * analysis.reduce, image.rows * analysis.reduce);
+    if (!probed && static_cast<double>(decoded_size.width) * decoded_size.height > static_cast<double>(max_pixels))
     {
-        int brightness = request_json["AdjustBrightnessContrast"].value("brightness", 0);
-        double contrast = request_json["AdjustBrightnessContrast"].value("contrast", 1.0);
-        processor = std::make_unique<BrightnessContrastProcessor>(std::move(processor), brightness, contrast);
+        send_error(socket, http::status::payload_too_large, "Image has more than " + std::to_string(max_pixels) + " pixels", req.version(), req.keep_alive());
+        return;
     }
 
-    if (request_json.value("ApplySharpening", false))
+    if (capture)
     {
-        processor = std::make_unique<SharpenProcessor>(std::move(processor));
+        json pipeline = request_json;
+        pipeline.erase("img");
+        pipeline.erase("img_ref");
+        _capture->record({arrival_us, tenant, std::move(pipeline), std::move(encoded)});
     }
 
-    if (request_json.value("EqualizeHistogram", false))
+    // Wait for a worker slot; cost is charged per pixel per stage so large
+    // batch images cannot starve small interactive requests of other tenants
+    double stages = static_cast<double>(plan->size() + renditions.size());
+    for (auto const &rendition : renditions)
+        stages += static_cast<double>(rendition.tail->size());
+    if (analyze)
+        stages += 1;
+    double cost = static_cast<double>(image.total()) * std::max(1.0, stages);
+    FairScheduler::Admission admission;
     {
-        processor = std::make_unique<EqualizeHistogramProcessor>(std::move(processor));
+        TraceScope span("queue");
+        admission = _scheduler->acquire(tenant, cost);
     }
-
-    if (request_json.contains("ApplyGammaCorrection") && request_json["ApplyGammaCorrection"].is_object())
+    if (!admission.granted())
     {
-        double gamma = request_json["ApplyGammaCorrection"].value("gamma", 1.0);
-        processor = std::make_unique<GammaCorrectionProcessor>(std::move(processor), gamma);
+        send_error(socket, http::status::service_unavailable, "Server busy, queue time limit exceeded", req.version(), req.keep_alive());
+        return;
     }
 
-    if (request_json.contains("ApplyWatermark") && request_json["ApplyWatermark"].is_object())
+    // Process image within this request's intra-op thread budget, which also
+    // covers the analysis or renditions built from it
+    cv::Mat processed;
+    std::optional<IntraOpScope> threads;
     {
-        std::string text = request_json["ApplyWatermark"].value("text", std::string());
-        if (!text.empty())
-            processor = std::make_unique<WatermarkProcessor>(std::move(processor), text);
+        TraceScope span("process");
+        threads.emplace(image.total());
+        if (yuv)
+            plan->run_yuv(*yuv);
+        else
+            processed = roi && !roi->before ? plan->run_region(image, input, roi_rect) : plan->run(image);
     }
 
-    if (request_json.value("InvertColors", false))
+    if (analyze)
     {
-        processor = std::make_unique<ColorInversionProcessor>(std::move(processor));
+        json stats;
+        {
+            TraceScope span("analyze");
+            stats = stats_json(analyze_image(processed, analysis.edge_threshold), analysis.bins);
+        }
+        threads.reset();
+        admission.release();
+
+        stats["reduce"] = analysis.reduce;
+        json response_json;
+        response_json["plan"] = std::move(plan_report);
+        response_json["analysis"] = std::move(stats);
+        send_json_response(socket, response_json, req.version(), req.keep_alive(),
+                           timing_header ? timer.server_timing() : std::string());
+        return;
     }
 
-    if (request_json.value("ApplySepia", false))
+    // Several outputs: the processed image is the shared prefix of their tails
+    if (!renditions.empty())
     {
-        processor = std::make_unique<SepiaProcessor>(std::move(processor));
+        if (!outputs_fit(socket, req, renditions, processed.size(), max_pixels))
+            return;
+        std::vector<Rendition> outputs;
+        {
+            TraceScope span("renditions");
+            outputs = render(processed, renditions);
+        }
+        threads.reset();
+        admission.release();
+
+        json response_json;
+        response_json["plan"] = std::move(plan_report);
+        TraceScope span("base64enc");
+        for (Rendition const &output : outputs)
+            response_json["outputs"][output.name] = {{"image", base64::encode(output.encoded)},
+                                                     {"format", output.format},
+                                                     {"width", output.size.width},
+                                                     {"height", output.size.height}};
+        send_json_response(socket, response_json, req.version(), req.keep_alive(),
+                       timing_header ? timer.server_timing() : std::string());
+        return;
     }
 
-    if (request_json.contains("ApplyMedianBlur") && request_json["ApplyMedianBlur"].is_object())
+    threads.reset();
+
+    // Encode to JPEG in memory then base64
+    std::vector<unsigned char> out_buf;
+    bool encoded_ok;
     {
-        int kernel = request_json["ApplyMedianBlur"].value("kernel", 0);
-        if (kernel > 0)
-            processor = std::make_unique<MedianBlurProcessor>(std::move(processor), kernel);
+        TraceScope span("imencode");
+        encoded_ok = yuv ? encode_jpeg_yuv(*yuv, out_buf) : cv::imencode(".jpg", processed, out_buf);
     }
-
-    if (request_json.value("StretchHistogram", false))
+    if (!encoded_ok)
     {
-        processor = std::make_unique<HistogramStretchProcessor>(std::move(processor));
+        send_error(socket, http::status::internal_server_error, "Failed to encode processed image", req.version(), req.keep_alive());
+        return;
     }
 
-    if (request_json.contains("ApplyUnsharpMask") && request_json["ApplyUnsharpMask"].is_object())
+    admission.release();
+
+    json response_json;
+    response_json["plan"] = std::move(plan_report);
     {
-        double strength = request_json["ApplyUnsharpMask"].value("strength", 1.0);
-        processor = std::make_unique<UnsharpMaskProcessor>(std::move(processor), strength);
+        TraceScope span("base64enc");
+        response_json["processed_image"] = base64::encode(out_buf);
     }
 
-    if (request_json.contains("ApplyDilation") && request_json["ApplyDilation"].is_object())
+    send_json_response(socket, response_json, req.version(), req.keep_alive(),
+                       timing_header ? timer.server_timing() : std::string());
+}
+
+// Readiness: 503 until warm-up is done, so a load balancer holds traffic
+// from a fresh process until its first requests are no slower than the rest
+void SyncServer::handle_ready_get(tcp::socket &socket, http::request<http::string_body> const &req)
+{
+    if (!_ready)
     {
-        int kernel = request_json["ApplyDilation"].value("kernel", 0);
-        if (kernel > 0)
-            processor = std::make_unique<DilationProcessor>(std::move(processor), kernel);
+        send_error(socket, http::status::service_unavailable, "Warming up", req.version(), req.keep_alive());
+        return;
     }
+    send_json_response(socket, {{"ready", true}, {"warmup", warmup_json(_warmup)}}, req.version(), req.keep_alive());
+}
+
+// Liveness: the process serves HTTP, warmed up or not
+void SyncServer::handle_status_get(tcp::socket &socket, http::request<http::string_body> const &req)
+{
+    send_json_response(socket, {{"status", "ok"}, {"ready", _ready.load()}}, req.version(), req.keep_alive());
+}
 
-    if (request_json.contains("ApplyErosion") && request_json["ApplyErosion"].is_object())
+void SyncServer::warm_up_then_ready()
+{
+    if (_warmup_size > 0)
     {
-        int kernel = request_json["ApplyErosion"].value("kernel", 0);
-        if (kernel > 0)
-            processor = std::make_unique<ErosionProcessor>(std::move(processor), kernel);
+        WarmupOptions options;
+        options.size = _warmup_size;
+        options.threads = _scheduler->config().worker_slots;
+        _warmup = warm_up(options, _preset_plans);
+        for (std::string const &skipped : _warmup.skipped)
+            std::cerr << "Warm-up skipped " << skipped << std::endl;
+        std::cerr << "Warmed up " << _warmup.stages << " stages and " << _warmup.codecs << " codec paths in "
+                  << static_cast<int>(_warmup.ms) << " ms" << std::endl;
     }
+    _ready = true;
+}
 
-    if (request_json.contains("ApplyCLAHE") && request_json["ApplyCLAHE"].is_object())
+void SyncServer::handle_metrics_get(tcp::socket &socket, http::request<http::string_body> const &req)
+{
+    json metrics;
+    metrics["scheduler"] = _scheduler->metrics();
+    metrics["plan_cache"] = _plans->metrics();
+    metrics["threading"] = threading_metrics();
+    if (_capture)
+        metrics["capture"] = _capture->metrics();
+    if (_images)
+        metrics["image_store"] = _images->metrics();
+    metrics["logging"] = logging_metrics();
+    metrics["memory"] = _memory->metrics();
+    metrics["overlay"] = overlay_metrics();
+    if (_ready)
+        metrics["warmup"] = warmup_json(_warmup);
+    send_json_response(socket, metrics, req.version(), req.keep_alive());
+}
+
+// POST /images stores an upload and returns its img_ref; GET and DELETE
+// /images/<img_ref> describe or drop it
+void SyncServer::handle_images(tcp::socket &socket, http::request<http::string_body> const &req, std::string const &target)
+{
+    if (!_images)
     {
-        double clip_limit = request_json["ApplyCLAHE"].value("clip_limit", 2.0);
-        processor = std::make_unique<CLAHEProcessor>(std::move(processor), clip_limit);
+        send_error(socket, http::status::not_found, "Image store is off (start the server with --image-store-mb=<n>)", req.version(), req.keep_alive());
+        return;
     }
 
-    // Process image
-    cv::Mat processed = processor->process(image);
-
-    // Encode to JPEG in memory then base64
-    std::vector<unsigned char> out_buf;
-    if (!cv::imencode(".jpg", processed, out_buf))
+    if (target == "/images")
     {
-        send_error(socket, http::status::internal_server_error, "Failed to encode processed image", req.version(), req.keep_alive());
+        if (req.method() != http::verb::post)
+        {
+            send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
+            return;
+        }
+
+        // The image file itself, or {"img": "<base64>"} as in processing requests
+        std::vector<unsigned char> encoded;
+        std::string content_type(req[http::field::content_type]);
+        if (content_type.rfind("application/json", 0) == 0)
+        {
+            json body;
+            try
+            {
+                TraceScope span("parse");
+                body = json::parse(req.body());
+            }
+            catch (const std::exception &e)
+            {
+                send_error(socket, http::status::bad_request, std::string("Invalid JSON: ") + e.what(), req.version(), req.keep_alive());
+                return;
+            }
+            if (!body.contains("img") || !body["img"].is_string())
+            {
+                send_error(socket, http::status::bad_request, "Missing or invalid 'img' field", req.version(), req.keep_alive());
+                return;
+            }
+            TraceScope span("base64");
+            if (!decode_base64_image(body["img"].get<std::string>(), encoded))
+            {
+                send_error(socket, http::status::bad_request, "Failed to decode image: Base64 decode failed", req.version(), req.keep_alive());
+                return;
+            }
+        }
+        else
+            encoded.assign(req.body().begin(), req.body().end());
+
+        // Decoding validates the upload and gives the size (and the pixels the store may keep)
+        std::size_t max_pixels = max_pixels_for(request_tenant(req));
+        std::optional<cv::Size> probed = probe_image_size(encoded);
+        double pixels = probed ? static_cast<double>(probed->width) * probed->height : static_cast<double>(max_pixels);
+        std::size_t decode_bytes = static_cast<std::size_t>(std::min(3.0 * pixels, static_cast<double>(_memory_budget)));
+        MemoryGovernor::Reservation memory;
+        if (!reserve_memory(socket, req, probed, max_pixels, decode_bytes, memory))
+            return;
+        cv::Mat image;
+        if (!encoded.empty())
+        {
+            TraceScope span("imdecode");
+            image = cv::imdecode(encoded, cv::IMREAD_COLOR);
+        }
+        if (image.empty())
+        {
+            send_error(socket, http::status::bad_request, "Failed to decode image: OpenCV imdecode failed", req.version(), req.keep_alive());
+            return;
+        }
+        if (image.total() > max_pixels)
+        {
+            send_error(socket, http::status::payload_too_large, "Image has more than " + std::to_string(max_pixels) + " pixels", req.version(), req.keep_alive());
+            return;
+        }
+
+        if (current_access)
+            current_access->image = image.size();
+        json response_json = {{"width", image.cols}, {"height", image.rows}, {"bytes", encoded.size()}};
+        try
+        {
+            response_json["img_ref"] = _images->put(std::move(encoded), std::move(image));
+        }
+        catch (const std::length_error &e)
+        {
+            send_error(socket, http::status::payload_too_large, e.what(), req.version(), req.keep_alive());
+            return;
+        }
+        send_json_response(socket, response_json, req.version(), req.keep_alive());
         return;
     }
 
-    std::string encoded = base64::encode(out_buf);
+    std::string ref = target.substr(std::strlen("/images/"));
+    if (req.method() == http::verb::get)
+    {
+        auto stored = _images->get(ref);
+        if (!stored)
+        {
+            send_error(socket, http::status::not_found, "Unknown or expired img_ref", req.version(), req.keep_alive());
+            return;
+        }
+        json response_json = {{"img_ref", stored->hash},
+                              {"width", stored->size.width},
+                              {"height", stored->size.height},
+                              {"bytes", stored->encoded.size()}};
+        send_json_response(socket, response_json, req.version(), req.keep_alive());
+    }
+    else if (req.method() == http::verb::delete_)
+    {
+        if (!_images->remove(ref))
+        {
+            send_error(socket, http::status::not_found, "Unknown or expired img_ref", req.version(), req.keep_alive());
+            return;
+        }
+        send_json_response(socket, json{{"deleted", ref}}, req.version(), req.keep_alive());
+    }
+    else
+        send_error(socket, http::status::method_not_allowed, "Method not allowed", req.version(), req.keep_alive());
+}
 
-    json response_json;
-    response_json["processed_image"] = encoded;
+void SyncServer::handle_trace_get(tcp::socket &socket, http::request<http::string_body> const &req)
+{
+    if (!tracing_enabled())
+    {
+        send_error(socket, http::status::not_found, "Tracing is off (start the server with --trace)", req.version(), req.keep_alive());
+        return;
+    }
+    // ?clear=1 empties the buffer after reading it
+    std::string target(req.target());
+    bool clear = target.find("clear=1") != std::string::npos;
+    send_json_response(socket, trace_events(clear), req.version(), req.keep_alive());
+}
 
-    send_json_response(socket, response_json, req.version(), req.keep_alive());
+std::string SyncServer::request_tenant(http::request<http::string_body> const &req) const
+{
+    std::string tenant_header(req["X-Tenant-ID"]);
+    std::string api_key(req["X-API-Key"]);
+    return _scheduler->resolve_tenant(tenant_header, api_key);
 }
 
 bool SyncServer::decode_base64_image(const std::string &b64, std::vector<unsigned char> &out)
@@ -389,35 +791,156 @@ bool SyncServer::decode_base64_image(const std::string &b64, std::vector<unsigne
     catch (...) { return false; }
 }
 
-cv::Mat SyncServer::decode_image_mat(const std::string &b64, std::string &err_msg)
+// imdecode flags for a decode at 1/`reduce` of the size, which JPEG does in
+// the DCT and other formats by resampling after a full decode
+static int reduced_decode_flags(int reduce)
+{
+    switch (reduce)
+    {
+    case 2:
+        return cv::IMREAD_REDUCED_COLOR_2;
+    case 4:
+        return cv::IMREAD_REDUCED_COLOR_4;
+    case 8:
+        return cv::IMREAD_REDUCED_COLOR_8;
+    default:
+        return cv::IMREAD_COLOR;
+    }
+}
+
+cv::Mat SyncServer::decode_image_mat(std::vector<unsigned char> const &img_data, std::string &err_msg,
+                                     std::function<cv::Rect(cv::Size)> const &region_for, int reduce)
+{
+    TraceScope span("imdecode");
+    cv::Mat img;
+    if (region_for)
+        img = decode_region(img_data, region_for);
+    else
+        img = cv::imdecode(img_data, reduced_decode_flags(reduce));
+    if (img.empty())
+        err_msg = "OpenCV imdecode failed";
+    return img;
+}
+
+// Refuses images over `max_pixels`, then waits for `bytes` of the memory
+// budget. Sends the error response and returns false if the request cannot run.
+bool SyncServer::reserve_memory(tcp::socket &socket, http::request<http::string_body> const &req, std::optional<cv::Size> probed,
+                                std::size_t max_pixels, std::size_t bytes, MemoryGovernor::Reservation &memory)
+{
+    if (probed && static_cast<double>(probed->width) * probed->height > static_cast<double>(max_pixels))
+    {
+        send_error(socket, http::status::payload_too_large, "Image has more than " + std::to_string(max_pixels) + " pixels", req.version(), req.keep_alive());
+        return false;
+    }
+
+    MemoryGovernor::Outcome outcome;
+    {
+        TraceScope span("memory");
+        memory = _memory->reserve(bytes, outcome);
+    }
+    if (outcome == MemoryGovernor::Outcome::TooLarge)
+    {
+        send_error(socket, http::status::payload_too_large, "Image needs more working memory than the server allows", req.version(), req.keep_alive());
+        return false;
+    }
+    if (outcome == MemoryGovernor::Outcome::TimedOut)
+    {
+        send_error(socket, http::status::service_unavailable, "Server busy, memory budget exhausted", req.version(), req.keep_alive());
+        return false;
+    }
+    return true;
+}
+
+// Refuses renditions of more than `max_pixels` from a prefix output of `base`.
+// Sends the error response and returns false if one is found.
+bool SyncServer::outputs_fit(tcp::socket &socket, http::request<http::string_body> const &req, std::vector<RenditionSpec> const &renditions,
+                                  cv::Size base, std::size_t max_pixels)
+{
+    RenditionSpec const *oversized = oversized_rendition(renditions, base, max_pixels);
+    if (!oversized)
+        return true;
+    send_error(socket, http::status::payload_too_large, "Output '" + oversized->name + "' has more than " + std::to_string(max_pixels) + " pixels",
+               req.version(), req.keep_alive());
+    return false;
+}
+
+std::size_t SyncServer::max_pixels_for(std::string const &tenant) const
 {
-    std::vector<unsigned char> img_data;
-    if (!decode_base64_image(b64, img_data))
+    std::size_t limit = _scheduler->config().policy_for(tenant).max_pixels;
+    return limit > 0 ? limit : _max_pixels;
+}
+
+// The plan's peak for the probed size, plus each rendition's tail peak and
+// encoder buffer at its own target size. Without a probed size (a format the
+// probe does not read) the image is assumed to be a square of `max_pixels`.
+std::size_t SyncServer::working_memory(PipelinePlan const &plan, std::vector<RenditionSpec> const &renditions,
+                                       std::optional<cv::Size> probed, std::size_t max_pixels) const
+{
+    int side = static_cast<int>(std::min(std::sqrt(static_cast<double>(max_pixels)), 1073741824.0));
+    cv::Size input = probed ? *probed : cv::Size(side, side);
+    cv::Size output = plan.output_size(input);
+    double bytes = static_cast<double>(plan.peak_bytes(input));
+    for (RenditionSpec const &rendition : renditions)
+    {
+        cv::Size target = rendition_size(rendition, output);
+        cv::Size encoded = rendition.tail->output_size(target);
+        bytes += static_cast<double>(rendition.tail->peak_bytes(target)) + 3.0 * static_cast<double>(encoded.width) * encoded.height;
+    }
+    if (!probed)
+        bytes = std::min(bytes, static_cast<double>(_memory_budget));
+    return static_cast<std::size_t>(std::min(bytes, 1e18));
+}
+
+// Same contract as decode_image_mat for an uploaded image. Kept pixels are
+// shared with other requests, so the result may be a view that is only read.
+cv::Mat SyncServer::stored_image_mat(ImageStore::Image const &stored, std::string &err_msg,
+                                     std::function<cv::Rect(cv::Size)> const &region_for, int reduce)
+{
+    cv::Mat img;
+    if (!stored.decoded.empty())
     {
-        err_msg = "Base64 decode failed";
-        return {};
+        img = stored.decoded;
+        if (region_for)
+        {
+            cv::Rect region = region_for(img.size()) & cv::Rect(cv::Point(), img.size());
+            img = region.empty() ? cv::Mat() : img(region);
+        }
+        else if (reduce > 1)
+        {
+            // Sized as a reduced JPEG decode; the kept pixels stay untouched
+            cv::Mat reduced;
+            cv::resize(img, reduced, cv::Size((img.cols + reduce - 1) / reduce, (img.rows + reduce - 1) / reduce), 0, 0, cv::INTER_AREA);
+            img = reduced;
+        }
+        return img;
     }
 
-    cv::Mat buf(1, static_cast<int>(img_data.size()), CV_8U, img_data.data());
-    cv::Mat img = cv::imdecode(buf, cv::IMREAD_COLOR);
+    TraceScope span("imdecode");
+    if (region_for)
+        img = decode_region(stored.encoded, region_for);
+    else
+        img = cv::imdecode(stored.encoded, reduced_decode_flags(reduce));
     if (img.empty())
         err_msg = "OpenCV imdecode failed";
     return img;
 }
 
-void SyncServer::send_json_response(tcp::socket &socket, json const &j, unsigned version, bool keep_alive)
+void SyncServer::send_json_response(tcp::socket &socket, json const &j, unsigned version, bool keep_alive, std::string const &server_timing)
 {
     boost::system::error_code ec;
     http::response<http::string_body> res{http::status::ok, version};
     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
     res.set(http::field::content_type, "application/json");
+    if (!server_timing.empty())
+        res.set("Server-Timing", server_timing);
     res.body() = j.dump();
     res.content_length(res.body().size());
     res.keep_alive(keep_alive);
 
+    note_response(http::status::ok, res.body().size());
     http::write(socket, res, ec);
     if (ec)
-        std::cerr << "write error (JSON response): " << ec.message() << std::endl;
+        log_error("write error (JSON response): " + ec.message());
 }
 
 void SyncServer::send_error(tcp::socket &socket, http::status status, std::string const &message, unsigned version, bool keep_alive)
@@ -433,9 +956,10 @@ void SyncServer::send_error(tcp::socket &socket, http::status status, std::strin
     res.content_length(res.body().size());
     res.keep_alive(keep_alive);
 
+    note_response(status, res.body().size());
     http::write(socket, res, ec);
     if (ec)
-        std::cerr << "write error (send_error): " << ec.message() << std::endl;
+        log_error("write error (send_error): " + ec.message());
 }
 
 // End of file
@@ -1,45 +1,121 @@
-#ifndef SYNC_SERVER
-#define SYNC_SERVER
+#ifndef MJ_SYNC_SERVER_REFACTOR_HPP
+#define MJ_SYNC_SERVER_REFACTOR_HPP
 
-#include <stdio.h>
-#include "../dep/json/include/nlohmann/json.hpp"
-#include <iostream>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/asio.hpp>
 #include <boost/asio/ip/tcp.hpp>
-#include <boost/config.hpp>
+#include <nlohmann/json.hpp>
+#include <cppcodec/base64_rfc4648.hpp>
+#include <opencv2/opencv.hpp>
 #include <iostream>
+#include <fstream>
 #include <string>
-#include <memory>
 #include <thread>
-#include <cstdlib>
-#include <ctime>
-#include <boost/beast/core.hpp>
-#include <boost/beast/http.hpp>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <optional>
+#include <atomic>
+#include <system_error>
+#include "image-processor.hpp" // your processor chain
+#include "fair-scheduler.hpp"
+#include "pipeline.hpp"
+#include "threading.hpp"
+#include "local-server.hpp"
+#include "tracing.hpp"
+#include "capture.hpp"
+#include "region-decode.hpp"
+#include "renditions.hpp"
+#include "image-store.hpp"
+#include "image-probe.hpp"
+#include "memory-governor.hpp"
+#include "presets.hpp"
+#include "plan-optimizer.hpp"
+#include "image-stats.hpp"
+#include "warmup.hpp"
+
+namespace mj {
 
+struct ServerOptions
+{
+    SchedulerConfig scheduler;
+    std::string local_socket; // Unix socket for co-located clients, empty = off
+    bool server_timing = false; // Server-Timing on every response, not only on X-Debug-Timing: 1
+    std::string capture;        // capture file for sampled requests, empty = off
+    double capture_rate = 0.01; // fraction of requests captured
+    std::size_t image_store_bytes = 256u << 20; // uploads referenced by "img_ref", 0 = off
+    std::chrono::seconds image_store_ttl{600};  // since an upload was last used
+    bool image_store_decoded = true;            // keep decoded pixels, not only the encoded bytes
+    std::size_t memory_budget = 0;              // working memory of all requests, 0 = half of physical memory
+    std::size_t max_pixels = 100000000;         // per image unless the tenant's policy sets max_pixels
+    nlohmann::json presets = nlohmann::json::object(); // named request fragments for "preset"
+    OptimizeMode optimize = OptimizeMode::Off;         // for requests without "optimize"
+    bool jpeg_yuv = false; // luma-only pipelines on JPEG run on its YCbCr planes (jpeg-yuv.hpp)
+    int warmup_size = 1024; // synthetic image side warmed up on before GET /ready succeeds, 0 = ready at once
+};
 
+class SyncServer {
+public:
+    SyncServer(std::string host, std::string port, ServerOptions options = ServerOptions());
+    ~SyncServer();
 
+    // Run the server (blocking)
+    void run();
 
-using boost::asio::ip::tcp;
-namespace http = boost::beast::http;
-using boost::asio::ip::tcp;
-namespace mj {
-class SyncServer
-{
 private:
-    static void do_session(
-    tcp::socket &socket,
-    std::shared_ptr<std::string const> const &doc_root);
     std::string _host;
     std::string _port;
-    /* data */
-public:
-   SyncServer(std::string host, std::string port);
-   void run();
-   ~SyncServer();
+    std::unique_ptr<FairScheduler> _scheduler;
+    std::unique_ptr<PlanCache> _plans;
+    std::unique_ptr<LocalServer> _local;
+    bool _server_timing;
+    std::unique_ptr<CaptureWriter> _capture;
+    std::unique_ptr<ImageStore> _images;
+    std::unique_ptr<MemoryGovernor> _memory;
+    std::size_t _memory_budget;
+    std::size_t _max_pixels;
+    nlohmann::json _presets;
+    OptimizeMode _optimize;
+    bool _jpeg_yuv;
+    int _warmup_size;
+    std::vector<std::shared_ptr<PipelinePlan const>> _preset_plans;
+    std::atomic<bool> _ready{false};
+    WarmupReport _warmup; // written before _ready is set
+
+    // session handling
+    void do_session(boost::asio::ip::tcp::socket socket);
 
+    // route handlers
+    void handle_root_get(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
+    void handle_root_post(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req,
+                          bool analyze = false);
+    void handle_metrics_get(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
+    void handle_images(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req, std::string const &target);
+    void handle_ready_get(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
+    void handle_status_get(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
+    void handle_trace_get(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req);
+
+    // helpers
+    void warm_up_then_ready();
+    bool decode_base64_image(const std::string &b64, std::vector<unsigned char> &out);
+    cv::Mat decode_image_mat(std::vector<unsigned char> const &img_data, std::string &err_msg,
+                             std::function<cv::Rect(cv::Size)> const &region_for = nullptr, int reduce = 1);
+    bool reserve_memory(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req,
+                        std::optional<cv::Size> probed, std::size_t max_pixels, std::size_t bytes, MemoryGovernor::Reservation &memory);
+    bool outputs_fit(boost::asio::ip::tcp::socket &socket, boost::beast::http::request<boost::beast::http::string_body> const &req,
+                          std::vector<RenditionSpec> const &renditions, cv::Size base, std::size_t max_pixels);
+    std::size_t max_pixels_for(std::string const &tenant) const;
+    std::size_t working_memory(PipelinePlan const &plan, std::vector<RenditionSpec> const &renditions,
+                               std::optional<cv::Size> probed, std::size_t max_pixels) const;
+    cv::Mat stored_image_mat(ImageStore::Image const &stored, std::string &err_msg,
+                             std::function<cv::Rect(cv::Size)> const &region_for = nullptr, int reduce = 1);
+    std::string request_tenant(boost::beast::http::request<boost::beast::http::string_body> const &req) const;
+    void send_json_response(boost::asio::ip::tcp::socket &socket, nlohmann::json const &j, unsigned version, bool keep_alive, std::string const &server_timing = std::string());
+    void send_error(boost::asio::ip::tcp::socket &socket, boost::beast::http::status status, std::string const &message, unsigned version, bool keep_alive);
 };
 
-}
-#endif
\ No newline at end of file
+} // namespace mj
+
+#endif // MJ_SYNC_SERVER_REFACTOR_HPP
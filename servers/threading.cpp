@@ -0,0 +1,256 @@
+#include "threading.hpp"
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The pluggable parallel_for_ backend API is stable from OpenCV 4.5.5; the
+// build can opt out with MJ_NO_PARALLEL_BACKEND (CMake MJ_PARALLEL_BACKEND=OFF)
+#include <opencv2/core/version.hpp>
+#if !defined(MJ_NO_PARALLEL_BACKEND) && __has_include(<opencv2/core/parallel/parallel_backend.hpp>) && \
+    (CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 5))))
+#include <opencv2/core/parallel/parallel_backend.hpp>
+#define MJ_HAVE_PARALLEL_BACKEND 1
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace mj;
+
+namespace {
+
+// Written once by configure_threading() before any request runs
+ThreadingOptions policy;
+int fixed_budget = 0;
+int cores = 1;
+
+std::atomic<int> in_flight{0};
+
+// Budget of the calling thread; 0 outside any IntraOpScope
+thread_local int current_budget = 0;
+
+// 0 for session threads, 1..n for pool helpers
+thread_local int helper_index = 0;
+
+int budget()
+{
+    if (current_budget > 0)
+        return current_budget;
+    return fixed_budget > 0 ? fixed_budget : cores;
+}
+
+void pin_to_core(int core)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
+
+#ifdef MJ_HAVE_PARALLEL_BACKEND
+
+// cv::parallel_for_ backend on one shared helper pool. The calling thread
+// always works on its own loop; up to budget - 1 idle helpers join it.
+class BudgetedBackend : public cv::parallel::ParallelForAPI
+{
+public:
+    BudgetedBackend(int helpers, bool pin)
+    {
+        for (int i = 0; i < helpers; ++i)
+            _threads.emplace_back(&BudgetedBackend::helper_loop, this, i + 1, pin);
+    }
+
+    ~BudgetedBackend() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _work.notify_all();
+        for (auto &t : _threads)
+            t.join();
+    }
+
+    int getThreadNum() const override { return helper_index; }
+    int getNumThreads() const override { return budget(); }
+
+    // Budgets come from IntraOpScope, not from OpenCV's global setting
+    int setNumThreads(int) override { return budget(); }
+
+    const char *getName() const override { return "mj-budgeted"; }
+
+    int helpers() const { return static_cast<int>(_threads.size()); }
+
+    void parallel_for(int tasks, FN_parallel_for_body_cb_t body, void *data) override
+    {
+        int threads = std::min(budget(), tasks);
+        if (threads <= 1 || _threads.empty())
+        {
+            body(0, tasks, data);
+            return;
+        }
+
+        auto job = std::make_shared<Job>();
+        job->tasks = tasks;
+        job->body = body;
+        job->data = data;
+        job->helpers_wanted = std::min(threads - 1, helpers());
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(job);
+        }
+        for (int i = 0; i < job->helpers_wanted; ++i)
+            _work.notify_one();
+
+        run_chunks(*job);
+
+        // Helpers that have not picked the job up yet are no longer needed
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = std::find(_jobs.begin(), _jobs.end(), job);
+            if (it != _jobs.end())
+                _jobs.erase(it);
+        }
+
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&] { return job->done.load() == job->tasks; });
+        if (job->error)
+            std::rethrow_exception(job->error);
+    }
+
+private:
+    struct Job
+    {
+        int tasks = 0;
+        FN_parallel_for_body_cb_t body = nullptr;
+        void *data = nullptr;
+        int helpers_wanted = 0;
+        int helpers_joined = 0; // guarded by BudgetedBackend::_mutex
+        std::atomic<int> next{0};
+        std::atomic<int> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+
+    static void run_chunks(Job &job)
+    {
+        for (int i = job.next++; i < job.tasks; i = job.next++)
+        {
+            try
+            {
+                job.body(i, i + 1, job.data);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                if (!job.error)
+                    job.error = std::current_exception();
+            }
+            if (++job.done == job.tasks)
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                job.finished.notify_all();
+            }
+        }
+    }
+
+    void helper_loop(int index, bool pin)
+    {
+        helper_index = index;
+        current_budget = 1;
+        if (pin)
+            pin_to_core(index % cores);
+
+        for (;;)
+        {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _work.wait(lock, [&] { return _stop || !_jobs.empty(); });
+                if (_stop)
+                    return;
+                job = _jobs.front();
+                if (++job->helpers_joined >= job->helpers_wanted)
+                    _jobs.pop_front();
+            }
+            run_chunks(*job);
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _work;
+    std::deque<std::shared_ptr<Job>> _jobs;
+    std::vector<std::thread> _threads;
+    bool _stop = false;
+};
+
+std::shared_ptr<BudgetedBackend> backend;
+
+#endif
+
+} // namespace
+
+void mj::configure_threading(ThreadingOptions const &options, int inter_op)
+{
+    cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    if (inter_op <= 0)
+        inter_op = cores;
+
+    policy = options;
+    fixed_budget = options.intra_op_threads > 0 ? std::min(options.intra_op_threads, cores)
+                                                : std::max(1, cores / inter_op);
+
+#ifdef MJ_HAVE_PARALLEL_BACKEND
+    backend = std::make_shared<BudgetedBackend>(cores - 1, options.pin_threads);
+    cv::parallel::setParallelForBackend(backend, false);
+#else
+    cv::setNumThreads(fixed_budget);
+#endif
+}
+
+IntraOpScope::IntraOpScope(std::size_t pixels) : _previous(current_budget)
+{
+    int active = ++in_flight;
+    _threads = budget();
+    if (policy.adaptive && pixels >= policy.adaptive_min_pixels)
+        _threads = std::max(_threads, cores / active);
+    current_budget = _threads;
+}
+
+IntraOpScope::~IntraOpScope()
+{
+    --in_flight;
+    current_budget = _previous;
+}
+
+nlohmann::json mj::threading_metrics()
+{
+    nlohmann::json j;
+    j["cores"] = cores;
+    j["intra_op_threads"] = budget();
+    j["adaptive"] = policy.adaptive;
+    j["pinned"] = policy.pin_threads;
+    j["requests_in_flight"] = in_flight.load();
+#ifdef MJ_HAVE_PARALLEL_BACKEND
+    j["backend"] = backend ? backend->getName() : "opencv";
+    j["helpers"] = backend ? backend->helpers() : 0;
+#else
+    j["backend"] = "opencv";
+#endif
+    return j;
+}
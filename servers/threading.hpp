@@ -0,0 +1,53 @@
+#ifndef MJ_THREADING_HPP
+#define MJ_THREADING_HPP
+
+#include <nlohmann/json.hpp>
+#include <cstddef>
+
+namespace mj {
+
+// Two-level threading policy. Inter-op parallelism (requests processed at
+// once) is the scheduler's worker_slots. Intra-op parallelism (threads one
+// request's cv::parallel_for_ loops may use) is set here.
+//
+// OpenCV's own pool is unaware of requests: one loop may take every core
+// while the other session threads keep computing, which oversubscribes the
+// CPU. Where OpenCV supports pluggable parallel backends, this installs one
+// built on a single helper pool. Each request borrows at most its budget of
+// helpers, so the process never runs more than inter-op + helpers compute
+// threads. Without that support the budget falls back to cv::setNumThreads.
+struct ThreadingOptions
+{
+    int intra_op_threads = 0;                  // per request, 0 = cores / inter-op (at least 1)
+    bool adaptive = false;                     // let large images use idle cores
+    std::size_t adaptive_min_pixels = 1 << 20; // smallest image adaptive mode widens
+    bool pin_threads = false;                  // pin helper threads to cores (Linux)
+};
+
+// Installs the policy. Call once at startup, before any image work.
+void configure_threading(ThreadingOptions const &options, int inter_op);
+
+// Sets the intra-op budget of the calling thread for one request. In adaptive
+// mode an image of at least adaptive_min_pixels gets an equal share of all
+// cores among the requests in flight, when that beats the fixed budget.
+class IntraOpScope
+{
+public:
+    explicit IntraOpScope(std::size_t pixels);
+    ~IntraOpScope();
+
+    IntraOpScope(IntraOpScope const &) = delete;
+    IntraOpScope &operator=(IntraOpScope const &) = delete;
+
+    int threads() const { return _threads; }
+
+private:
+    int _threads;
+    int _previous;
+};
+
+nlohmann::json threading_metrics();
+
+} // namespace mj
+
+#endif // MJ_THREADING_HPP
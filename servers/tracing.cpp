@@ -0,0 +1,221 @@
+#include "tracing.hpp"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+struct TraceEvent
+{
+    char name[48];
+    bool stage;
+    std::uint32_t tid;
+    std::uint64_t request;
+    std::int64_t ts_us;
+    std::int64_t dur_us;
+};
+
+std::atomic<bool> enabled{false};
+std::atomic<std::uint64_t> next_request{1};
+std::atomic<std::uint32_t> next_tid{1};
+const auto process_start = std::chrono::steady_clock::now();
+
+thread_local RequestTimer *current = nullptr;
+thread_local std::uint32_t tid = 0;
+
+std::mutex ring_mutex;
+std::vector<TraceEvent> ring;
+std::size_t ring_head = 0;
+std::size_t ring_count = 0;
+
+std::uint32_t thread_id()
+{
+    if (tid == 0)
+        tid = next_tid++;
+    return tid;
+}
+
+std::int64_t micros(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+// Server-Timing desc is a quoted string; drop what would need escaping
+std::string header_safe(std::string_view text)
+{
+    std::string out;
+    for (char c : text)
+        if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20)
+            out += c;
+    return out;
+}
+
+} // namespace
+
+void mj::enable_tracing(std::size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    ring.assign(std::max<std::size_t>(capacity, 1), TraceEvent{});
+    ring_head = 0;
+    ring_count = 0;
+    enabled = true;
+}
+
+bool mj::tracing_enabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+json mj::trace_events(bool clear)
+{
+    json events = json::array();
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    std::size_t capacity = ring.size();
+    for (std::size_t i = 0; i < ring_count; ++i)
+    {
+        TraceEvent const &e = ring[(ring_head + capacity - ring_count + i) % capacity];
+        events.push_back({{"name", e.name},
+                          {"cat", e.stage ? "stage" : "phase"},
+                          {"ph", "X"},
+                          {"ts", e.ts_us},
+                          {"dur", e.dur_us},
+                          {"pid", static_cast<int>(getpid())},
+                          {"tid", e.tid},
+                          {"args", {{"request", e.request}}}});
+    }
+    if (clear)
+        ring_count = 0;
+    return {{"traceEvents", events}, {"displayTimeUnit", "ms"}};
+}
+
+bool mj::dump_trace_file(std::string const &path)
+{
+    std::ofstream out(path);
+    out << trace_events().dump();
+    return static_cast<bool>(out);
+}
+
+void mj::install_trace_signal()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    std::thread([set] {
+        for (int n = 0;; ++n)
+        {
+            int sig = 0;
+            if (sigwait(&set, &sig) != 0)
+                continue;
+            std::string path = "vision_tools-trace-" + std::to_string(getpid()) + "-" + std::to_string(n) + ".json";
+            if (dump_trace_file(path))
+                std::cerr << "Trace written to " << path << std::endl;
+            else
+                std::cerr << "Cannot write trace to " << path << std::endl;
+        }
+    }).detach();
+}
+
+// RequestTimer
+
+RequestTimer::RequestTimer(bool collect)
+    : _collect(collect), _id(next_request++), _start(std::chrono::steady_clock::now()), _previous(current)
+{
+    if (_collect || tracing_enabled())
+        current = this;
+}
+
+RequestTimer::~RequestTimer()
+{
+    if (current == this)
+        current = _previous;
+}
+
+std::string RequestTimer::server_timing() const
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    int stage = 0;
+    for (auto const &span : _spans)
+    {
+        if (span.stage)
+            out << "stage" << stage++ << ";desc=\"" << header_safe(span.name) << "\"";
+        else
+            out << span.name;
+        out << ";dur=" << span.ms << ", ";
+    }
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+    out << "total;dur=" << total;
+    return out.str();
+}
+
+json RequestTimer::timings() const
+{
+    json out = json::object();
+    int stage = 0;
+    for (auto const &span : _spans)
+    {
+        std::string key = span.stage ? std::to_string(stage++) + ":" + span.name : span.name;
+        out[key] = out.value(key, 0.0) + span.ms;
+    }
+    out["total"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+    return out;
+}
+
+RequestTimer const *RequestTimer::active()
+{
+    for (RequestTimer const *timer = current; timer; timer = timer->_previous)
+        if (timer->_collect)
+            return timer;
+    return nullptr;
+}
+
+// TraceScope
+
+TraceScope::TraceScope(std::string_view name, bool stage)
+    : _name(name), _stage(stage), _active(current != nullptr || tracing_enabled())
+{
+    if (_active)
+        _start = std::chrono::steady_clock::now();
+}
+
+TraceScope::~TraceScope()
+{
+    if (!_active)
+        return;
+
+    auto end = std::chrono::steady_clock::now();
+    if (current && current->_collect)
+        current->_spans.push_back({std::string(_name), _stage, std::chrono::duration<double, std::milli>(end - _start).count()});
+
+    if (!tracing_enabled())
+        return;
+
+    TraceEvent event{};
+    std::size_t length = std::min(_name.size(), sizeof(event.name) - 1);
+    std::memcpy(event.name, _name.data(), length);
+    event.stage = _stage;
+    event.tid = thread_id();
+    event.request = current ? current->_id : 0;
+    event.ts_us = micros(_start - process_start);
+    event.dur_us = micros(end - _start);
+
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    ring[ring_head] = event;
+    ring_head = (ring_head + 1) % ring.size();
+    ring_count = std::min(ring_count + 1, ring.size());
+}
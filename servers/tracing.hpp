@@ -0,0 +1,92 @@
+#ifndef MJ_TRACING_HPP
+#define MJ_TRACING_HPP
+
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mj {
+
+// Per-request timing and an optional process-wide trace.
+//
+// TraceScope marks a span (a request phase or a pipeline stage). Spans go to
+// the RequestTimer active on the calling thread, which turns them into a
+// Server-Timing header, and to the trace ring buffer when tracing is enabled.
+// With neither active a TraceScope costs one thread-local and one relaxed
+// atomic load and never reads the clock.
+
+// Starts recording spans into a ring buffer of `capacity` events
+void enable_tracing(std::size_t capacity);
+bool tracing_enabled();
+
+// Buffered spans as Chrome trace-event JSON (chrome://tracing, Perfetto)
+nlohmann::json trace_events(bool clear = false);
+bool dump_trace_file(std::string const &path);
+
+// SIGUSR1 writes vision_tools-trace-<pid>-<n>.json to the working directory.
+// Call from main() before any other thread starts, so they all inherit the
+// blocked signal and only the dedicated waiter thread receives it.
+void install_trace_signal();
+
+class RequestTimer
+{
+public:
+    // `collect` keeps this request's spans for server_timing()
+    explicit RequestTimer(bool collect);
+    ~RequestTimer();
+
+    RequestTimer(RequestTimer const &) = delete;
+    RequestTimer &operator=(RequestTimer const &) = delete;
+
+    // Server-Timing header value: phases by name, stages as stage<N> with
+    // the stage name in desc, then the total so far
+    std::string server_timing() const;
+
+    // The same spans as JSON milliseconds, stages keyed "<N>:<name>"
+    nlohmann::json timings() const;
+
+    // The innermost timer on this thread that collects spans, or nullptr
+    static RequestTimer const *active();
+
+    std::uint64_t id() const { return _id; }
+
+private:
+    friend class TraceScope;
+
+    struct Span
+    {
+        std::string name;
+        bool stage;
+        double ms;
+    };
+
+    bool _collect;
+    std::uint64_t _id;
+    std::chrono::steady_clock::time_point _start;
+    RequestTimer *_previous;
+    std::vector<Span> _spans;
+};
+
+class TraceScope
+{
+public:
+    // `name` must outlive the scope
+    explicit TraceScope(std::string_view name, bool stage = false);
+    ~TraceScope();
+
+    TraceScope(TraceScope const &) = delete;
+    TraceScope &operator=(TraceScope const &) = delete;
+
+private:
+    std::string_view _name;
+    bool _stage;
+    bool _active;
+    std::chrono::steady_clock::time_point _start;
+};
+
+} // namespace mj
+
+#endif // MJ_TRACING_HPP
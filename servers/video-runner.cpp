@@ -0,0 +1,282 @@
+#include "video-runner.hpp"
+#include "bounded-queue.hpp"
+#include "pipeline.hpp"
+#include "threading.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+struct Frame
+{
+    std::size_t index = 0;
+    cv::Mat image;
+    std::vector<unsigned char> encoded; // image sequence output, encoded by the worker
+};
+
+// Hands frames to the writer in index order. put() blocks while a frame is
+// `window` or more frames ahead of the writer, which bounds memory.
+class ReorderBuffer
+{
+public:
+    explicit ReorderBuffer(std::size_t window) : _window(std::max<std::size_t>(window, 1)) {}
+
+    bool put(Frame frame)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _space.wait(lock, [&] { return frame.index < _next + _window || _aborted; });
+        if (_aborted)
+            return false;
+        _frames.emplace(frame.index, std::move(frame));
+        _ready.notify_all();
+        return true;
+    }
+
+    // Next frame in order; nullopt after the last one or on abort()
+    std::optional<Frame> take()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [&] { return _aborted || _next >= _total || _frames.count(_next) > 0; });
+        if (_aborted || _next >= _total)
+            return std::nullopt;
+        auto it = _frames.find(_next);
+        Frame frame = std::move(it->second);
+        _frames.erase(it);
+        ++_next;
+        _space.notify_all();
+        return frame;
+    }
+
+    void set_total(std::size_t total)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _total = total;
+        _ready.notify_all();
+    }
+
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        _frames.clear();
+        _space.notify_all();
+        _ready.notify_all();
+    }
+
+private:
+    std::size_t _window;
+    std::size_t _next = 0;
+    std::size_t _total = std::numeric_limits<std::size_t>::max();
+    bool _aborted = false;
+    std::map<std::size_t, Frame> _frames;
+    std::mutex _mutex;
+    std::condition_variable _space;
+    std::condition_variable _ready;
+};
+
+int default_fourcc(fs::path const &output)
+{
+    std::string ext = output.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (ext == ".avi")
+        return cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    if (ext == ".webm")
+        return cv::VideoWriter::fourcc('V', 'P', '8', '0');
+    return cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+}
+
+bool is_sequence_output(std::string const &output)
+{
+    std::error_code ec;
+    return (!output.empty() && output.back() == '/') || fs::is_directory(output, ec);
+}
+
+fs::path sequence_path(std::string const &dir, std::size_t index, std::string const &format)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "frame_%06zu.", index);
+    return fs::path(dir) / (name + format);
+}
+
+} // namespace
+
+VideoReport mj::run_video(VideoOptions const &options, std::ostream &progress)
+{
+    VideoReport report;
+
+    std::unique_ptr<PipelinePlan const> plan;
+    try
+    {
+        plan = std::make_unique<PipelinePlan const>(canonicalize_pipeline(options.pipeline));
+    }
+    catch (const json::exception &e)
+    {
+        throw std::invalid_argument(std::string("Invalid pipeline: ") + e.what());
+    }
+
+    cv::VideoCapture capture(options.input);
+    if (!capture.isOpened())
+        throw std::invalid_argument("Cannot open video: " + options.input);
+
+    bool sequence = is_sequence_output(options.output);
+    std::string format = options.format.empty() ? "png" : options.format;
+    if (sequence)
+        fs::create_directories(options.output);
+
+    double fps = options.fps > 0 ? options.fps : capture.get(cv::CAP_PROP_FPS);
+    report.fps = fps > 0 ? fps : 30.0;
+    report.temporal = plan->temporal();
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    report.workers = report.temporal ? 1 : (options.workers > 0 ? options.workers : cores);
+    std::size_t window = options.window > 0 ? options.window : 2 * static_cast<std::size_t>(report.workers);
+    double frame_count = capture.get(cv::CAP_PROP_FRAME_COUNT);
+
+    if (report.temporal)
+        progress << "Pipeline has a temporal stage; processing frames in order on one worker" << std::endl;
+
+    BoundedQueue<Frame> to_process(static_cast<std::size_t>(report.workers), 1);
+    ReorderBuffer reorder(window);
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto fail = [&](std::exception_ptr e) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = e;
+        }
+        to_process.abort();
+        reorder.abort();
+    };
+
+    std::vector<std::thread> threads;
+
+    // Decoder: VideoCapture can only be read sequentially
+    threads.emplace_back([&] {
+        std::size_t index = 0;
+        try
+        {
+            for (;;)
+            {
+                Frame frame;
+                if (!capture.read(frame.image) || frame.image.empty())
+                    break;
+                frame.index = index++;
+                if (!to_process.push(std::move(frame)))
+                    break;
+            }
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+        reorder.set_total(index);
+        to_process.producer_done();
+    });
+
+    for (int i = 0; i < report.workers; ++i)
+        threads.emplace_back([&] {
+            while (auto frame = to_process.pop())
+            {
+                try
+                {
+                    {
+                        IntraOpScope scope(frame->image.total());
+                        frame->image = plan->run(frame->image);
+                    }
+                    if (sequence && !cv::imencode("." + format, frame->image, frame->encoded))
+                        throw std::runtime_error("Failed to encode frame " + std::to_string(frame->index));
+                    if (!reorder.put(std::move(*frame)))
+                        break;
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                    break;
+                }
+            }
+        });
+
+    // Writer: this thread, in frame order
+    auto start = std::chrono::steady_clock::now();
+    auto last_print = start;
+    auto elapsed = [&] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    auto print_progress = [&] {
+        progress << "\r" << report.frames;
+        if (frame_count > 0)
+            progress << "/" << static_cast<std::size_t>(frame_count);
+        progress << " frames, " << std::fixed << std::setprecision(1)
+                 << report.frames / std::max(elapsed(), 1e-3) << " frames/s" << std::flush;
+    };
+
+    cv::VideoWriter writer;
+    try
+    {
+        while (auto frame = reorder.take())
+        {
+            if (sequence)
+            {
+                fs::path path = sequence_path(options.output, frame->index, format);
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<const char *>(frame->encoded.data()), static_cast<std::streamsize>(frame->encoded.size()));
+                if (!out)
+                    throw std::runtime_error("Cannot write " + path.string());
+            }
+            else
+            {
+                if (!writer.isOpened())
+                {
+                    int fourcc = options.fourcc.size() == 4
+                                     ? cv::VideoWriter::fourcc(options.fourcc[0], options.fourcc[1], options.fourcc[2], options.fourcc[3])
+                                     : default_fourcc(options.output);
+                    report.size = frame->image.size();
+                    if (!writer.open(options.output, fourcc, report.fps, report.size, frame->image.channels() == 3))
+                        throw std::invalid_argument("Cannot open video writer for " + options.output);
+                }
+                writer.write(frame->image);
+            }
+            if (report.size.empty())
+                report.size = frame->image.size();
+            ++report.frames;
+
+            if (std::chrono::steady_clock::now() - last_print >= std::chrono::seconds(1))
+            {
+                print_progress();
+                last_print = std::chrono::steady_clock::now();
+            }
+        }
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+
+    for (auto &t : threads)
+        t.join();
+    writer.release();
+    print_progress();
+    progress << std::endl;
+    report.seconds = elapsed();
+
+    if (error)
+        std::rethrow_exception(error);
+    return report;
+}
@@ -0,0 +1,48 @@
+#ifndef MJ_VIDEO_RUNNER_HPP
+#define MJ_VIDEO_RUNNER_HPP
+
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace mj {
+
+// Video file mode. Frames are decoded in order by cv::VideoCapture, processed
+// by a pool of workers with the same plan the server uses, and written in
+// order by cv::VideoWriter or as a numbered image sequence. Decode, process
+// and encode overlap. Finished frames wait in a reorder buffer at most
+// `window` frames deep; workers that get further ahead wait.
+//
+// A plan with a temporal stage (PipelinePlan::temporal) runs on one worker so
+// it sees every frame in order.
+struct VideoOptions
+{
+    nlohmann::json pipeline;    // same keys as the HTTP request body
+    std::string input;          // video file or anything cv::VideoCapture opens
+    std::string output;         // video file, or a directory for an image sequence
+    std::string fourcc;         // codec for video output, empty = by extension
+    std::string format = "png"; // image sequence extension
+    double fps = 0;             // 0 = the input's (30 when unknown)
+    int workers = 0;            // 0 = CPU count
+    std::size_t window = 0;     // reorder depth, 0 = 2 x workers
+};
+
+struct VideoReport
+{
+    std::size_t frames = 0;
+    double seconds = 0;
+    double fps = 0;
+    cv::Size size;
+    bool temporal = false;
+    int workers = 0;
+};
+
+// Throws std::invalid_argument for a bad pipeline or unopenable input/output,
+// and rethrows the first frame processing error after stopping all stages.
+VideoReport run_video(VideoOptions const &options, std::ostream &progress);
+
+} // namespace mj
+
+#endif // MJ_VIDEO_RUNNER_HPP
@@ -0,0 +1,145 @@
+#include "warmup.hpp"
+#include "image-probe.hpp"
+#include "image-stats.hpp"
+#include "jpeg-yuv.hpp"
+#include "processor-registry.hpp"
+#include "region-decode.hpp"
+#include "threading.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+using json = nlohmann::json;
+using namespace mj;
+
+namespace {
+
+// Smooth areas, noise and hard edges, so codecs and filters take their usual paths
+cv::Mat synthetic_image(int size)
+{
+    cv::Mat image(size, size, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::GaussianBlur(image, image, cv::Size(0, 0), 2.0);
+    cv::rectangle(image, cv::Rect(size / 4, size / 4, size / 2, size / 2), cv::Scalar(40, 160, 220), cv::FILLED);
+    return image;
+}
+
+// Defaults, with small values for required numbers and a short text for the
+// first text parameter (Watermark's text, Overlay's text rather than logo)
+json warmup_params(StageDefinition const &definition)
+{
+    json params = json::object();
+    bool text = false;
+    for (StageParam const &param : definition.params)
+    {
+        if (param.type == StageParam::Type::String)
+        {
+            if (!text && (param.fallback.is_null() || param.fallback == ""))
+                params[param.name] = "warm-up";
+            text = true;
+        }
+        else if (param.fallback.is_null())
+        {
+            double value = std::max(param.min.value_or(0.0), 5.0);
+            params[param.name] = param.type == StageParam::Type::Int ? json(static_cast<int>(value)) : json(value);
+        }
+    }
+    return params;
+}
+
+// Runs `work`, counting it in `counter` or recording why it failed
+template <typename Work>
+void attempt(WarmupReport &report, int &counter, std::string const &what, Work &&work)
+{
+    try
+    {
+        work();
+        ++counter;
+    }
+    catch (const std::exception &e)
+    {
+        report.skipped.push_back(what + ": " + e.what());
+    }
+}
+
+void warm_thread(cv::Mat const &image, std::vector<std::shared_ptr<PipelinePlan const>> const &plans, WarmupReport &report)
+{
+    IntraOpScope threads(image.total());
+
+    ProcessorRegistry const &registry = processor_registry();
+    for (StageDefinition const &definition : registry.definitions())
+        attempt(report, report.stages, definition.op, [&] {
+            std::optional<json> params = registry.normalize(definition, warmup_params(definition), true);
+            if (!params)
+                throw std::invalid_argument("no parameters");
+            PipelinePlan plan(PipelineSpec{{definition.op, std::move(*params)}});
+            plan.run(image);
+        });
+
+    for (auto const &plan : plans)
+        attempt(report, report.stages, "plan " + plan->key(), [&] { plan->run(image); });
+
+    std::vector<unsigned char> jpeg;
+    for (std::string extension : {".jpg", ".png", ".webp"})
+        attempt(report, report.codecs, extension.substr(1), [&] {
+            std::vector<unsigned char> encoded;
+            if (!cv::imencode(extension, image, encoded))
+                throw std::runtime_error("cannot encode");
+            if (cv::imdecode(encoded, cv::IMREAD_COLOR).empty() || !probe_image_size(encoded))
+                throw std::runtime_error("cannot decode");
+            auto quarter = [](cv::Size full) { return cv::Rect(full.width / 4, full.height / 4, full.width / 2, full.height / 2); };
+            if (decode_region(encoded, quarter).empty())
+                throw std::runtime_error("cannot decode a region");
+            if (extension == ".jpg")
+                jpeg = std::move(encoded);
+        });
+    if (jpeg.empty())
+        return;
+
+    attempt(report, report.codecs, "reduced jpg", [&] {
+        for (int flags : {cv::IMREAD_REDUCED_COLOR_2, cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_8})
+            if (cv::imdecode(jpeg, flags).empty())
+                throw std::runtime_error("cannot decode");
+    });
+    attempt(report, report.codecs, "jpg yuv", [&] {
+        YuvImage yuv;
+        std::vector<unsigned char> encoded;
+        if (!decode_jpeg_yuv(jpeg, yuv) || !encode_jpeg_yuv(yuv, encoded))
+            throw std::runtime_error("needs libjpeg-turbo");
+    });
+    attempt(report, report.codecs, "analysis", [&] { analyze_image(image); });
+}
+
+} // namespace
+
+WarmupReport mj::warm_up(WarmupOptions const &options, std::vector<std::shared_ptr<PipelinePlan const>> const &plans)
+{
+    WarmupReport report;
+    if (options.size <= 0)
+        return report;
+
+    auto started = std::chrono::steady_clock::now();
+    cv::Mat image = synthetic_image(options.size);
+
+    // Every thread does the same work; the first one's counts are reported
+    std::vector<WarmupReport> reports(std::max(1, options.threads));
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < reports.size(); ++i)
+        threads.emplace_back(warm_thread, std::cref(image), std::cref(plans), std::ref(reports[i]));
+    warm_thread(image, plans, reports[0]);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    report = std::move(reports[0]);
+    report.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    return report;
+}
+
+json mj::warmup_json(WarmupReport const &report)
+{
+    return {{"ms", report.ms}, {"stages", report.stages}, {"codecs", report.codecs}, {"skipped", report.skipped}};
+}
@@ -0,0 +1,44 @@
+#ifndef MJ_WARMUP_HPP
+#define MJ_WARMUP_HPP
+
+#include <nlohmann/json.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "pipeline.hpp"
+
+namespace mj {
+
+// Startup warm-up. OpenCV's thread pools and dispatch tables, the codecs'
+// tables, the intra-op helper threads and the allocator's per-thread arenas
+// are all set up lazily, by whichever requests come first after a start.
+// Warm-up does that work on a synthetic image instead: it runs every
+// registered stage (with its defaults, and small values for required
+// parameters), every plan in `plans`, and every codec path a request can
+// take (imencode and imdecode in each format, reduced and region decodes,
+// the header probe, the JPEG YCbCr round trip and the analysis pass).
+//
+// `threads` copies run at once, each within an IntraOpScope like a request,
+// so each worker slot finds its pools and arenas already paged in.
+struct WarmupOptions
+{
+    int size = 1024; // side of the synthetic image, 0 = no warm-up
+    int threads = 1;
+};
+
+struct WarmupReport
+{
+    double ms = 0;
+    int stages = 0;                   // stages and plans run
+    int codecs = 0;                   // codec paths run
+    std::vector<std::string> skipped; // "<what>: <error>", for paths unavailable in this build
+};
+
+// Blocks until done. Failures are reported, not thrown.
+WarmupReport warm_up(WarmupOptions const &options, std::vector<std::shared_ptr<PipelinePlan const>> const &plans);
+
+nlohmann::json warmup_json(WarmupReport const &report);
+
+} // namespace mj
+
+#endif // MJ_WARMUP_HPP
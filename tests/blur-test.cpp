@@ -0,0 +1,124 @@
+#include "blur.hpp"
+#include "test-support.hpp"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// gaussian_blur against cv::GaussianBlur. Below the sigma threshold it is
+// OpenCV's own blur and must match exactly; at and above it the box cascade
+// must stay within blur.hpp's bounds, plus a level for each side's rounding,
+// for every pass count. Images cover 1, 3 and 4 channels, widths either side
+// of a 256-element column stripe, and images smaller than the kernel, which
+// are reflected many times over.
+
+namespace {
+
+// Within 4 grey levels of cv::GaussianBlur when the image is at least as
+// large as its kernel, within 10 when smaller
+constexpr double MAX_ERROR = 4;
+constexpr double MAX_ERROR_SMALL = 10;
+
+// cv::GaussianBlur's kernel size for 8-bit images
+int kernel_size(int ksize, double sigma)
+{
+    return ksize > 0 ? ksize : cvRound(sigma * 6 + 1) | 1;
+}
+
+// A step edge, a sinusoid and noise
+std::vector<cv::Mat> test_images(int rows, int cols, int cn)
+{
+    cv::Mat step(rows, cols, CV_8UC(cn), cv::Scalar::all(30));
+    step.colRange(cols / 2, cols).setTo(cv::Scalar::all(220));
+
+    cv::Mat plane(rows, cols, CV_8UC1), wave;
+    for (int y = 0; y < rows; ++y)
+        for (int x = 0; x < cols; ++x)
+            plane.at<unsigned char>(y, x) = cv::saturate_cast<unsigned char>(127.5 + 127.5 * std::sin(x / 7.0 + y / 11.0));
+    cv::merge(std::vector<cv::Mat>(cn, plane), wave);
+
+    return {step, wave, mj::test::random_image(rows, cols, CV_8UC(cn), static_cast<unsigned>(rows * cols + cn))};
+}
+
+double difference(cv::Mat const &src, int ksize, double sigma)
+{
+    cv::Mat out, expected;
+    mj::gaussian_blur(src, out, ksize, sigma);
+    cv::GaussianBlur(src, expected, cv::Size(ksize, ksize), sigma);
+    return mj::test::max_difference(out, expected);
+}
+
+// Mean of one period of the BORDER_REFLECT_101 image, which repeats the
+// inner rows and columns twice and the outer ones once, in every pixel
+cv::Mat period_mean(cv::Mat const &image)
+{
+    cv::Scalar sum = cv::Scalar::all(0);
+    double weights = 0;
+    for (int y = 0; y < image.rows; ++y)
+        for (int x = 0; x < image.cols; ++x)
+        {
+            double weight = (y == 0 || y == image.rows - 1 ? 1 : 2) * (x == 0 || x == image.cols - 1 ? 1 : 2);
+            cv::Vec3b const &pixel = image.at<cv::Vec3b>(y, x);
+            for (int c = 0; c < 3; ++c)
+                sum[c] += weight * pixel[c];
+            weights += weight;
+        }
+    return cv::Mat(image.size(), image.type(), cv::Scalar(sum[0] / weights, sum[1] / weights, sum[2] / weights));
+}
+
+struct Blur
+{
+    int ksize;
+    double sigma;
+};
+
+} // namespace
+
+int main()
+{
+    const std::vector<cv::Size> sizes = {{96, 64}, {86, 40}, {257, 130}, {300, 200}, {5, 7}, {30, 1}, {1, 30}};
+
+    // Below the threshold of 8, including a ksize whose derived sigma is just under it
+    const Blur exact[] = {{0, 7.9}, {49, 0}, {5, 0}, {0, 2.0}, {3, 1.5}};
+    // At the threshold, from sigma or from ksize (51 derives 8.0), and above it
+    const Blur approximate[] = {{0, 8.0}, {51, 0}, {0, 12.5}, {0, 20.0}, {0, 40.0}};
+
+    for (int passes : {3, 4, 5})
+    {
+        mj::set_blur_options({8.0, passes});
+        for (cv::Size size : sizes)
+            for (int cn : {1, 3, 4})
+                for (cv::Mat const &image : test_images(size.height, size.width, cn))
+                {
+                    for (Blur blur : exact)
+                        CHECK_AT(difference(image, blur.ksize, blur.sigma) == 0,
+                                 size.width << "x" << size.height << "x" << cn << ", ksize " << blur.ksize << ", sigma " << blur.sigma);
+
+                    for (Blur blur : approximate)
+                    {
+                        int kernel = kernel_size(blur.ksize, blur.sigma);
+                        double bound = std::min(size.width, size.height) >= kernel ? MAX_ERROR : MAX_ERROR_SMALL;
+                        double error = difference(image, blur.ksize, blur.sigma);
+                        CHECK_AT(error >= 0 && error <= bound, size.width << "x" << size.height << "x" << cn << ", ksize " << blur.ksize << ", sigma "
+                                                                          << blur.sigma << ", " << passes << " passes: " << error);
+                    }
+                }
+    }
+
+    // Box widths past 65k, where 32-bit running sums would wrap: the image is
+    // reflected so many times over that every pixel is its period's mean
+    mj::set_blur_options({8.0, 3});
+    for (cv::Size size : {cv::Size(30, 20), cv::Size(7, 5), cv::Size(64, 48)})
+    {
+        cv::Mat image = mj::test::random_image(size.height, size.width, CV_8UC3, 5), out;
+        mj::gaussian_blur(image, out, 0, 60000.0);
+        CHECK_AT(mj::test::max_difference(out, period_mean(image)) <= 1, size.width << "x" << size.height);
+    }
+
+    // A threshold of 0 turns the cascade off
+    mj::set_blur_options({0.0, 3});
+    for (cv::Mat const &image : test_images(64, 96, 3))
+        CHECK(difference(image, 0, 20.0) == 0);
+
+    return mj::test::result();
+}
@@ -0,0 +1,91 @@
+#include "jpeg-support.hpp"
+#include "region-decode.hpp"
+#include "test-support.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <cstdint>
+#include <vector>
+
+// EXIF parsing on hostile input. Offsets in the file are untrusted; one near
+// 2^32 used to wrap past the bounds checks and read far outside the marker.
+
+namespace {
+
+// `jpeg` with an APP1 Exif segment after SOI: a little-endian TIFF header
+// whose first IFD is at `ifd`, then `body`
+std::vector<unsigned char> with_exif(std::vector<unsigned char> const &jpeg, std::uint32_t ifd, std::vector<unsigned char> const &body)
+{
+    std::vector<unsigned char> exif = {'E', 'x', 'i', 'f', 0, 0, 'I', 'I', 0x2A, 0};
+    for (int shift = 0; shift < 32; shift += 8)
+        exif.push_back(static_cast<unsigned char>(ifd >> shift));
+    exif.insert(exif.end(), body.begin(), body.end());
+
+    std::size_t length = exif.size() + 2;
+    std::vector<unsigned char> out(jpeg.begin(), jpeg.begin() + 2);
+    out.insert(out.end(), {0xFF, 0xE1, static_cast<unsigned char>(length >> 8), static_cast<unsigned char>(length)});
+    out.insert(out.end(), exif.begin(), exif.end());
+    out.insert(out.end(), jpeg.begin() + 2, jpeg.end());
+    return out;
+}
+
+// An IFD with one entry: Orientation, SHORT, count 1
+std::vector<unsigned char> orientation_ifd(int orientation)
+{
+    return {1, 0, 0x12, 0x01, 3, 0, 1, 0, 0, 0, static_cast<unsigned char>(orientation), 0, 0, 0, 0, 0, 0, 0};
+}
+
+#ifdef MJ_HAVE_JPEG_CROP
+int read_orientation(std::vector<unsigned char> const &data)
+{
+    jpeg_decompress_struct cinfo;
+    mj::JpegError error;
+    cinfo.err = mj::quiet_jpeg_errors(error);
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data.data()), static_cast<unsigned long>(data.size()));
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+    jpeg_read_header(&cinfo, TRUE);
+    int orientation = mj::exif_orientation(cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return orientation;
+}
+#endif
+
+} // namespace
+
+int main()
+{
+    std::vector<unsigned char> jpeg;
+    CHECK(cv::imencode(".jpg", mj::test::random_image(64, 48, CV_8UC3), jpeg));
+    const cv::Rect region(8, 8, 16, 16);
+    auto region_for = [&](cv::Size) { return region; };
+
+    // IFD offsets past the segment, and an IFD claiming 65535 entries in 4 bytes
+    const std::vector<unsigned char> many_entries = {0xFF, 0xFF, 0, 0};
+    for (std::uint32_t ifd : {0xFFFFFFFEu, 0xFFFFFFF4u, 0x80000000u, 0xFFFFu, 8u})
+    {
+        std::vector<unsigned char> hostile = with_exif(jpeg, ifd, many_entries);
+#ifdef MJ_HAVE_JPEG_CROP
+        CHECK_AT(read_orientation(hostile) == 1, "IFD at " << ifd);
+#endif
+        cv::Mat expected = cv::imdecode(hostile, cv::IMREAD_COLOR);
+        CHECK_AT(!expected.empty(), "IFD at " << ifd);
+        if (!expected.empty())
+            CHECK_AT(mj::test::max_difference(mj::decode_region(hostile, region_for), expected(region)) == 0, "IFD at " << ifd);
+    }
+
+    // A well-formed orientation is still read
+    std::vector<unsigned char> rotated = with_exif(jpeg, 8, orientation_ifd(6));
+#ifdef MJ_HAVE_JPEG_CROP
+    CHECK(read_orientation(rotated) == 6);
+#endif
+    cv::Mat expected = cv::imdecode(rotated, cv::IMREAD_COLOR);
+    CHECK(expected.size() == cv::Size(64, 48));
+    if (expected.size() == cv::Size(64, 48))
+        CHECK(mj::test::max_difference(mj::decode_region(rotated, region_for), expected(region)) == 0);
+
+    return mj::test::result();
+}
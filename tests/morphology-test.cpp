@@ -0,0 +1,82 @@
+#include "morphology.hpp"
+#include "test-support.hpp"
+#include <opencv2/imgproc.hpp>
+#include <vector>
+
+// morphology_rect against cv::morphologyEx with a MORPH_RECT element, which
+// it must match exactly: odd and even kernels (an even one sits off-centre,
+// so the border on each side differs), kernels either side of the VHGW
+// cutover (9), sizes either side of a 512-byte column stripe, kernels larger
+// than the image, and views into a larger image.
+
+namespace {
+
+const int OPS[] = {cv::MORPH_DILATE, cv::MORPH_ERODE, cv::MORPH_OPEN, cv::MORPH_CLOSE, cv::MORPH_GRADIENT};
+
+cv::Mat expected(cv::Mat const &src, int op, cv::Size ksize)
+{
+    cv::Mat out;
+    cv::morphologyEx(src, out, op, cv::getStructuringElement(cv::MORPH_RECT, ksize));
+    return out;
+}
+
+void compare(cv::Mat const &src, cv::Size ksize, char const *what)
+{
+    for (int op : OPS)
+    {
+        cv::Mat out;
+        mj::morphology_rect(src, out, op, ksize);
+        CHECK_AT(mj::test::max_difference(out, expected(src, op, ksize)) == 0,
+                 what << " " << src.cols << "x" << src.rows << "x" << src.channels() << ", kernel " << ksize.width << "x" << ksize.height << ", op " << op);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    const std::vector<cv::Size> kernels = {{1, 1}, {2, 2}, {3, 3}, {8, 8},  {9, 9},   {10, 10}, {9, 1},
+                                           {1, 9}, {8, 15}, {15, 8}, {16, 9}, {31, 31}, {64, 17}};
+
+    for (int cn : {1, 3, 4})
+    {
+        // 512 bytes per row is one column stripe exactly
+        const int stripe = 512 / cn;
+        const std::vector<cv::Size> sizes = {{1, 1}, {5, 7}, {47, 33}, {stripe, 20}, {stripe + 1, 20}, {stripe - 1, 12}};
+        for (cv::Size size : sizes)
+        {
+            cv::Mat src = mj::test::random_image(size.height, size.width, CV_8UC(cn), static_cast<unsigned>(size.area() + cn));
+            for (cv::Size ksize : kernels)
+                compare(src, ksize, "random");
+        }
+
+        // A view: rows are not contiguous and the pixels around it must not leak in
+        cv::Mat big = mj::test::random_image(80, 90, CV_8UC(cn), 7);
+        for (cv::Size ksize : kernels)
+            compare(big(cv::Rect(13, 9, 50, 41)), ksize, "view");
+
+        // Kernels far larger than the image; the largest would not fit in
+        // memory unclamped, so it is compared with the 2 * size - 1 it is
+        // equivalent to
+        cv::Mat small = mj::test::random_image(7, 5, CV_8UC(cn), 11);
+        compare(small, cv::Size(40, 40), "large kernel");
+        compare(small, cv::Size(1000, 3), "large kernel");
+        for (int op : OPS)
+        {
+            cv::Mat out;
+            mj::morphology_rect(small, out, op, cv::Size(1 << 30, 1 << 30));
+            CHECK_AT(mj::test::max_difference(out, expected(small, op, cv::Size(9, 13))) == 0, "huge kernel, op " << op << ", " << cn << " channels");
+        }
+    }
+
+    // Other depths are passed through to OpenCV
+    for (int type : {CV_16UC1, CV_32FC3})
+    {
+        cv::Mat src(30, 40, type);
+        cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(1000));
+        compare(src, cv::Size(9, 9), "passed through");
+        compare(src, cv::Size(12, 5), "passed through");
+    }
+
+    return mj::test::result();
+}
@@ -0,0 +1,112 @@
+#include "pipeline.hpp"
+#include "presets.hpp"
+#include "processor-registry.hpp"
+#include "test-support.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Every compiled-in StaticPipeline against the dynamic chain it replaces,
+// which it must match exactly. PipelinePlan checks that on one 128x96 probe
+// only; here each recipe runs with several parameter sets on images of other
+// sizes (odd, tiny, wider than tall and the reverse), on views, and with
+// Resize scaling down, up and to the same size.
+
+namespace {
+
+using json = nlohmann::json;
+
+// A stage with its parameters normalized as a request's would be
+mj::StageSpec stage(std::string const &op, json params = json::object())
+{
+    mj::ProcessorRegistry const &registry = mj::processor_registry();
+    return {op, *registry.normalize(*registry.find(op), params, true)};
+}
+
+std::vector<mj::PipelineSpec> specs()
+{
+    const std::vector<json> resizes = {{{"width", 64}, {"height", 48}}, {{"width", 301}, {"height", 199}}, {{"width", 1}, {"height", 1}}};
+    const int kernels[] = {1, 3, 5, 15, 51};
+    const json tones[] = {{{"brightness", -40}, {"contrast", 1.7}}, {{"brightness", 25}, {"contrast", 0.5}}, {{"brightness", 0}, {"contrast", 1.0}}};
+    const double gammas[] = {0.45, 1.0, 2.2};
+    const json text = {{"text", "sample"}};
+
+    std::vector<mj::PipelineSpec> out;
+    for (json const &size : resizes)
+    {
+        for (int k : kernels)
+        {
+            out.push_back({stage("Grayscale"), stage("Resize", size), stage("Blur", {{"kernel_size", k}})});
+            out.push_back({stage("Resize", size), stage("Blur", {{"kernel_size", k}})});
+        }
+        out.push_back({stage("Grayscale"), stage("Resize", size)});
+        out.push_back({stage("Resize", size), stage("Sharpen")});
+        out.push_back({stage("Resize", size), stage("Sharpen"), stage("Watermark", text)});
+        out.push_back({stage("Resize", size), stage("Watermark", text)});
+        for (json const &tone : tones)
+            out.push_back({stage("Resize", size), stage("BrightnessContrast", tone), stage("GammaCorrection", {{"gamma", 2.2}})});
+    }
+    for (json const &tone : tones)
+    {
+        for (double gamma : gammas)
+            out.push_back({stage("BrightnessContrast", tone), stage("GammaCorrection", {{"gamma", gamma}})});
+        out.push_back({stage("Grayscale"), stage("BrightnessContrast", tone)});
+    }
+    return out;
+}
+
+} // namespace
+
+int main()
+{
+    // Each recipe is covered
+    std::vector<std::string> recipes = mj::static_recipes();
+    std::vector<mj::PipelineSpec> all = specs();
+    for (std::string const &recipe : recipes)
+    {
+        bool found = false;
+        for (mj::PipelineSpec const &spec : all)
+        {
+            std::string name;
+            for (mj::StageSpec const &s : spec)
+                name += (name.empty() ? "" : "+") + s.op;
+            found = found || name == recipe;
+        }
+        CHECK_AT(found, "no test for recipe " << recipe);
+    }
+
+    const std::vector<cv::Size> sizes = {{128, 96}, {64, 48}, {301, 199}, {97, 255}, {1, 1}, {3, 40}, {640, 17}};
+    cv::Mat big = mj::test::random_image(260, 330, CV_8UC3, 3);
+    for (mj::PipelineSpec const &spec : all)
+    {
+        mj::PipelinePlan plan(spec);
+        CHECK_AT(mj::compile_static(spec) && plan.specialized(), "not specialized: " << plan.key());
+
+        std::vector<cv::Mat> images;
+        for (cv::Size size : sizes)
+            images.push_back(mj::test::random_image(size.height, size.width, CV_8UC3, static_cast<unsigned>(size.area())));
+        // A view: rows are not contiguous
+        images.push_back(big(cv::Rect(17, 11, 251, 203)));
+
+        for (cv::Mat const &image : images)
+            CHECK_AT(mj::test::max_difference(plan.run(image), plan.run_chain(image)) == 0,
+                     plan.key() << " on " << image.cols << "x" << image.rows);
+    }
+
+    // The probe runs large Resize targets at the probe's size, so this compiles
+    // without allocating full frames; larger targets are refused outright
+    mj::PipelinePlan large({stage("Resize", {{"width", 16384}, {"height", 16384}}), stage("Blur", {{"kernel_size", 3}})});
+    CHECK(large.specialized());
+    bool refused = false;
+    try
+    {
+        stage("Resize", {{"width", 16385}, {"height", 10}});
+    }
+    catch (const std::invalid_argument &)
+    {
+        refused = true;
+    }
+    CHECK(refused);
+
+    return mj::test::result();
+}
@@ -0,0 +1,71 @@
+#ifndef MJ_TEST_SUPPORT_HPP
+#define MJ_TEST_SUPPORT_HPP
+
+#include <opencv2/core.hpp>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Minimal checks for the ctest executables: a failed CHECK prints where and
+// why and the test keeps going; main returns mj::test::result().
+namespace mj::test {
+
+inline int &failures()
+{
+    static int count = 0;
+    return count;
+}
+
+inline void fail(char const *file, int line, std::string const &what)
+{
+    ++failures();
+    std::cerr << file << ":" << line << ": FAILED " << what << std::endl;
+}
+
+inline int result()
+{
+    if (failures() > 0)
+        std::cerr << failures() << " check(s) failed" << std::endl;
+    return failures() > 0 ? 1 : 0;
+}
+
+// Largest absolute difference of two images of the same size and type, -1
+// when they differ in size, type or channel count
+inline double max_difference(cv::Mat const &a, cv::Mat const &b)
+{
+    if (a.size() != b.size() || a.type() != b.type())
+        return -1;
+    return a.empty() ? 0 : cv::norm(a, b, cv::NORM_INF);
+}
+
+// Random 8-bit image, the same for the same arguments
+inline cv::Mat random_image(int rows, int cols, int type, unsigned seed = 1)
+{
+    cv::Mat image(rows, cols, type);
+    cv::RNG rng(seed);
+    rng.fill(image, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    return image;
+}
+
+} // namespace mj::test
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+            mj::test::fail(__FILE__, __LINE__, #condition); \
+    } while (false)
+
+// CHECK with a description of the case, e.g. CHECK_AT(a == b, "kernel " << k)
+#define CHECK_AT(condition, context) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::ostringstream where_; \
+            where_ << #condition << " [" << context << "]"; \
+            mj::test::fail(__FILE__, __LINE__, where_.str()); \
+        } \
+    } while (false)
+
+#endif // MJ_TEST_SUPPORT_HPP
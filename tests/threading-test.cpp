@@ -0,0 +1,96 @@
+#include "threading.hpp"
+#include "test-support.hpp"
+#include <opencv2/core/utility.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Several request threads, each in an IntraOpScope, run cv::parallel_for_
+// loops whose bodies run cv::parallel_for_ again. With the budgeted backend
+// the inner loops run inside helper-pool jobs; every loop must finish and
+// cover its range exactly once.
+
+namespace {
+
+constexpr int OUTER = 64;
+constexpr int INNER = 256;
+constexpr int REQUESTS = 6;
+constexpr int ROUNDS = 20;
+
+long long nested_sum()
+{
+    std::atomic<long long> sum{0};
+    cv::parallel_for_(cv::Range(0, OUTER), [&](const cv::Range &outer) {
+        for (int i = outer.start; i < outer.end; ++i)
+            cv::parallel_for_(cv::Range(0, INNER), [&](const cv::Range &inner) {
+                long long local = 0;
+                for (int j = inner.start; j < inner.end; ++j)
+                    local += static_cast<long long>(i) * INNER + j;
+                sum += local;
+            });
+    });
+    return sum;
+}
+
+} // namespace
+
+int main()
+{
+    mj::ThreadingOptions options;
+    options.intra_op_threads = 4;
+    mj::configure_threading(options, 2);
+#ifdef MJ_EXPECT_PARALLEL_BACKEND
+    CHECK(mj::threading_metrics()["backend"] == "mj-budgeted");
+#endif
+
+    // A deadlock would otherwise hang until the ctest timeout
+    std::atomic<bool> finished{false};
+    std::thread watchdog([&] {
+        for (int i = 0; i < 600 && !finished; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!finished)
+        {
+            std::cerr << "Nested parallel_for_ did not finish within 60 s" << std::endl;
+            std::_Exit(1);
+        }
+    });
+
+    const long long n = static_cast<long long>(OUTER) * INNER;
+    const long long expected = n * (n - 1) / 2;
+    std::vector<int> wrong(REQUESTS, 0);
+    std::vector<std::thread> requests;
+    for (int r = 0; r < REQUESTS; ++r)
+        requests.emplace_back([&, r] {
+            mj::IntraOpScope scope(std::size_t(1) << 22);
+            for (int round = 0; round < ROUNDS; ++round)
+                wrong[r] += nested_sum() != expected;
+        });
+    for (std::thread &request : requests)
+        request.join();
+
+    // A failing body reaches the caller and leaves the pool usable
+    bool thrown = false;
+    try
+    {
+        mj::IntraOpScope scope(std::size_t(1) << 22);
+        cv::parallel_for_(cv::Range(0, 16), [](const cv::Range &range) {
+            if (range.start <= 7 && 7 < range.end)
+                throw std::runtime_error("stage failed");
+        });
+    }
+    catch (const std::exception &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(nested_sum() == expected);
+
+    finished = true;
+    watchdog.join();
+    for (int r = 0; r < REQUESTS; ++r)
+        CHECK_AT(wrong[r] == 0, "request " << r << ", " << wrong[r] << " wrong sums");
+    return mj::test::result();
+}